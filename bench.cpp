@@ -0,0 +1,298 @@
+/*
+  CPUのマイクロベンチマーク (make bench)
+  - ROMファイルなしで動かせるように、カーネルごとに小さなゲストの
+    プログラムを組み立ててシステムROMのイメージにし、CPU::exec()で
+    決まったクロック数だけ実行する
+  - 1命令あたりのホスト側の時間(ns)を報告する。コアの速度を変えた
+    時は、変更の前後でこれを比べる
+  - カーネルは無限ループなので、ビジーウェイトの検出で飛ばされない
+    命令を必ず含める
+
+  usage: bench [-j] [clks] [kernel...]
+ */
+#include <cstdio> // for printf()
+#include <cstdlib> // for strtol()
+#include <cstring> // for memset(), strcmp()
+#include <chrono> // for steady_clock
+#include <initializer_list>
+#include "memory.h"
+#include "io.h"
+#include "cpu.h"
+#include "pic.h"
+#include "event.h"
+
+#define SLICE_CLKS 280000
+#define BENCH_CLKS 50000000 // カーネルごとに実行するクロック数
+
+// ROMのイメージ(64KB)はf000:0000から。コードはf000:e000から置く
+#define ROM_SIZE 0x10000
+#define CODE_OFF 0xe000
+#define GDT_OFF 0xd000
+
+// ゲストのコードの組み立て
+class Asm {
+public:
+	u8 rom[ROM_SIZE];
+	u32 pc; // f000からのオフセット
+
+	Asm() {
+		memset(rom, 0xff, ROM_SIZE);
+		pc = CODE_OFF;
+		// リセットベクタ: JMP f000:e000
+		rom[0xfff0] = 0xea;
+		rom[0xfff1] = CODE_OFF & 0xff;
+		rom[0xfff2] = CODE_OFF >> 8;
+		rom[0xfff3] = 0x00;
+		rom[0xfff4] = 0xf0;
+	}
+	void b(std::initializer_list<int> l) {
+		for (int d : l) {
+			rom[pc++] = d;
+		}
+	}
+	void w(u16 d) { b({d & 0xff, d >> 8}); }
+	// JMP rel8/Jcc rel8 (opは0xebか0x7x)
+	void jmp8(u8 op, u32 target) { b({op, (u8)(target - (pc + 2))}); }
+	// 前方へのJMP rel8。飛び先はあとでlabel()で決める
+	u32 fwd8(void) { b({0xeb, 0}); return pc - 1; }
+	void label(u32 at) { rom[at] = pc - (at + 1); }
+	// 共通の準備: CLI, DS=ES=SS=0, SP=7000
+	void setup(void) {
+		b({0xfa}); // cli
+		b({0x31, 0xc0}); // xor ax, ax
+		b({0x8e, 0xd8}); // mov ds, ax
+		b({0x8e, 0xc0}); // mov es, ax
+		b({0x8e, 0xd0}); // mov ss, ax
+		b({0xbc}); w(0x7000); // mov sp, 7000
+	}
+};
+
+// ADD/XOR/AND/OR/SUB/INCのレジスタ同士の演算
+static void k_alu(Asm &a)
+{
+	u32 top;
+
+	a.setup();
+	top = a.pc;
+	a.b({0x01, 0xd8}); // add ax, bx
+	a.b({0x31, 0xc2}); // xor dx, ax
+	a.b({0x43}); // inc bx
+	a.b({0x21, 0xd0}); // and ax, dx
+	a.b({0x09, 0xde}); // or si, bx
+	a.b({0x29, 0xf0}); // sub ax, si
+	a.b({0x66, 0x01, 0xcf}); // add edi, ecx
+	a.b({0xd1, 0xe2}); // shl dx, 1
+	a.jmp8(0xeb, top);
+}
+
+// いろいろなModR/Mでのメモリの読み書き
+static void k_modrm(Asm &a)
+{
+	u32 top;
+
+	a.setup();
+	a.b({0xbb}); a.w(0x1000); // mov bx, 1000
+	a.b({0xbe}); a.w(0x0010); // mov si, 0010
+	a.b({0xbf}); a.w(0x0020); // mov di, 0020
+	top = a.pc;
+	a.b({0x8b, 0x07}); // mov ax, [bx]
+	a.b({0x89, 0x47, 0x02}); // mov [bx+2], ax
+	a.b({0x8b, 0x50, 0x04}); // mov dx, [bx+si+4]
+	a.b({0x01, 0x16}); a.w(0x0600); // add [0600], dx
+	a.b({0x8b, 0x87}); a.w(0x0100); // mov ax, [bx+0100]
+	a.b({0x89, 0x85}); a.w(0x0200); // mov [di+0200], ax
+	a.b({0x66, 0x8b, 0x0f}); // mov ecx, [bx]
+	a.b({0x67, 0x66, 0x89, 0x4c, 0x5e, 0x08}); // mov [esi+ebx*2+8], ecx
+	a.b({0x80, 0x47, 0x01, 0x03}); // add byte [bx+1], 3
+	a.jmp8(0xeb, top);
+}
+
+// REP MOVSW/STOSW/CMPSB
+static void k_string(Asm &a)
+{
+	u32 top;
+
+	a.setup();
+	a.b({0xfc}); // cld
+	top = a.pc;
+	a.b({0xb9}); a.w(256); // mov cx, 256
+	a.b({0xbe}); a.w(0x1000); // mov si, 1000
+	a.b({0xbf}); a.w(0x2000); // mov di, 2000
+	a.b({0xf3, 0xa5}); // rep movsw
+	a.b({0xb9}); a.w(256); // mov cx, 256
+	a.b({0xbf}); a.w(0x3000); // mov di, 3000
+	a.b({0xf3, 0xab}); // rep stosw
+	a.b({0xb9}); a.w(512); // mov cx, 512
+	a.b({0xbe}); a.w(0x1000); // mov si, 1000
+	a.b({0xbf}); a.w(0x2000); // mov di, 2000
+	a.b({0xf3, 0xa6}); // repe cmpsb
+	a.jmp8(0xeb, top);
+}
+
+// CALL far/RETFと、呼ばれた先でのセグメントレジスタのロード
+static void k_farcall(Asm &a)
+{
+	u32 top, func, skip;
+
+	a.setup();
+	skip = a.fwd8();
+	func = a.pc;
+	a.b({0x8c, 0xd8}); // mov ax, ds
+	a.b({0x8e, 0xc0}); // mov es, ax
+	a.b({0x1e}); // push ds
+	a.b({0x1f}); // pop ds
+	a.b({0xcb}); // retf
+	a.label(skip);
+	top = a.pc;
+	a.b({0x9a}); a.w(func); a.w(0xf000); // call f000:func
+	a.b({0x41}); // inc cx
+	a.jmp8(0xeb, top);
+}
+
+// リアルモードとプロテクトモード(16bit)の行き来
+static void k_modesw(Asm &a)
+{
+	static const u8 gdt[] = {
+		0, 0, 0, 0, 0, 0, 0, 0,
+		0xff, 0xff, 0x00, 0x00, 0x0f, 0x9b, 0x00, 0x00, // 08: コード f0000
+		0xff, 0xff, 0x00, 0x00, 0x00, 0x93, 0x00, 0x00, // 10: データ 0
+	};
+	u32 top, pm, rm;
+
+	memcpy(a.rom + GDT_OFF, gdt, sizeof(gdt));
+	// GDTR (limit, base)
+	a.rom[GDT_OFF + 0x20] = sizeof(gdt) - 1;
+	a.rom[GDT_OFF + 0x21] = 0;
+	a.rom[GDT_OFF + 0x22] = GDT_OFF & 0xff;
+	a.rom[GDT_OFF + 0x23] = GDT_OFF >> 8;
+	a.rom[GDT_OFF + 0x24] = 0x0f;
+	a.rom[GDT_OFF + 0x25] = 0;
+
+	a.setup();
+	a.b({0x2e, 0x0f, 0x01, 0x16}); a.w(GDT_OFF + 0x20); // lgdt cs:[gdtr]
+	top = a.pc;
+	a.b({0x0f, 0x20, 0xc0}); // mov eax, cr0
+	a.b({0x0c, 0x01}); // or al, 1
+	a.b({0x0f, 0x22, 0xc0}); // mov cr0, eax
+	pm = a.pc + 5;
+	a.b({0xea}); a.w(pm); a.w(0x0008); // jmp 0008:pm
+	a.b({0xb8}); a.w(0x0010); // mov ax, 0010
+	a.b({0x8e, 0xd8}); // mov ds, ax
+	a.b({0x0f, 0x20, 0xc0}); // mov eax, cr0
+	a.b({0x24, 0xfe}); // and al, fe
+	a.b({0x0f, 0x22, 0xc0}); // mov cr0, eax
+	rm = a.pc + 5;
+	a.b({0xea}); a.w(rm); a.w(0xf000); // jmp f000:rm
+	a.b({0x31, 0xc0}); // xor ax, ax
+	a.b({0x8e, 0xd8}); // mov ds, ax
+	a.jmp8(0xeb, top);
+}
+
+// INT n/IRETの往復 (リアルモード)
+static void k_int(Asm &a)
+{
+	u32 top, handler, skip;
+
+	a.setup();
+	skip = a.fwd8();
+	handler = a.pc;
+	a.b({0x41}); // inc cx
+	a.b({0xcf}); // iret
+	a.label(skip);
+	a.b({0xc7, 0x06}); a.w(0x80 * 4); a.w(handler); // mov [0200], handler
+	a.b({0xc7, 0x06}); a.w(0x80 * 4 + 2); a.w(0xf000); // mov [0202], f000
+	top = a.pc;
+	a.b({0xcd, 0x80}); // int 80
+	a.b({0x42}); // inc dx
+	a.jmp8(0xeb, top);
+}
+
+static const struct {
+	const char *name;
+	void (*build)(Asm &a);
+} kernels[] = {
+	{"alu", k_alu},
+	{"modrm", k_modrm},
+	{"string", k_string},
+	{"farcall", k_farcall},
+	{"modesw", k_modesw},
+	{"int", k_int},
+};
+
+// カーネルを組み立てて、clksクロック実行した時間(秒)を返す
+static double run(void (*build)(Asm &a), s32 clks, bool jit, u64 *insns)
+{
+	Asm *a = new Asm;
+	std::chrono::steady_clock::time_point t0;
+	double sec;
+
+	build(*a);
+	Memory mem((u32)0x600000, a->rom, ROM_SIZE);
+	pSUMOT::IO io(0x10000);
+	PIC pic;
+	CPU cpu(&mem);
+	Event ev(&cpu);
+	io.set_ev(&ev);
+	cpu.reset();
+#ifdef USE_JIT
+	cpu.set_jit(jit);
+#endif
+	delete a;
+
+	t0 = std::chrono::steady_clock::now();
+	for (s32 n = 0; n < clks; n += SLICE_CLKS) {
+		cpu.remains_clks += SLICE_CLKS;
+		cpu.exit_clks = 0;
+		do {
+			ev.check0();
+			cpu.remains_clks = cpu.exec();
+			ev.check();
+		} while (cpu.remains_clks > 0);
+	}
+	sec = std::chrono::duration<double>(
+		std::chrono::steady_clock::now() - t0).count();
+	*insns = cpu.get_insns();
+	return sec;
+}
+
+int main(int argc, char *argv[])
+{
+	s32 clks = BENCH_CLKS;
+	bool jit = false;
+	int first = 1, nr_names = 0;
+	u64 insns;
+	double sec;
+
+	for (; first < argc && argv[first][0] == '-'; first++) {
+		if (strcmp(argv[first], "-j") == 0) {
+#ifdef USE_JIT
+			jit = true;
+#else
+			printf("JIT is not compiled in (build with -DUSE_JIT)\n");
+			return 1;
+#endif
+		}
+	}
+	if (first < argc && argv[first][0] >= '0' && argv[first][0] <= '9') {
+		clks = strtol(argv[first++], NULL, 0);
+	}
+	nr_names = argc - first;
+
+	printf("%-8s %12s %9s %8s %8s\n",
+	       "kernel", "insns", "ms", "ns/insn", "MIPS");
+	for (auto &k : kernels) {
+		bool sel = (nr_names == 0);
+		for (int i = first; i < argc; i++) {
+			sel |= (strcmp(argv[i], k.name) == 0);
+		}
+		if (!sel) {
+			continue;
+		}
+		sec = run(k.build, clks, jit, &insns);
+		printf("%-8s %12llu %9.1f %8.2f %8.1f\n", k.name,
+		       (unsigned long long)insns, sec * 1e3,
+		       sec * 1e9 / insns, insns / sec / 1e6);
+	}
+
+	return 0;
+}
@@ -9,6 +9,7 @@ BUS *BUS::mem = 0;
 BUS *BUS::io = 0;
 BUS *BUS::dmac = 0;
 BUS *BUS::cdc = 0;
+BUS *BUS::pic = 0;
 Event *BUS::ev = 0;
 
 BUS* BUS::get_bus(const char *s) {
@@ -21,6 +22,9 @@ BUS* BUS::get_bus(const char *s) {
 	if (strcmp(s, "dmac") == 0) {
 		return dmac;
 	}
+	if (strcmp(s, "pic") == 0) {
+		return pic;
+	}
 	return 0;
 }
 
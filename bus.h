@@ -16,6 +16,7 @@ protected:
 	static BUS *io;
 	static BUS *dmac;
 	static BUS *cdc;
+	static BUS *pic;
 	static Event *ev;
 public:
 	/*-----
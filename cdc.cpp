@@ -2,11 +2,14 @@
 #include <fstream>
 #include "cdc.h"
 #include "event.h"
+#include "pic.h"
 
 #define STATUS 0x20
 #define IRQ 0x40
 #define SIRQ 0x80
 #define SRQ 0x01
+#define SMIC 0x80 // マスターコントロール: SIRQをクリアする
+#define CDC_IRQ 9
 
 u8 CDC::srq_count;
 CDC::msf CDC::start_msf;
@@ -38,6 +41,13 @@ u8 CDC::read8(u32 addr) {
 void CDC::write8(u32 addr, u8 data) {
 	switch (addr & 0xf) {
 	case 0x0: // マスターコントロール
+		if (data & SMIC) {
+			master_status &= ~SIRQ;
+			if (pic) {
+				((PIC *)pic)->set_irq(CDC_IRQ, false);
+			}
+		}
+		// fall through
 	case 0x2: // コマンドレジスタ書き込み
 		switch (data & 0x1f) {
 		case 0x0: // xxx ready?
@@ -95,8 +105,9 @@ void CDC::write8(u32 addr, u8 data) {
 			srq_count++;
 		}
 		if (data & IRQ) { //コマンドステータス要求時のIRQ制御
-			//INTXXX
+			// 割り込みはコマンドの処理時間分遅らせて上げる
 			master_status |= SIRQ;
+			ev->add(300, raise_irq);
 		}
 		break;
 	case 0x4: // パラメータレジスタ書き込み
@@ -113,6 +124,12 @@ void CDC::read_1sector(void) {
 	srq_count++;
 }
 
+void CDC::raise_irq(void) {
+	if (pic) {
+		((PIC *)pic)->set_irq(CDC_IRQ, true);
+	}
+}
+
 /*
 u16 CDC::read16(u32 addr) {
 	return 0;
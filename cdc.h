@@ -21,6 +21,7 @@ public:
 	u8 read8(u32 addr);
 	void write8(u32 addr, u8 data);
 	static void read_1sector(void);
+	static void raise_irq(void);
   /*
 	u16 read16(u32 addr);
 	void write16(u32 addr, u16 data);
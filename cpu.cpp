@@ -1,21 +1,42 @@
 #include <cstdio> // for printf()
+#include <cstdlib> // for exit()
+#include <algorithm> // for std::min()
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h> // for string_find()
+#endif
 #include "cpu.h"
 #include "cpu_macros.h"
 #include "cpu_clocks.h"
+#include "jit.h"
+#include "sampler.h"
 
 using namespace std; // for printf()
 
 CPU::CPU(BUS* bus) {
-	mem = bus->get_bus("mem");
+	mem = (Memory *)bus->get_bus("mem");
 	io = bus->get_bus("io");
 	dmac = (DMAC *)bus->get_bus("dmac");
+	pic = (PIC *)bus->get_bus("pic");
+	intr_pending = 0;
+	intr_shadow = false;
+	halted = false;
+	idle_clks = 0;
+	spin.head = 0;
+	spin.len = 0;
+	spin.ok = false;
+	spin.valid = false;
+	mem->subscribe_gen(spin_gen_hook, this);
+	if (pic) {
+		pic->connect(&intr_pending);
+	}
 
 	// バイト同士の演算によるフラグSF/ZF/PF/CFの状態をあらかじめ算出する
 	// キャリーフラグ算出のため、配列長は9ビットである
+	// (ZFは下位8ビットで判定する。0x100はCF=1, ZF=1)
 	for (int i = 0; i < 0x200; i++) {
 		u8 sf, zf, pf, cf;
 		sf = (i & 0x80)? SF : 0;
-		zf = (i == 0)? ZF : 0;
+		zf = (i & 0xff)? 0 : ZF;
 		pf = i;
 		pf ^= pf >> 4;
 		pf ^= pf >> 2;
@@ -24,20 +45,7 @@ CPU::CPU(BUS* bus) {
 		cf = (i & 0x100)? CF : 0;
 		flag_calb[i] = sf | zf | pf | cf;
 	}
-	// ワード同士の演算によるフラグSF/ZF/PF/CFの状態をあらかじめ算出する
-	// キャリーフラグ算出のため、配列長は17ビットである
-	for (int i = 0; i < 0x20000; i++) {
-		u8 sf, zf, pf, cf;
-		sf = (i & 0x8000)? SF : 0;
-		zf = (i == 0)? ZF : 0;
-		pf = (u8)(i & 0xff); // パリティは下位8ビットのみチェックする
-		pf ^= pf >> 4;
-		pf ^= pf >> 2;
-		pf ^= pf >> 1;
-		pf = (pf & 1)? 0 : PF;
-		cf = (i & 0x10000)? CF : 0;
-		flag_calw[i] = sf | zf | pf | cf;
-	}
+	// ワード同士の演算によるフラグは表を持たずにFLAG_CALw()で求める
 	// ダブルワード同士の演算をあらかじめ算出しておくには、配列長33ビットの
 	// 配列を用意しなければならないため現実的ではない。
 	// そのため、ダブルワード同士の演算によるフラグはその都度算出する。
@@ -51,6 +59,30 @@ CPU::CPU(BUS* bus) {
 		pf = (pf & 1)? 0 : PF;
 		pflag_cal[i] = pf;
 	}
+
+	for (int i = 0; i < ICACHE_SIZE; i++) {
+		icache[i].len = 0;
+	}
+	ic_len = 0;
+
+	for (int i = 0; i < DESC_CACHE_SIZE; i++) {
+		desc_cache[i].gen = 0;
+	}
+	desc_gen = 1;
+
+	for (int i = 0; i < 256; i++) {
+		gate_cache[i].gen = 0;
+	}
+	idt_gen = 1;
+
+	trace = NULL;
+	sampler = NULL;
+	insns = 0;
+
+#ifdef USE_JIT
+	jit = new JIT(this, mem);
+	jit_enabled = false;
+#endif
 }
 
 void CPU::reset() {
@@ -60,6 +92,14 @@ void CPU::reset() {
 
 	for (int i = 0; i < NR_SEGREG; i++) segreg[i] = 0x0000;
 	for (int i = 0; i < 4; i++) cr[i] = 0;
+	mem->set_paging(false);
+	mem->set_cr3(0);
+	idtr.base = 0;
+	idtr.limit = 0x3ff;
+	idt_gen++;
+	tr = 0;
+	tr_base = 0;
+	tr_type = 0;
 	segreg[CS] = 0xf000;
 	eip = 0xfff0;
 	edx = 0x672; // xxxなんか入れないとだめみたい
@@ -73,16 +113,518 @@ void CPU::reset() {
 	  セグメントディスクリプタキャッシュのセグメントベースはcs<<4に戻る?
 	 */
 	sdcr[CS].base = 0xffff0000;
+	cpu_mode = MODE_RM16;
 	flag8 = 0;
+#ifdef LAZY_FLAGS
+	lf_op = LF_NONE;
+#endif
 	cr[0] = 0x60000010;
 
 	remains_clks = 0;
+	intr_shadow = false;
+	halted = false;
 
 #ifdef CORE_DAS
 	DAS_hlt = false;
 #endif
 }
 
+#ifdef LAZY_FLAGS
+// 遅延していたCFを求める
+// ADD/SUBのバイト、ワードは結果の9, 17ビット目がそのままCF
+u8 CPU::lazy_cf(void)
+{
+	u32 r = lf_res, s = lf_src, d = lf_dst;
+
+	switch (lf_op) {
+	case LF_ADD:
+		if (lf_size == LF_d) {
+			return ((d >> 1) + (s >> 1) + (((d & 1) + (s & 1) + lf_cry) >> 1)) >> 31;
+		}
+		return r >> (8 << lf_size) & 1;
+	case LF_SUB:
+		if (lf_size == LF_d) {
+			return ((r >> 1) + (s >> 1) + (((r & 1) + (s & 1) + lf_cry) >> 1)) >> 31;
+		}
+		return r >> (8 << lf_size) & 1;
+	case LF_LOG:
+		return 0;
+	case LF_INCDEC:
+		return lf_cry;
+	}
+	return flag8 & CF;
+}
+
+// 遅延していたフラグを求めてflag8とflagu8のOFに反映する
+void CPU::lazy_flags(void)
+{
+	u32 r = lf_res, s = lf_src, d = lf_dst;
+	u32 msb, of;
+	u8 f;
+
+	msb = 0x80 << ((8 << lf_size) - 8);
+	f = pflag_cal[r & 0xff];
+	f |= (r & (msb | (msb - 1)))? 0 : ZF;
+	f |= (r & msb)? SF : 0;
+	f |= lazy_cf();
+
+	switch (lf_op) {
+	case LF_ADD:
+		f |= (d ^ s ^ r) & AF;
+		of = (r ^ s) & (r ^ d) & msb;
+		break;
+	case LF_SUB:
+		f |= (d ^ s ^ r) & AF;
+		of = (d ^ r) & (d ^ s) & msb;
+		break;
+	case LF_INCDEC:
+		// xxx OFの計算がNP2と違う (FLAG_INCDECと同じ)
+		f |= (d ^ r) & AF;
+		of = (d ^ r) & msb;
+		break;
+	default: // LF_LOG
+		of = 0;
+		break;
+	}
+	flag8 = f;
+	of? flagu8 |= OFSET8 : flagu8 &= ~OFSET8;
+	lf_op = LF_NONE;
+}
+#endif
+
+/*
+  外部割り込み(INTR)を受け付ける
+  - PICから割り込み番号を受け取って割り込む
+ */
+void CPU::intr(void)
+{
+	if (halted) {
+		// 戻り先をHLTの次の命令にする
+		eip++;
+		halted = false;
+	}
+	interrupt(pic->ack(), 0);
+}
+
+/*
+  IDTのゲートを引く
+  - xxx タスクゲート、IDTのリミット外、存在しないゲートは未実装
+    (本来は#GP, #NP)
+ */
+struct CPU::_gate *CPU::get_gate(u8 n)
+{
+	struct _gate *g = &gate_cache[n];
+	u32 adr = idtr.base + n * 8;
+	u32 lo, hi;
+
+	if (g->gen == idt_gen && g->page_gen == mem->get_page_gen(adr)) {
+		return g;
+	}
+	if (n * 8 + 7 > idtr.limit) {
+		printf("INT 0x%02x: out of IDT limit\n", n);
+		exit(1);
+	}
+	lo = mem->read32(adr);
+	hi = mem->read32(adr + 4);
+	g->offset = (hi & 0xffff0000) | (lo & 0xffff);
+	g->sel = lo >> 16;
+	g->type = hi >> 8 & 0x1f; // Sビットも含める
+	g->dpl = hi >> 13 & 3;
+	if (!(hi & 0x8000) || (g->type & 0x16) != 0x06) {
+		printf("INT 0x%02x: unsupported gate (0x%08x%08x)\n", n, hi, lo);
+		exit(1);
+	}
+
+	// ページをまたがず、書き込みを監視できるゲートだけ登録する
+	g->gen = 0;
+	if ((adr & PAGE_MASK) <= PAGE_SIZE - 8 && mem->watch_page(adr)) {
+		g->gen = idt_gen;
+		g->page_gen = mem->get_page_gen(adr);
+	}
+	return g;
+}
+
+/*
+  割り込み/例外
+  - リアルモードはIVT(リニアアドレス0)から、プロテクトモードはIDTの
+    ゲートから飛ぶ
+  - 呼ぶ前にeipを戻り先にしておくこと
+  - lenはINT n, INT 3, INTOの命令長(外部割り込みと例外は0)。
+    ゲートのDPLがCPLより小さければ、eipを命令の先頭に戻して#GP
+  - errが0以上ならエラーコードを積む
+  - プロテクトモードではゲートのサイズ(286/386)でスタックに積む。
+    内側の特権レベルに移る場合は、TSSから得たスタックに切り替えて
+    元のSS:ESPを積む
+ */
+void CPU::interrupt(u8 n, u8 len, s32 err)
+{
+	struct _gate *g;
+	u32 flags, old_cs, old_eip, old_ss, old_esp;
+	u8 cpl, dpl;
+	bool d32;
+
+	LF_SYNC();
+	spin.valid = false;
+	flags = eflagsu16 << 16 | flagu8 << 8 | flag8;
+
+	if (isRealMode) {
+		clks -= CLK_INT;
+		PUSHW0((u16)flags);
+		PUSHW0(segreg[CS]);
+		PUSHW0(ip);
+		flagu8 &= ~(TFSET8 | IFSET8);
+		eip = mem->read16(n * 4);
+		update_segreg(CS, mem->read16(n * 4 + 2));
+		if (sampler) {
+			sampler->call(get_seg_adr(CS, ip), esp);
+		}
+		return;
+	}
+
+	g = get_gate(n);
+	cpl = segreg[CS] & 3;
+	if (len > 0 && g->dpl < cpl) {
+		eip -= len;
+		interrupt(13, 0, n * 8 + 2); // #GP
+		return;
+	}
+	d32 = g->type & 0x08;
+	old_cs = segreg[CS];
+	old_eip = eip;
+	old_ss = segreg[SS];
+	old_esp = esp;
+
+	update_segreg(CS, g->sel);
+	// コンフォーミングコードセグメントならCPLは変わらない
+	dpl = (sdcr[CS].attr & 0x04)? cpl : sdcr[CS].attr >> 5 & 3;
+	segreg[CS] = (segreg[CS] & ~3) | dpl;
+
+	if (dpl < cpl) {
+		clks -= CLK_PM_INT_PRIV;
+		if (tr_type & 0x08) { // 386TSS
+			update_segreg(SS, mem->read16(tr_base + 8 + dpl * 8));
+			esp = mem->read32(tr_base + 4 + dpl * 8);
+		} else { // 286TSS
+			update_segreg(SS, mem->read16(tr_base + 4 + dpl * 4));
+			esp = mem->read16(tr_base + 2 + dpl * 4);
+		}
+		if (d32) {
+			PUSHD(old_ss);
+			PUSHD(old_esp);
+		} else {
+			PUSHW(old_ss);
+			PUSHW(old_esp);
+		}
+	} else {
+		clks -= CLK_PM_INT;
+	}
+	if (d32) {
+		PUSHD(flags);
+		PUSHD(old_cs);
+		PUSHD(old_eip);
+		if (err >= 0) {
+			PUSHD(err);
+		}
+		eip = g->offset;
+	} else {
+		PUSHW(flags);
+		PUSHW(old_cs);
+		PUSHW(old_eip);
+		if (err >= 0) {
+			PUSHW(err);
+		}
+		eip = g->offset & 0xffff;
+	}
+	flagu8 &= ~(TFSET8 | NTSET8);
+	eflagsu16 &= ~0x3; // RF, VM
+	if (!(g->type & 1)) { // 割り込みゲート
+		flagu8 &= ~IFSET8;
+	}
+	if (sampler) {
+		sampler->call(get_seg_adr(CS, eip), esp);
+	}
+}
+
+/*
+  プロテクトモードのIRET
+  - 戻り先のCSのRPLがCPLより大きければ、外側の特権レベルに戻るので
+    SS:ESPも戻す
+  - xxx NT(タスクからの戻り)、V86モードへの戻りは未実装。IOPL, IFの
+    変更の特権チェックはしない
+ */
+void CPU::iret(void)
+{
+	u32 new_eip, new_cs, new_flags, new_esp, new_ss;
+	bool d32 = (opsize == size32);
+	u8 cpl = segreg[CS] & 3;
+
+	LF_SYNC();
+	if (flagu8 & NTSET8) {
+		printf("IRET: nested task is not supported\n");
+		exit(1);
+	}
+	if (sampler) {
+		sampler->ret(esp);
+	}
+	if (d32) {
+		POPD(new_eip);
+		POPD(new_cs);
+		POPD(new_flags);
+	} else {
+		POPW(new_eip);
+		POPW(new_cs);
+		POPW(new_flags);
+	}
+	if ((new_cs & 3) > cpl) {
+		clks -= CLK_PM_IRET_PRIV;
+		if (d32) {
+			POPD(new_esp);
+			POPD(new_ss);
+		} else {
+			POPW(new_esp);
+			POPW(new_ss);
+		}
+		update_segreg(SS, (u16)new_ss);
+		if (d32) {
+			esp = new_esp;
+		} else {
+			sp = (u16)new_esp;
+		}
+	} else {
+		clks -= CLK_PM_IRET;
+	}
+	update_segreg(CS, (u16)new_cs);
+	eip = d32? new_eip : new_eip & 0xffff;
+	if (d32) {
+		eflagsu16 = (new_flags >> 16) & ~0x2; // VM
+	}
+	flagu8 = (u8)(new_flags >> 8);
+	flag8 = new_flags & 0xff;
+}
+
+// ページの世代が進んだら、判定したループを捨てる (Memory::subscribe_gen())
+void CPU::spin_gen_hook(void *arg, u32 page)
+{
+	CPU *cpu = (CPU *)arg;
+
+	if (page == PAGE_ALL || page == cpu->spin.head >> PAGE_SHIFT) {
+		cpu->spin.len = 0;
+		cpu->spin.valid = false;
+	}
+}
+
+/*
+  ループ本体(p[0]～p[len - 1])が飛ばせる命令だけでできているか
+  - 最後の2バイトはループの分岐命令(Jcc rel8, JMP rel8, LOOP rel8)
+  - カウンタのレジスタをspin.counterに設定する
+ */
+bool CPU::spin_decode(const u8 *p, u8 len)
+{
+	u8 immv = (cpu_mode == MODE_PM32)? 4 : 2;
+	u8 i = 0, br;
+	bool dec_last = false; // 最後にフラグを変えたのがDEC
+
+	spin.counter = -1;
+	while (i + 2 < len) {
+		switch (p[i]) {
+		case 0xec: case 0xed: // IN AL/eAX, DX
+		case 0x90: // NOP
+			i++;
+			break;
+		case 0xe4: case 0xe5: // IN AL/eAX, imm8
+			i += 2;
+			break;
+		case 0xa0: case 0xa1: // MOV AL/eAX, moffs
+			i += 1 + immv;
+			break;
+		case 0xa8: case 0x3c: case 0x24: // TEST/CMP/AND AL, imm8
+			i += 2;
+			dec_last = false;
+			break;
+		case 0xa9: case 0x3d: case 0x25: // TEST/CMP/AND eAX, imm
+			i += 1 + immv;
+			dec_last = false;
+			break;
+		case 0x84: case 0x85: // TEST AL, AL / TEST eAX, eAX
+			if (p[i + 1] != 0xc0) {
+				return false;
+			}
+			i += 2;
+			dec_last = false;
+			break;
+		case 0xf3: // PAUSE
+			if (p[i + 1] != 0x90) {
+				return false;
+			}
+			i += 2;
+			break;
+		case 0x48: case 0x49: case 0x4a: case 0x4b:
+		case 0x4c: case 0x4d: case 0x4e: case 0x4f: // DEC r
+			if (spin.counter >= 0) {
+				return false;
+			}
+			spin.counter = p[i] & 7;
+			i++;
+			dec_last = true;
+			break;
+		default:
+			return false;
+		}
+	}
+	if (i + 2 != len) {
+		return false;
+	}
+	br = p[i];
+	if (br == 0xe2) { // LOOP (CXがカウンタ)
+		if (spin.counter >= 0) {
+			return false;
+		}
+		spin.counter = 1;
+		return true;
+	}
+	if (br != 0xeb && (br & 0xf0) != 0x70) {
+		return false;
+	}
+	// DECの結果で分岐するなら、0になるまで回るJNZだけ
+	return !dec_last || br == 0x75;
+}
+
+/*
+  短い後方分岐が成立した時に呼ぶ(eipは分岐先)
+ */
+void CPU::spin_check(s8 rel)
+{
+	u32 head = get_seg_adr(CS, eip);
+	u8 len = -rel;
+	u8 buf[SPIN_BODY_MAX];
+	s32 iter;
+	u32 k, kmax;
+	int diff = -1;
+
+	if (trace || (intr_pending && (flagu8 & IFSET8))) {
+		spin.valid = false;
+		return;
+	}
+	// ループのあるページの世代が進んだらspin_gen_hook()がlenを0にする
+	if (spin.head != head || spin.len != len) {
+		spin.head = head;
+		spin.len = len;
+		spin.valid = false;
+		spin.ok = false;
+		if ((head & PAGE_MASK) + len > PAGE_SIZE ||
+		    !mem->watch_page(head)) {
+			return;
+		}
+		for (int i = 0; i < len; i++) {
+			buf[i] = mem->read8(head + i);
+		}
+		spin.ok = spin_decode(buf, len);
+	}
+	if (!spin.ok) {
+		return;
+	}
+
+	if (spin.valid) {
+		// 前回からレジスタがどう変わったか
+		for (int i = 0; i < NR_GENREG; i++) {
+			if (reg[i].reg32 == spin.reg[i]) {
+				continue;
+			}
+			if (diff >= 0 || i != spin.counter ||
+			    spin.reg[i] - reg[i].reg32 != 1 ||
+			    reg[i].reg16.upper16 != spin.reg[i] >> 16) {
+				diff = -2;
+				break;
+			}
+			diff = i;
+		}
+		iter = spin.clks - clks;
+		if (diff == -1 && iter == 0 && clks > exit_clks) {
+			// クロックを消費しないループ(JMP $など)は、そのままでは
+			// いつまでも終わらないので、次のイベントまで進める
+			idle_clks += clks - exit_clks;
+			clks = exit_clks;
+		} else if (diff != -2 && iter > 0 && clks > exit_clks) {
+			// 最後の1回は普通に実行して、途中の命令で止まる場合も
+			// 1命令ずつ実行した場合と同じ位置で止まるようにする
+			k = (clks - exit_clks - 1) / iter;
+			if (diff >= 0) {
+				kmax = reg[diff].reg16.lower16;
+				kmax = (kmax > 0)? kmax - 1 : 0;
+				if (k > kmax) {
+					k = kmax;
+				}
+				reg[diff].reg32 -= k;
+			}
+			clks -= (s32)(k * iter);
+			idle_clks += (u64)k * iter;
+		}
+	}
+	for (int i = 0; i < NR_GENREG; i++) {
+		spin.reg[i] = reg[i].reg32;
+	}
+	spin.clks = clks;
+	spin.valid = true;
+}
+
+/*
+  命令実行前の状態をトレースに記録する
+  - 命令の先頭(プリフィックスがあればプリフィックスの位置)で呼ぶ
+  - 命令長はプリフィックスの0x66, 0x67を反映してinsn_len()で求める。
+    求められない命令は(プリフィックスと)1バイト目だけを記録する
+ */
+void CPU::trace_insn(void)
+{
+	struct trace_head *r;
+	u8 **rpage = mem->get_rpage();
+	u8 buf[TRACE_MAX_LEN];
+	SIZEPRFX save_opsize = opsize, save_addrsize = addrsize;
+	u32 lin, len;
+	u8 *p;
+	int i;
+
+	lin = get_seg_adr(CS, isRealMode? ip : eip);
+	r = trace->want(lin);
+	if (r == NULL) {
+		return;
+	}
+	LF_SYNC();
+
+	r->lin = lin;
+	r->pc = eip;
+	r->eflags = eflagsu16 << 16 | flagu8 << 8 | flag8;
+	for (i = 0; i < NR_GENREG; i++) {
+		r->reg[i] = genregd(i);
+	}
+	for (i = 0; i < NR_SEGREG; i++) {
+		r->sreg[i] = segreg[i];
+	}
+	// MMIOを読むと副作用があるので、ホスト側のメモリにある場合だけ読む
+	for (i = 0; i < TRACE_MAX_LEN; i++) {
+		p = rpage[(lin + i) >> PAGE_SHIFT];
+		buf[i] = p? p[(lin + i) & PAGE_MASK] : 0;
+	}
+	for (len = 0; len < TRACE_MAX_LEN - 1; len++) {
+		switch (buf[len]) {
+		case 0x66:
+			opsize = (save_opsize == size16)? size32 : size16;
+			continue;
+		case 0x67:
+			addrsize = (save_addrsize == size16)? size32 : size16;
+			continue;
+		case 0x26: case 0x2e: case 0x36: case 0x3e: case 0x64: case 0x65:
+		case 0xf0: case 0xf2: case 0xf3:
+			continue;
+		}
+		break;
+	}
+	i = insn_len(buf + len, TRACE_MAX_LEN - len);
+	opsize = save_opsize;
+	addrsize = save_addrsize;
+	r->len = len + (i? i : 1);
+	memcpy(r->bytes, buf, r->len);
+}
+
 #ifdef CORE_DAS // CORE_DAS stands for cpu CORE DisASsembler
 /*
   以下の様なレジスタの状態を出力する
@@ -97,6 +639,7 @@ void CPU::DAS_dump_reg() {
 	if (op_continue) {
 		return;
 	}
+	LF_SYNC();
 
 	printf("\n");
 	for (i = 0; i < 4; i++) {
@@ -149,7 +692,7 @@ void CPU::DAS_prt_post_op(u8 n) {
 		return;
 	}
 	for (i = 0; i < n; i++)
-		printf(" %02x", mem->read8(get_seg_adr(CS, eip + i)));
+		printf(" %02x", fetch8(eip + i));
 	for (i = 0; i < 5 - n; i++)
 		printf("%3c", ' ');
 }
@@ -197,7 +740,7 @@ void CPU::DAS_modrm(u8 modrm, bool isReg, bool isDest, REGSIZE regsize) {
 	// [disp16]
 	if (addrsize == size16 && rm == 6 && mod == 0) {
 		printf("[0x%04x]%s",
-		       mem->read16(get_seg_adr(CS, eip + 1)),
+		       fetch16(eip + 1),
 		       isDest?"\n":", ");
 		return;
 	}
@@ -205,7 +748,7 @@ void CPU::DAS_modrm(u8 modrm, bool isReg, bool isDest, REGSIZE regsize) {
 	// [disp32]
 	if (addrsize == size32 && rm == 5 && mod == 0) {
 		printf("[0x%08x]%s",
-		       mem->read32(get_seg_adr(CS, eip + 1)),
+		       fetch32(eip + 1),
 		       isDest?"\n":", ");
 		return;
 	}
@@ -215,7 +758,7 @@ void CPU::DAS_modrm(u8 modrm, bool isReg, bool isDest, REGSIZE regsize) {
 	// <SIB>
 	// 参考文献 (7)2-9 xxx インデックスがESPの時はなしになるらしい
 	if (addrsize == size32 && rm == 4) {
-		sib = mem->read8(get_seg_adr(CS, ++tip));
+		sib = fetch8(++tip);
 		idx = sib >> 3 & 7;
 		base = sib & 7;
 		sprintf(addressing_str[1][4],
@@ -228,14 +771,14 @@ void CPU::DAS_modrm(u8 modrm, bool isReg, bool isDest, REGSIZE regsize) {
 
 	// + disp
 	if (mod == 1) {
-		sprintf(disp, " + 0x%02x", mem->read8(get_seg_adr(CS, ++tip)));
+		sprintf(disp, " + 0x%02x", fetch8(++tip));
 	} else if (mod == 2) {
 		if (addrsize == size16) {
 			sprintf(disp, " + 0x%04x",
-				mem->read16(get_seg_adr(CS, ++tip)));
+				fetch16(++tip));
 		} else {
 			sprintf(disp, " + 0x%08x",
-				mem->read32(get_seg_adr(CS, ++tip)));
+				fetch32(++tip));
 		}
 	} else {
 		disp[0] = '\0';
@@ -251,6 +794,7 @@ void CPU::DAS_modrm(u8 modrm, bool isReg, bool isDest, REGSIZE regsize) {
 
 #define DAS_pr(...) if (!op_continue) printf(__VA_ARGS__)
 #define OP_CONTINUE() op_continue = true
+#define OP_CONTINUE_END() op_continue = false
 
 #else
 #define DAS_dump_reg()
@@ -258,6 +802,7 @@ void CPU::DAS_modrm(u8 modrm, bool isReg, bool isDest, REGSIZE regsize) {
 #define DAS_modrm(m, isR, isD, isW)
 #define DAS_pr(...)
 #define OP_CONTINUE()
+#define OP_CONTINUE_END()
 #endif // CORE_DAS
 
 // modR/Mに続くディスプレースメントのバイト数を返す
@@ -292,14 +837,261 @@ u8 CPU::nr_disp_modrm(u8 modrm) {
 	else if (mod == 3)
 		return 0;
 
-	if (rm == 4)
+	if (rm == 4) {
+		// SIBのベースが101でmodが00の場合はdisp32が続く
+		// (eipはModR/Mをポイントしていること)
+		if (mod == 0 && (fetch8(eip + 1) & 7) == 5)
+			return 4 + 1;
 		return tmp + 1;
+	}
 
 	if (mod == 0 && rm == 5) return 4;
 
 	return tmp;
 }
 
+/*
+  命令長を求める
+  - pから始まるnバイトの中で命令長を求める。プリフィックスは1命令とみなす
+  - nバイトに収まらない命令、解釈できない命令は0を返す
+  - 命令キャッシュの登録にだけ使うので、長めに見積もっても害はない
+    (キャッシュされたバイト列より後ろはメモリからフェッチされる)
+ */
+u8 CPU::insn_len(const u8 *p, u32 n)
+{
+	u32 len = 1, imm = 0;
+	u8 op, immv;
+	bool has_modrm = false;
+
+	immv = (opsize == size16)? 2 : 4;
+	op = p[0];
+
+	switch (op) {
+	// オペランドなし
+	case 0x06: case 0x07: case 0x0e: case 0x16: case 0x17: case 0x1e: case 0x1f:
+	case 0x26: case 0x27: case 0x2e: case 0x2f: case 0x36: case 0x37: case 0x3e: case 0x3f:
+	case 0x40: case 0x41: case 0x42: case 0x43: case 0x44: case 0x45: case 0x46: case 0x47:
+	case 0x48: case 0x49: case 0x4a: case 0x4b: case 0x4c: case 0x4d: case 0x4e: case 0x4f:
+	case 0x50: case 0x51: case 0x52: case 0x53: case 0x54: case 0x55: case 0x56: case 0x57:
+	case 0x58: case 0x59: case 0x5a: case 0x5b: case 0x5c: case 0x5d: case 0x5e: case 0x5f:
+	case 0x60: case 0x61: case 0x66: case 0x67:
+	case 0x90: case 0x91: case 0x92: case 0x93: case 0x94: case 0x95: case 0x96: case 0x97:
+	case 0x98: case 0x99: case 0x9b: case 0x9c: case 0x9d: case 0x9e: case 0x9f:
+	case 0xa4: case 0xa5: case 0xa6: case 0xa7: case 0xaa: case 0xab: case 0xac: case 0xad:
+	case 0xae: case 0xaf: case 0xc3: case 0xcb: case 0xcc: case 0xce: case 0xcf: case 0xd7:
+	case 0xec: case 0xed: case 0xee: case 0xef:
+	case 0xf0: case 0xf2: case 0xf3: case 0xf4: case 0xf5:
+	case 0xf8: case 0xf9: case 0xfa: case 0xfb: case 0xfc: case 0xfd:
+		break;
+	// ModR/Mのみ
+	case 0x00: case 0x01: case 0x02: case 0x03: case 0x08: case 0x09: case 0x0a: case 0x0b:
+	case 0x10: case 0x11: case 0x12: case 0x13: case 0x18: case 0x19: case 0x1a: case 0x1b:
+	case 0x20: case 0x21: case 0x22: case 0x23: case 0x28: case 0x29: case 0x2a: case 0x2b:
+	case 0x30: case 0x31: case 0x32: case 0x33: case 0x38: case 0x39: case 0x3a: case 0x3b:
+	case 0x84: case 0x85: case 0x86: case 0x87: case 0x88: case 0x89: case 0x8a: case 0x8b:
+	case 0x8c: case 0x8d: case 0x8e: case 0x8f: case 0xc4: case 0xc5:
+	case 0xd0: case 0xd1: case 0xd2: case 0xd3: case 0xfe: case 0xff:
+		has_modrm = true;
+		break;
+	// ModR/M + imm8
+	case 0x80: case 0x82: case 0x83: case 0xc0: case 0xc1: case 0xc6:
+		has_modrm = true;
+		imm = 1;
+		break;
+	// ModR/M + imm16/imm32
+	case 0x81: case 0xc7:
+		has_modrm = true;
+		imm = immv;
+		break;
+	// TEST r/m, immはsubopが0, 1の時だけ即値がある
+	case 0xf6: case 0xf7:
+		if (n < 2) {
+			return 0;
+		}
+		has_modrm = true;
+		if ((p[1] >> 3 & 7) < 2) {
+			imm = (op == 0xf6)? 1 : immv;
+		}
+		break;
+	// imm8 (rel8, port含む)
+	case 0x04: case 0x0c: case 0x14: case 0x1c: case 0x24: case 0x2c: case 0x34: case 0x3c:
+	case 0x6a: case 0xa8: case 0xcd: case 0xd4: case 0xd5: case 0xeb:
+	case 0x70: case 0x71: case 0x72: case 0x73: case 0x74: case 0x75: case 0x76: case 0x77:
+	case 0x78: case 0x79: case 0x7a: case 0x7b: case 0x7c: case 0x7d: case 0x7e: case 0x7f:
+	case 0xb0: case 0xb1: case 0xb2: case 0xb3: case 0xb4: case 0xb5: case 0xb6: case 0xb7:
+	case 0xe0: case 0xe1: case 0xe2: case 0xe3: case 0xe4: case 0xe5: case 0xe6: case 0xe7:
+		imm = 1;
+		break;
+	// imm16/imm32 (rel16/rel32含む)
+	case 0x05: case 0x0d: case 0x15: case 0x1d: case 0x25: case 0x2d: case 0x35: case 0x3d:
+	case 0x68: case 0xa9: case 0xe8: case 0xe9:
+	case 0xb8: case 0xb9: case 0xba: case 0xbb: case 0xbc: case 0xbd: case 0xbe: case 0xbf:
+		imm = immv;
+		break;
+	// imm16
+	case 0xc2: case 0xca:
+		imm = 2;
+		break;
+	// moffs
+	case 0xa0: case 0xa1: case 0xa2: case 0xa3:
+		imm = (addrsize == size16)? 2 : 4;
+		break;
+	// ptr16:16 (ptr16:32)
+	case 0x9a: case 0xea:
+		imm = 2 + immv;
+		break;
+	// 2バイト命令
+	case 0x0f:
+		if (n < 2) {
+			return 0;
+		}
+		len = 2;
+		switch (p[1]) {
+		case 0x06: case 0xa0: case 0xa1: case 0xa8: case 0xa9:
+			break;
+		case 0x00: case 0x01: case 0x02: case 0x03: case 0x20: case 0x21: case 0x22: case 0x23:
+		case 0x90: case 0x91: case 0x92: case 0x93: case 0x94: case 0x95: case 0x96: case 0x97:
+		case 0x98: case 0x99: case 0x9a: case 0x9b: case 0x9c: case 0x9d: case 0x9e: case 0x9f:
+		case 0xa3: case 0xa5: case 0xab: case 0xad: case 0xaf: case 0xb3: case 0xbb:
+		case 0xb6: case 0xb7: case 0xbe: case 0xbf: case 0xbc: case 0xbd:
+			has_modrm = true;
+			break;
+		case 0xa4: case 0xac: case 0xba:
+			has_modrm = true;
+			imm = 1;
+			break;
+		case 0x80: case 0x81: case 0x82: case 0x83: case 0x84: case 0x85: case 0x86: case 0x87:
+		case 0x88: case 0x89: case 0x8a: case 0x8b: case 0x8c: case 0x8d: case 0x8e: case 0x8f:
+			imm = immv;
+			break;
+		default:
+			return 0;
+		}
+		break;
+	default:
+		return 0;
+	}
+
+	if (has_modrm) {
+		u8 modrm, mod, rm;
+
+		if (len >= n) {
+			return 0;
+		}
+		modrm = p[len++];
+		mod = modrm >> 6;
+		rm = modrm & 7;
+		if (mod != 3) {
+			if (addrsize == size16) {
+				if (mod == 1) {
+					len += 1;
+				} else if (mod == 2 || rm == 6) {
+					len += 2;
+				}
+			} else {
+				if (rm == 4) {
+					// SIB
+					if (len >= n) {
+						return 0;
+					}
+					if (mod == 0 && (p[len] & 7) == 5) {
+						len += 4;
+					}
+					len++;
+				}
+				if (mod == 1) {
+					len += 1;
+				} else if (mod == 2 || rm == 5) {
+					len += 4;
+				}
+			}
+		}
+	}
+	len += imm;
+
+	return (len <= n)? len : 0;
+}
+
+// 命令キャッシュを引き、ic_eip, ic_len, ic_bytesを実行する命令に合わせる
+// ミスした場合は命令長を求めて登録する
+void CPU::icache_lookup(void)
+{
+	u32 lin, n;
+	u8 mode, len;
+	u8 buf[ICACHE_MAX_LEN];
+	struct _icache *e;
+
+	lin = get_seg_adr(CS, isRealMode? ip : eip);
+	mode = opsize | addrsize << 1 | isRealMode << 2;
+	e = &icache[lin & (ICACHE_SIZE - 1)];
+	ic_eip = eip;
+
+	if (e->len && e->adr == lin && e->mode == mode &&
+	    e->gen == mem->get_page_gen(lin)) {
+		ic_len = e->len;
+		ic_bytes = e->bytes;
+		return;
+	}
+
+	e->len = 0;
+	ic_len = 0;
+	if (!mem->watch_page(lin)) {
+		return;
+	}
+	// ページをまたがない範囲で読み込む
+	n = PAGE_SIZE - (lin & PAGE_MASK);
+	if (n > ICACHE_MAX_LEN) {
+		n = ICACHE_MAX_LEN;
+	}
+	for (u32 i = 0; i < n; i++) {
+		buf[i] = mem->read8(lin + i);
+	}
+	len = insn_len(buf, n);
+	if (len == 0) {
+		return;
+	}
+	memcpy(e->bytes, buf, len);
+	e->adr = lin;
+	e->mode = mode;
+	e->gen = mem->get_page_gen(lin);
+	e->len = len;
+	ic_len = len;
+	ic_bytes = e->bytes;
+}
+
+// 命令ストリームからの読み込み
+// aは(セグメントを加算する前の)命令ポインタの値。実行中の命令が
+// キャッシュされていれば、そこから読み込む
+inline u8 CPU::fetch8(u32 a)
+{
+	u32 off = a - ic_eip;
+
+	if (off < ic_len) {
+		return ic_bytes[off];
+	}
+	return mem->read8(get_seg_adr(CS, a));
+}
+
+inline u16 CPU::fetch16(u32 a)
+{
+	u32 off = a - ic_eip;
+
+	if (off < ic_len && ic_len - off >= 2) {
+		return load16le(ic_bytes + off);
+	}
+	return mem->read16(get_seg_adr(CS, a));
+}
+
+inline u32 CPU::fetch32(u32 a)
+{
+	u32 off = a - ic_eip;
+
+	if (off < ic_len && ic_len - off >= 4) {
+		return load32le(ic_bytes + off);
+	}
+	return mem->read32(get_seg_adr(CS, a));
+}
+
 // modが11でないことはあらかじめチェックしておくこと
 // Effective Addressを取得
 // eipはModR/Mの次をポイントしていなければならない
@@ -330,7 +1122,7 @@ u16 CPU::modrm16_ea(u8 modrm)
 		break;
 	case 6:
 		if (mod == 0) {
-			tmp16 = mem->read16(get_seg_adr(CS, eip));
+			tmp16 = fetch16(eip);
 			eip += 2;
 			break;
 		}
@@ -342,10 +1134,10 @@ u16 CPU::modrm16_ea(u8 modrm)
 	}
 
 	if (mod == 1) {
-		tmp16 += (s8)mem->read8(get_seg_adr(CS, eip));
+		tmp16 += (s8)fetch8(eip);
 		eip++;
 	} else if (mod == 2) {
-		tmp16 += (s16)mem->read16(get_seg_adr(CS, eip));
+		tmp16 += (s16)fetch16(eip);
 		eip += 2;
 	}
 
@@ -357,7 +1149,7 @@ u32 CPU::modrm32_ea(u8 modrm)
 	u8 sib, idx, base;
 	u16 mod;
 	u32 tmp32;
-	u32 sib_scale[] = {0, 2, 4, 8};
+	u32 sib_scale[] = {1, 2, 4, 8};
 
 	mod = modrm >> 6;
 
@@ -375,10 +1167,16 @@ u32 CPU::modrm32_ea(u8 modrm)
 		tmp32 = ebx;
 		break;
 	case 4: // <SIB>
-		sib = mem->read8(get_seg_adr(CS, eip++));
+		sib = fetch8(eip++);
 		idx = sib >> 3 & 7;
 		base = sib & 7;
-		tmp32 = (base == 5 && mod == 0)? 0 : genregd(base);
+		if (base == 5 && mod == 0) {
+			// [disp32 + index]
+			tmp32 = fetch32(eip);
+			eip += 4;
+		} else {
+			tmp32 = genregd(base);
+		}
 		if (idx != 4) {
 			tmp32 += genregd(idx) * sib_scale[sib >> 6];
 		}
@@ -386,7 +1184,7 @@ u32 CPU::modrm32_ea(u8 modrm)
 	case 5:
 		// [disp32]
 		if (mod == 0) {
-			tmp32 = mem->read32(get_seg_adr(CS, eip));
+			tmp32 = fetch32(eip);
 			eip += 4;
 			break;
 		}
@@ -401,10 +1199,10 @@ u32 CPU::modrm32_ea(u8 modrm)
 	}
 
 	if (mod == 1) {
-		tmp32 += (s8)mem->read8(get_seg_adr(CS, eip));
+		tmp32 += (s8)fetch8(eip);
 		eip++;
 	} else if (mod == 2) {
-		tmp32 += (s32)mem->read32(get_seg_adr(CS, eip));
+		tmp32 += (s32)fetch32(eip);
 		eip += 4;
 	}
 
@@ -419,17 +1217,21 @@ u32 CPU::modrm_seg_ea(u8 modrm)
 {
 	if (addrsize == size16) {
 		return modrm16_ea(modrm)
-			+ sdcr[modrm_add_seg[0][modrm >> 6][modrm & 7]].base;
+			+ sdcr[eff_seg[modrm_add_seg[0][modrm >> 6][modrm & 7]]].base;
 	}
 
 	// xxxSIBのベースがもしEBPだったらセグメントはCS?
 	if ((modrm & 7) != 4) {
 		return modrm32_ea(modrm) +
-			sdcr[modrm_add_seg[1][modrm >> 6][modrm & 7]].base;
+			sdcr[eff_seg[modrm_add_seg[1][modrm >> 6][modrm & 7]]].base;
 	} else {
 		u8 sib;
-		sib = get_seg_adr(CS, eip);
-		return modrm32_ea(modrm) + sdcr[modrm_add_sib[sib & 7]].base;
+		sib = fetch8(eip);
+		// [disp32 + index]の場合はDS
+		if ((sib & 7) == 5 && modrm >> 6 == 0) {
+			return modrm32_ea(modrm) + sdcr[eff_seg[DS]].base;
+		}
+		return modrm32_ea(modrm) + sdcr[eff_seg[modrm_add_sib[sib & 7]]].base;
 	}
 }
 
@@ -475,24 +1277,40 @@ void CPU::update_segreg(const u8 seg, const u16 n) {
 
 	// プロテクトモード
 	u32 tmpadr, dst;
+	struct _desc_cache *dc = &desc_cache[n >> 3 & (DESC_CACHE_SIZE - 1)];
 
 	// セグメントで指定されるディスクリプタの先頭アドレス
-	tmpadr = gdtr.base + (n & 0xf8);
-	dst = (mem->read32(tmpadr + 2) & 0x00ffffff)
-		+ (mem->read8(tmpadr + 7) << 24);
-	DAS_pr("base=0x%08x", dst);
-	sdcr[seg].base = dst;
-
-	dst = mem->read8(tmpadr + 5) + ((mem->read8(tmpadr + 6) & 0xf0) << 4);
-	DAS_pr("\tAttr=0x%04x", (u16)dst);
-	sdcr[seg].attr = (u16)dst;
-
-	dst = mem->read16(tmpadr) + ((mem->read8(tmpadr + 6) & 0xf) << 16);
-	if (sdcr[seg].attr & 0x800) {
-		dst = dst << 12 | 0xfff;
+	tmpadr = gdtr.base + (n & 0xfff8);
+
+	if (dc->gen == desc_gen && dc->sel == (n & ~3) &&
+	    dc->page_gen == mem->get_page_gen(tmpadr)) {
+		sdcr[seg] = dc->sd;
+	} else {
+		dst = (mem->read32(tmpadr + 2) & 0x00ffffff)
+			+ (mem->read8(tmpadr + 7) << 24);
+		DAS_pr("base=0x%08x", dst);
+		sdcr[seg].base = dst;
+
+		dst = mem->read8(tmpadr + 5) + ((mem->read8(tmpadr + 6) & 0xf0) << 4);
+		DAS_pr("\tAttr=0x%04x", (u16)dst);
+		sdcr[seg].attr = (u16)dst;
+
+		dst = mem->read16(tmpadr) + ((mem->read8(tmpadr + 6) & 0xf) << 16);
+		if (sdcr[seg].attr & 0x800) {
+			dst = dst << 12 | 0xfff;
+		}
+		DAS_pr("\tlimit=0x%08x\n", dst);
+		sdcr[seg].limit = dst;
+
+		// ページをまたがず、書き込みを監視できるディスクリプタだけ登録する
+		if ((tmpadr & PAGE_MASK) <= PAGE_SIZE - 8 &&
+		    mem->watch_page(tmpadr)) {
+			dc->sel = n & ~3;
+			dc->gen = desc_gen;
+			dc->page_gen = mem->get_page_gen(tmpadr);
+			dc->sd = sdcr[seg];
+		}
 	}
-	DAS_pr("\tlimit=0x%08x\n", dst);
-	sdcr[seg].limit = dst;
 
 	if (seg != CS) {
 		return;
@@ -508,12 +1326,576 @@ void CPU::update_segreg(const u8 seg, const u16 n) {
 		opsize = size16;
 		addrsize = size16;
 	}
+	update_cpu_mode();
 }
 
-#define CLKS(clk_op) clks -= (clk_op)
+// isRealModeとCSのDビットから実行モードを求める
+// オペランドサイズ、アドレスサイズもモードのデフォルトにする
+void CPU::update_cpu_mode(void)
+{
+	if (isRealMode) {
+		cpu_mode = MODE_RM16;
+	} else {
+		cpu_mode = (sdcr[CS].attr & 0x400)? MODE_PM32 : MODE_PM16;
+	}
+	opsize = (cpu_mode == MODE_PM32)? size32 : size16;
+	addrsize = opsize;
+}
+
+/*
+  MOVS/STOSの一括処理
+  - cnt要素(REPなしなら1)のうち、clksが0以下になる要素までを処理して
+    処理した要素数を返す(1要素ずつ処理した場合と同じところで中断する)
+  - (E)SI, (E)DIはアドレスサイズで扱い、DFの方向に進める
+  - ホスト側のメモリに割り当たっているページの中はmemmove()/memset()で
+    まとめて処理する。ページ境界、(E)SI/(E)DIの16bitのラップアラウンド、
+    MMIOや監視中のページにかかる要素はMemory経由で1要素ずつ処理する
+  - クロックは最後にまとめて引く
+ */
+
+// addrからlimit(ページや64KB)の境界をまたがずにアクセスできる要素数
+static inline u32 string_room(u32 addr, u8 size, bool down, u32 limit)
+{
+	u32 o = addr & (limit - 1);
+
+	if (o + size > limit) {
+		return 0;
+	}
+	return down? o / size + 1 : (limit - o) / size;
+}
+
+// cnt要素のうち、clksが0以下になる要素までの要素数(最低1要素)
+u32 CPU::string_todo(u32 clk, u32 cnt)
+{
+	u32 todo;
+
+	todo = (clks <= 0)? 1 : ((u32)clks + clk - 1) / clk;
+	return (todo < cnt)? todo : cnt;
+}
+
+u32 CPU::string_movs(u8 size, u32 cnt)
+{
+	u8 **rpage = mem->get_rpage();
+	u8 **wpage = mem->get_wpage();
+	bool a16 = (addrsize == size16);
+	bool down = flagu8 & DF8;
+	u32 s = a16? si : esi;
+	u32 d = a16? di : edi;
+	u32 todo, done, n, sa, da, len;
+	u8 *ps, *pd;
+
+	todo = string_todo(CLK_MOVS, cnt);
+	for (done = 0; done < todo; done += n) {
+		sa = get_seg_adr(eff_seg[DS], s);
+		da = get_seg_adr(ES, d);
+		ps = rpage[sa >> PAGE_SHIFT];
+		pd = wpage[da >> PAGE_SHIFT];
+		n = todo - done;
+		n = std::min(n, string_room(sa, size, down, PAGE_SIZE));
+		n = std::min(n, string_room(da, size, down, PAGE_SIZE));
+		if (a16) {
+			n = std::min(n, string_room(s, size, down, 0x10000));
+			n = std::min(n, string_room(d, size, down, 0x10000));
+		}
+		if (ps == NULL || pd == NULL || n == 0) {
+			// Memory経由で1要素
+			switch (size) {
+			case 1:
+				mem->write8(da, mem->read8(sa));
+				break;
+			case 2:
+				mem->write16(da, mem->read16(sa));
+				break;
+			default:
+				mem->write32(da, mem->read32(sa));
+				break;
+			}
+			n = 1;
+		} else {
+			len = n * size;
+			ps += sa & PAGE_MASK;
+			pd += da & PAGE_MASK;
+			// 1要素ずつ順に転送した結果がmemmove()と変わるのは、
+			// 転送先が進む方向の先にソースと重なっている場合だけ
+			if (down? (pd < ps && pd + len > ps) : (pd > ps && pd < ps + len)) {
+				s32 step = down? -size : size;
+				for (u32 i = 0; i < n; i++, ps += step, pd += step) {
+					switch (size) {
+					case 1: *pd = *ps; break;
+					case 2: store16le(pd, load16le(ps)); break;
+					default: store32le(pd, load32le(ps)); break;
+					}
+				}
+			} else if (down) {
+				memmove(pd - len + size, ps - len + size, len);
+			} else {
+				memmove(pd, ps, len);
+			}
+		}
+		s += down? -(n * size) : n * size;
+		d += down? -(n * size) : n * size;
+	}
+	if (a16) {
+		si = s;
+		di = d;
+	} else {
+		esi = s;
+		edi = d;
+	}
+	clks -= CLK_MOVS * todo;
+	return todo;
+}
+
+u32 CPU::string_stos(u8 size, u32 cnt)
+{
+	u8 **wpage = mem->get_wpage();
+	bool a16 = (addrsize == size16);
+	bool down = flagu8 & DF8;
+	u32 d = a16? di : edi;
+	u32 data = (size == 1)? al : (size == 2)? ax : eax;
+	u32 todo, done, n, da, len;
+	u8 *pd;
+
+	todo = string_todo(CLK_STOS, cnt);
+	for (done = 0; done < todo; done += n) {
+		da = get_seg_adr(ES, d);
+		pd = wpage[da >> PAGE_SHIFT];
+		n = todo - done;
+		n = std::min(n, string_room(da, size, down, PAGE_SIZE));
+		if (a16) {
+			n = std::min(n, string_room(d, size, down, 0x10000));
+		}
+		if (pd == NULL || n == 0) {
+			// Memory経由で1要素
+			switch (size) {
+			case 1:
+				mem->write8(da, data);
+				break;
+			case 2:
+				mem->write16(da, data);
+				break;
+			default:
+				mem->write32(da, data);
+				break;
+			}
+			n = 1;
+		} else {
+			len = n * size;
+			pd += da & PAGE_MASK;
+			if (down) {
+				pd -= len - size;
+			}
+			if (size == 1) {
+				memset(pd, data, len);
+			} else if (size == 2) {
+				for (u32 i = 0; i < len; i += 2) {
+					store16le(pd + i, data);
+				}
+			} else {
+				for (u32 i = 0; i < len; i += 4) {
+					store32le(pd + i, data);
+				}
+			}
+		}
+		d += down? -(n * size) : n * size;
+	}
+	if (a16) {
+		di = d;
+	} else {
+		edi = d;
+	}
+	clks -= CLK_STOS * todo;
+	return todo;
+}
+
+/*
+  CMPS/SCASの一括処理
+  - cnt要素のうち、clksが0以下になる要素までを比較して、比較した要素数を
+    返す。REPE/REPNEの条件で終わった場合はstopをtrueにする
+  - フラグは最後に比較した要素で求める
+  - ホスト側のメモリに割り当たっているページの中は、string_find()で
+    条件に合う最初の要素をまとめて探す
+ */
+
+#if defined(__AVX2__)
+#define VEC_BYTES 32
+typedef __m256i vec_t;
+static inline vec_t vec_load(const u8 *p) { return _mm256_loadu_si256((const __m256i *)p); }
+static inline vec_t vec_set(u32 v, u8 size) {
+	return (size == 1)? _mm256_set1_epi8(v) : (size == 2)? _mm256_set1_epi16(v) : _mm256_set1_epi32(v);
+}
+// 等しいバイトのビットが立ったマスク (要素単位で比較する)
+static inline u32 vec_eq(vec_t a, vec_t b, u8 size) {
+	vec_t c = (size == 1)? _mm256_cmpeq_epi8(a, b) : (size == 2)? _mm256_cmpeq_epi16(a, b) : _mm256_cmpeq_epi32(a, b);
+	return (u32)_mm256_movemask_epi8(c);
+}
+#elif defined(__SSE2__)
+#define VEC_BYTES 16
+typedef __m128i vec_t;
+static inline vec_t vec_load(const u8 *p) { return _mm_loadu_si128((const __m128i *)p); }
+static inline vec_t vec_set(u32 v, u8 size) {
+	return (size == 1)? _mm_set1_epi8(v) : (size == 2)? _mm_set1_epi16(v) : _mm_set1_epi32(v);
+}
+static inline u32 vec_eq(vec_t a, vec_t b, u8 size) {
+	vec_t c = (size == 1)? _mm_cmpeq_epi8(a, b) : (size == 2)? _mm_cmpeq_epi16(a, b) : _mm_cmpeq_epi32(a, b);
+	return (u32)_mm_movemask_epi8(c);
+}
+#endif
+
+static inline u32 string_load(const u8 *p, u8 size)
+{
+	return (size == 1)? *p : (size == 2)? load16le(p) : load32le(p);
+}
+
+/*
+  ホスト側のメモリのn要素(sizeバイト)を順に比較し、eqなら等しい、
+  eqでなければ異なる最初の要素の番号を返す(なければn)
+  - pがNULLならdataと比較する(SCAS)
+  - p, qは最初の要素を指す。downならアドレスの小さい方へ進む
+  - SIMDが使えるホストではVEC_BYTESずつ比較する
+ */
+static u32 string_find(const u8 *p, const u8 *q, u32 data, u32 n, u8 size, bool down, bool eq)
+{
+	u32 i = 0;
+
+#ifdef VEC_BYTES
+	const u32 per = VEC_BYTES / size; // 1回で比較する要素数
+	const u32 all = (VEC_BYTES == 32)? 0xffffffff : 0xffff;
+	vec_t v = vec_set(data, size);
+	u32 m;
+
+	for (; i + per <= n; i += per) {
+		// 今回比較する要素のうち、アドレスの最も小さい要素のオフセット
+		s32 o = down? -(s32)((i + per - 1) * size) : i * size;
+		m = vec_eq(p? vec_load(p + o) : v, vec_load(q + o), size);
+		if (!eq) {
+			m ^= all;
+		}
+		if (m != 0) {
+			if (down) {
+				return i + (VEC_BYTES - 1 - (31 - __builtin_clz(m))) / size;
+			}
+			return i + __builtin_ctz(m) / size;
+		}
+	}
+#endif
+	for (; i < n; i++) {
+		s32 o = down? -(s32)(i * size) : i * size;
+		u32 d = p? string_load(p + o, size) : data;
+		if ((d == string_load(q + o, size)) == eq) {
+			return i;
+		}
+	}
+	return n;
+}
+
+u32 CPU::string_cmps(u8 size, u32 cnt, bool scas, bool &stop)
+{
+	u8 **rpage = mem->get_rpage();
+	bool a16 = (addrsize == size16);
+	bool down = flagu8 & DF8;
+	bool eq = repne_prefix; // REPNEは等しい要素で終わる
+	u32 s = a16? si : esi;
+	u32 d = a16? di : edi;
+	u32 data = (size == 1)? al : (size == 2)? ax : eax;
+	u32 todo, done, n, k, sa, da;
+	u32 dst = 0, src = 0, res;
+	u8 *ps = NULL, *pd;
+	s32 o;
+
+	stop = false;
+	todo = string_todo(scas? CLK_SCAS : CLK_CMPS, cnt);
+	if (todo == 0) {
+		return 0; // フラグも変わらない
+	}
+	for (done = 0; done < todo; done += n) {
+		sa = get_seg_adr(eff_seg[DS], s);
+		da = get_seg_adr(ES, d);
+		pd = rpage[da >> PAGE_SHIFT];
+		n = todo - done;
+		n = std::min(n, string_room(da, size, down, PAGE_SIZE));
+		if (a16) {
+			n = std::min(n, string_room(d, size, down, 0x10000));
+		}
+		if (!scas) {
+			ps = rpage[sa >> PAGE_SHIFT];
+			n = std::min(n, string_room(sa, size, down, PAGE_SIZE));
+			if (a16) {
+				n = std::min(n, string_room(s, size, down, 0x10000));
+			}
+		}
+		if (pd == NULL || (!scas && ps == NULL) || n == 0) {
+			// Memory経由で1要素
+			switch (size) {
+			case 1:
+				dst = scas? data : mem->read8(sa);
+				src = mem->read8(da);
+				break;
+			case 2:
+				dst = scas? data : mem->read16(sa);
+				src = mem->read16(da);
+				break;
+			default:
+				dst = scas? data : mem->read32(sa);
+				src = mem->read32(da);
+				break;
+			}
+			n = 1;
+			k = ((dst == src) == eq)? 0 : 1;
+		} else {
+			ps = scas? NULL : ps + (sa & PAGE_MASK);
+			pd += da & PAGE_MASK;
+			k = string_find(ps, pd, data, n, size, down, eq);
+			// 最後に比較する要素
+			o = (k < n)? k : n - 1;
+			o = down? -(o * size) : o * size;
+			dst = scas? data : string_load(ps + o, size);
+			src = string_load(pd + o, size);
+		}
+		if (k < n) {
+			n = k + 1;
+			stop = true;
+		}
+		if (!scas) {
+			s += down? -(n * size) : n * size;
+		}
+		d += down? -(n * size) : n * size;
+		if (stop) {
+			done += n;
+			break;
+		}
+	}
+	if (a16) {
+		si = s;
+		di = d;
+	} else {
+		esi = s;
+		edi = d;
+	}
+	clks -= (scas? CLK_SCAS : CLK_CMPS) * done;
+
+	res = dst - src;
+	switch (size) {
+	case 1:
+		FLAG8bSUB(res, src, dst, );
+		OF_SUBb(res, src, dst);
+		break;
+	case 2:
+		FLAG8wSUB(res, src, dst, );
+		OF_SUBw(res, src, dst);
+		break;
+	default:
+		FLAG8dSUB(res, src, dst, );
+		OF_SUBd(res, src, dst);
+		break;
+	}
+	return done;
+}
+
+#define CLKS(clk_op) clks -= (clk_op)
+
+// MOVS/STOS
+// REPつきなら(E)CXの要素数をfn(sizeバイトの要素)で処理し、clksが尽きて
+// 処理しきれなかった場合は(E)CXに残りを入れて命令の先頭から再開する
+#define STRING_OP(fn, size)					\
+	if (repe_prefix) {					\
+		cnt = (addrsize == size16)? cx : ecx;		\
+		cnt -= fn(size, cnt);				\
+		if (addrsize == size16) {			\
+			cx = cnt;				\
+		} else {					\
+			ecx = cnt;				\
+		}						\
+		if (cnt != 0) {					\
+			REAL? ip-- : eip--;			\
+			OP_CONTINUE();				\
+			return clks;				\
+		}						\
+	} else {						\
+		fn(size, 1);					\
+	}
+
+// CMPS/SCAS
+// REPE/REPNEの条件で終わらずにclksが尽きた場合は、(E)CXに残りを入れて
+// 命令の先頭から再開する
+#define STRING_CMP_OP(size, scas)				\
+	if (repe_prefix || repne_prefix) {			\
+		cnt = (addrsize == size16)? cx : ecx;		\
+		cnt -= string_cmps(size, cnt, scas, str_stop);	\
+		if (addrsize == size16) {			\
+			cx = cnt;				\
+		} else {					\
+			ecx = cnt;				\
+		}						\
+		if (cnt != 0 && !str_stop) {			\
+			REAL? ip-- : eip--;			\
+			OP_CONTINUE();				\
+			return clks;				\
+		}						\
+	} else {						\
+		string_cmps(size, 1, scas, str_stop);		\
+	}
+
+// 命令の取り出し
+// リアルモードでip++した時に16bitをこえて0に戻る場合を考慮し、
+// リアルモードの場合はeip++ではなくip++するようにした。
+// ここまでする考慮しなくてもよければ削る(高速化のため)
+#define OP_FETCH()						\
+	if (dmac->working) {					\
+	}							\
+	PROF_BEGIN();						\
+	icache_lookup();					\
+	op = fetch8(REAL? ip++ : eip++);			\
+	DAS_pr("%08x %02x", get_seg_adr(CS, eip - 1), op)
+
+// 短い後方分岐が成立した/しなかった時のビジーウェイトの検出
+#define SPIN_TAKEN(rel)						\
+	if ((s8)(rel) < 0 && (s8)(rel) >= -SPIN_BODY_MAX) {	\
+		spin_check((s8)(rel));				\
+	}
+#define SPIN_EXIT(rel)						\
+	if ((s8)(rel) < 0) {					\
+		spin.valid = false;				\
+	}
+
+// トレース中なら命令の先頭で状態を記録する
+#define TRACE_INSN()						\
+	if (trace && seg_ovride == 0 && !opsize_ovride &&	\
+	    !addrsize_ovride && !repe_prefix && !repne_prefix) {	\
+		trace_insn();					\
+	}
+
+// 未実装の命令。フライトレコーダーならそこまでのトレースを書き出す
+#define TRACE_DUMP()						\
+	if (trace) {						\
+		trace->dump();					\
+	}
+
+// コールを追跡中なら、呼んだ先とリターンアドレスの位置をSamplerに知らせる
+#define SAMPLE_CALL()						\
+	if (sampler) {						\
+		sampler->call(get_seg_adr(CS, REAL? ip : eip), esp); \
+	}
+#define SAMPLE_RET()						\
+	if (sampler) {						\
+		sampler->ret(esp);				\
+	}
+
+// 割り込み要求があれば受け付ける
+// プリフィックスの途中とSTIの直後の1命令の間は受け付けない
+#define INTR_CHECK()						\
+	if (intr_pending) {					\
+		if ((flagu8 & IFSET8) && !intr_shadow &&	\
+		    seg_ovride == 0 && !opsize_ovride &&	\
+		    !addrsize_ovride && !repe_prefix && !repne_prefix) { \
+			intr();					\
+			if (cpu_mode != MODE) {			\
+				return clks;			\
+			}					\
+		}						\
+		intr_shadow = false;				\
+	}
+
+// 変換済みのブロックがあれば実行する
+// トレース中はすべての命令を記録するためにインタプリタで実行する
+// プリフィックスの途中(オーバーライド中)はインタプリタで続ける
+#ifdef USE_JIT
+#define JIT_EXEC()						\
+	if (jit_enabled && !trace && seg_ovride == 0 &&		\
+	    !opsize_ovride && !addrsize_ovride &&			\
+	    !repe_prefix && !repne_prefix &&				\
+	    jit->exec() && clks <= exit_clks) {			\
+		return clks;					\
+	}
+#else
+#define JIT_EXEC()
+#endif
+
+// 命令ごとのプロファイル
+#ifdef OP_PROFILE
+#define PROF_BEGIN() prof.begin()
+#define PROF_END()						\
+	prof.end((op == 0x0f? 0x100 | subop : op) |		\
+		 ((opsize == size32)? PROF_OP32 : 0) |		\
+		 ((seg_ovride > 0)? PROF_SEG : 0) |		\
+		 (opsize_ovride? PROF_OPSIZE : 0) |		\
+		 (addrsize_ovride? PROF_ADDRSIZE : 0) |	\
+		 (repe_prefix? PROF_REPE : 0) |			\
+		 (repne_prefix? PROF_REPNE : 0))
+#else
+#define PROF_BEGIN()
+#define PROF_END()
+#endif
 
-s32 CPU::exec(void) {
-	u8 op, subop;
+// 命令の後始末
+#define OP_EPILOGUE()						\
+	insns++;						\
+	PROF_END();						\
+	if (seg_ovride > 0) {					\
+		seg_ovride = 0;					\
+		/* オーバーライドしたセグメントを元に戻す */	\
+		eff_seg[DS] = DS;				\
+		eff_seg[SS] = SS;				\
+	}							\
+	/* {オペランド|アドレス}サイズオーバーライドプリフィックスを */ \
+	/* 元に戻す */						\
+	opsize_ovride = false;					\
+	addrsize_ovride = false;				\
+	repne_prefix = false;					\
+	repe_prefix = false;					\
+	OP_CONTINUE_END();					\
+	/* モードが変わったら特殊化したインタプリタを切り替える */	\
+	/* (opsize/addrsizeはupdate_cpu_mode()で設定済み) */	\
+	if (cpu_mode != MODE) {					\
+		return clks;					\
+	}							\
+	opsize = DEF32? size32 : size16;			\
+	addrsize = DEF32? size32 : size16
+
+/*
+  命令ディスパッチ
+  - 通常はswitch (op)で分岐する
+  - THREADED_DISPATCHを定義すると、GCCのラベルのアドレス(&&label)を
+    並べたテーブルで分岐する。各ハンドラの最後(NEXT_OP)で後始末と
+    次の命令の取り出しを行い、そのままテーブルで次のハンドラに飛ぶ
+    (分岐元が命令ごとに分かれるので、ホストの分岐予測が当たりやすい)
+  - 最初の1命令とswitchを抜けた場合(プリフィックス等でreturnした
+    場合を除く)はwhileループ側で後始末と取り出しを行う
+ */
+#ifdef THREADED_DISPATCH
+#ifndef __GNUC__
+#error "THREADED_DISPATCH requires GCC's labels as values"
+#endif
+#define OP_SWITCH(x, tbl) goto *tbl[x]; switch (x)
+#define OPCASE(n) case n: op_##n
+#define OPCASE0F(n) case n: op0f_##n
+#define OPDEFAULT default: op_default
+#define OPDEFAULT0F default: op0f_default
+#define NEXT_OP							\
+	OP_EPILOGUE();						\
+	if (clks <= exit_clks) {				\
+		return clks;					\
+	}							\
+	INTR_CHECK();						\
+	JIT_EXEC();						\
+	TRACE_INSN();						\
+	DAS_dump_reg();						\
+	OP_FETCH();						\
+	goto *optbl[op]
+#else
+#define OP_SWITCH(x, tbl) switch (x)
+#define OPCASE(n) case n
+#define OPCASE0F(n) case n
+#define OPDEFAULT default
+#define OPDEFAULT0F default
+#define NEXT_OP break
+#endif
+
+template <int MODE> s32 CPU::exec_mode(void) {
+	// 実行モードごとにインスタンス化するので、以下は定数になる
+	constexpr bool REAL = (MODE == MODE_RM16);
+	constexpr bool DEF32 = (MODE == MODE_PM32);
+	u8 op, subop = 0;
 	u16 warg1, warg2;
 	u32 darg1;
 	u8 modrm, ndisp, sreg, greg, rm;
@@ -522,10 +1904,150 @@ s32 CPU::exec(void) {
 	u32 src, dst, res;
 	u64 dst64;
 	u32 cnt;
-	s32 incdec;
+	bool str_stop; // CMPS/SCASがREPE/REPNEの条件で終わった
+#ifdef THREADED_DISPATCH
+	// 命令ごとのハンドラのラベル (未実装の命令はop_default)
+	static void *optbl[0x100] = {
+		&&op_0x00, &&op_0x01, &&op_0x02, &&op_0x03,
+		&&op_0x04, &&op_0x05, &&op_0x06, &&op_0x07,
+		&&op_0x08, &&op_0x09, &&op_0x0a, &&op_0x0b,
+		&&op_0x0c, &&op_0x0d, &&op_0x0e, &&op_0x0f,
+		&&op_0x10, &&op_0x11, &&op_0x12, &&op_0x13,
+		&&op_0x14, &&op_0x15, &&op_0x16, &&op_0x17,
+		&&op_0x18, &&op_0x19, &&op_0x1a, &&op_0x1b,
+		&&op_0x1c, &&op_0x1d, &&op_0x1e, &&op_0x1f,
+		&&op_0x20, &&op_0x21, &&op_0x22, &&op_0x23,
+		&&op_0x24, &&op_0x25, &&op_0x26, &&op_0x27,
+		&&op_0x28, &&op_0x29, &&op_0x2a, &&op_0x2b,
+		&&op_0x2c, &&op_0x2d, &&op_0x2e, &&op_0x2f,
+		&&op_0x30, &&op_0x31, &&op_0x32, &&op_0x33,
+		&&op_0x34, &&op_0x35, &&op_0x36, &&op_0x37,
+		&&op_0x38, &&op_0x39, &&op_0x3a, &&op_0x3b,
+		&&op_0x3c, &&op_0x3d, &&op_0x3e, &&op_0x3f,
+		&&op_0x40, &&op_0x41, &&op_0x42, &&op_0x43,
+		&&op_0x44, &&op_0x45, &&op_0x46, &&op_0x47,
+		&&op_0x48, &&op_0x49, &&op_0x4a, &&op_0x4b,
+		&&op_0x4c, &&op_0x4d, &&op_0x4e, &&op_0x4f,
+		&&op_0x50, &&op_0x51, &&op_0x52, &&op_0x53,
+		&&op_0x54, &&op_0x55, &&op_0x56, &&op_0x57,
+		&&op_0x58, &&op_0x59, &&op_0x5a, &&op_0x5b,
+		&&op_0x5c, &&op_0x5d, &&op_0x5e, &&op_0x5f,
+		&&op_0x60, &&op_0x61, &&op_default, &&op_default,
+		&&op_default, &&op_default, &&op_0x66, &&op_0x67,
+		&&op_0x68, &&op_default, &&op_0x6a, &&op_default,
+		&&op_default, &&op_default, &&op_default, &&op_default,
+		&&op_0x70, &&op_0x71, &&op_0x72, &&op_0x73,
+		&&op_0x74, &&op_0x75, &&op_0x76, &&op_0x77,
+		&&op_0x78, &&op_0x79, &&op_0x7a, &&op_0x7b,
+		&&op_0x7c, &&op_0x7d, &&op_0x7e, &&op_0x7f,
+		&&op_0x80, &&op_0x81, &&op_0x82, &&op_0x83,
+		&&op_0x84, &&op_0x85, &&op_0x86, &&op_0x87,
+		&&op_0x88, &&op_0x89, &&op_0x8a, &&op_0x8b,
+		&&op_0x8c, &&op_0x8d, &&op_0x8e, &&op_0x8f,
+		&&op_0x90, &&op_0x91, &&op_0x92, &&op_0x93,
+		&&op_0x94, &&op_0x95, &&op_0x96, &&op_0x97,
+		&&op_0x98, &&op_0x99, &&op_0x9a, &&op_0x9b,
+		&&op_0x9c, &&op_0x9d, &&op_0x9e, &&op_0x9f,
+		&&op_0xa0, &&op_0xa1, &&op_0xa2, &&op_0xa3,
+		&&op_0xa4, &&op_0xa5, &&op_0xa6, &&op_0xa7,
+		&&op_0xa8, &&op_0xa9, &&op_0xaa, &&op_0xab,
+		&&op_0xac, &&op_0xad, &&op_0xae, &&op_0xaf,
+		&&op_0xb0, &&op_0xb1, &&op_0xb2, &&op_0xb3,
+		&&op_0xb4, &&op_0xb5, &&op_0xb6, &&op_0xb7,
+		&&op_0xb8, &&op_0xb9, &&op_0xba, &&op_0xbb,
+		&&op_0xbc, &&op_0xbd, &&op_0xbe, &&op_0xbf,
+		&&op_0xc0, &&op_0xc1, &&op_0xc2, &&op_0xc3,
+		&&op_0xc4, &&op_0xc5, &&op_0xc6, &&op_0xc7,
+		&&op_default, &&op_default, &&op_0xca, &&op_0xcb,
+		&&op_0xcc, &&op_0xcd, &&op_0xce, &&op_0xcf,
+		&&op_0xd0, &&op_0xd1, &&op_0xd2, &&op_0xd3,
+		&&op_0xd4, &&op_0xd5, &&op_default, &&op_0xd7,
+		&&op_0xd8, &&op_0xd9, &&op_0xda, &&op_0xdb,
+		&&op_0xdc, &&op_0xdd, &&op_0xde, &&op_0xdf,
+		&&op_0xe0, &&op_0xe1, &&op_0xe2, &&op_0xe3,
+		&&op_0xe4, &&op_0xe5, &&op_0xe6, &&op_0xe7,
+		&&op_0xe8, &&op_0xe9, &&op_0xea, &&op_0xeb,
+		&&op_0xec, &&op_0xed, &&op_0xee, &&op_0xef,
+		&&op_0xf0, &&op_default, &&op_0xf2, &&op_0xf3,
+		&&op_0xf4, &&op_0xf5, &&op_0xf6, &&op_0xf7,
+		&&op_0xf8, &&op_0xf9, &&op_0xfa, &&op_0xfb,
+		&&op_0xfc, &&op_0xfd, &&op_0xfe, &&op_0xff
+	};
+	// 2バイト命令(0x0f xx)用
+	static void *optbl0f[0x100] = {
+		&&op0f_0x00, &&op0f_0x01, &&op0f_default, &&op0f_default,
+		&&op0f_default, &&op0f_default, &&op0f_default, &&op0f_default,
+		&&op0f_default, &&op0f_default, &&op0f_default, &&op0f_default,
+		&&op0f_default, &&op0f_default, &&op0f_default, &&op0f_default,
+		&&op0f_default, &&op0f_default, &&op0f_default, &&op0f_default,
+		&&op0f_default, &&op0f_default, &&op0f_default, &&op0f_default,
+		&&op0f_default, &&op0f_default, &&op0f_default, &&op0f_default,
+		&&op0f_default, &&op0f_default, &&op0f_default, &&op0f_default,
+		&&op0f_0x20, &&op0f_default, &&op0f_0x22, &&op0f_default,
+		&&op0f_default, &&op0f_default, &&op0f_default, &&op0f_default,
+		&&op0f_default, &&op0f_default, &&op0f_default, &&op0f_default,
+		&&op0f_default, &&op0f_default, &&op0f_default, &&op0f_default,
+		&&op0f_default, &&op0f_default, &&op0f_default, &&op0f_default,
+		&&op0f_default, &&op0f_default, &&op0f_default, &&op0f_default,
+		&&op0f_default, &&op0f_default, &&op0f_default, &&op0f_default,
+		&&op0f_default, &&op0f_default, &&op0f_default, &&op0f_default,
+		&&op0f_default, &&op0f_default, &&op0f_default, &&op0f_default,
+		&&op0f_default, &&op0f_default, &&op0f_default, &&op0f_default,
+		&&op0f_default, &&op0f_default, &&op0f_default, &&op0f_default,
+		&&op0f_default, &&op0f_default, &&op0f_default, &&op0f_default,
+		&&op0f_default, &&op0f_default, &&op0f_default, &&op0f_default,
+		&&op0f_default, &&op0f_default, &&op0f_default, &&op0f_default,
+		&&op0f_default, &&op0f_default, &&op0f_default, &&op0f_default,
+		&&op0f_default, &&op0f_default, &&op0f_default, &&op0f_default,
+		&&op0f_default, &&op0f_default, &&op0f_default, &&op0f_default,
+		&&op0f_default, &&op0f_default, &&op0f_default, &&op0f_default,
+		&&op0f_default, &&op0f_default, &&op0f_default, &&op0f_default,
+		&&op0f_default, &&op0f_default, &&op0f_default, &&op0f_default,
+		&&op0f_default, &&op0f_default, &&op0f_default, &&op0f_default,
+		&&op0f_default, &&op0f_default, &&op0f_default, &&op0f_default,
+		&&op0f_default, &&op0f_default, &&op0f_default, &&op0f_default,
+		&&op0f_default, &&op0f_default, &&op0f_default, &&op0f_default,
+		&&op0f_0x80, &&op0f_0x81, &&op0f_0x82, &&op0f_0x83,
+		&&op0f_0x84, &&op0f_0x85, &&op0f_0x86, &&op0f_0x87,
+		&&op0f_0x88, &&op0f_0x89, &&op0f_0x8a, &&op0f_0x8b,
+		&&op0f_0x8c, &&op0f_0x8d, &&op0f_0x8e, &&op0f_0x8f,
+		&&op0f_default, &&op0f_default, &&op0f_default, &&op0f_default,
+		&&op0f_default, &&op0f_default, &&op0f_default, &&op0f_default,
+		&&op0f_default, &&op0f_default, &&op0f_default, &&op0f_default,
+		&&op0f_default, &&op0f_default, &&op0f_default, &&op0f_default,
+		&&op0f_0xa0, &&op0f_0xa1, &&op0f_default, &&op0f_default,
+		&&op0f_default, &&op0f_default, &&op0f_default, &&op0f_default,
+		&&op0f_0xa8, &&op0f_0xa9, &&op0f_default, &&op0f_default,
+		&&op0f_default, &&op0f_default, &&op0f_default, &&op0f_default,
+		&&op0f_default, &&op0f_default, &&op0f_default, &&op0f_default,
+		&&op0f_default, &&op0f_default, &&op0f_0xb6, &&op0f_0xb7,
+		&&op0f_default, &&op0f_default, &&op0f_default, &&op0f_default,
+		&&op0f_default, &&op0f_default, &&op0f_0xbe, &&op0f_0xbf,
+		&&op0f_default, &&op0f_default, &&op0f_default, &&op0f_default,
+		&&op0f_default, &&op0f_default, &&op0f_default, &&op0f_default,
+		&&op0f_default, &&op0f_default, &&op0f_default, &&op0f_default,
+		&&op0f_default, &&op0f_default, &&op0f_default, &&op0f_default,
+		&&op0f_default, &&op0f_default, &&op0f_default, &&op0f_default,
+		&&op0f_default, &&op0f_default, &&op0f_default, &&op0f_default,
+		&&op0f_default, &&op0f_default, &&op0f_default, &&op0f_default,
+		&&op0f_default, &&op0f_default, &&op0f_default, &&op0f_default,
+		&&op0f_default, &&op0f_default, &&op0f_default, &&op0f_default,
+		&&op0f_default, &&op0f_default, &&op0f_default, &&op0f_default,
+		&&op0f_default, &&op0f_default, &&op0f_default, &&op0f_default,
+		&&op0f_default, &&op0f_default, &&op0f_default, &&op0f_default,
+		&&op0f_default, &&op0f_default, &&op0f_default, &&op0f_default,
+		&&op0f_default, &&op0f_default, &&op0f_default, &&op0f_default,
+		&&op0f_default, &&op0f_default, &&op0f_default, &&op0f_default,
+		&&op0f_default, &&op0f_default, &&op0f_default, &&op0f_default
+	};
+#endif
 
 	clks = remains_clks;
+	spin.valid = false;
 	while (clks > exit_clks) { // xxx マイナスになった分はどこかで補填する?
+		INTR_CHECK();
+		JIT_EXEC();
+		TRACE_INSN();
 
 #if 0	// MAMEとの比較用に一時的に変更
 		if (seg_ovride == 0 && !opsize_ovride && !addrsize_ovride &&!repe_prefix && !repne_prefix) {
@@ -535,16 +2057,9 @@ s32 CPU::exec(void) {
 		DAS_dump_reg();
 #endif
 
-		if (dmac->working) {
-		}
-
-		// リアルモードでip++した時に16bitをこえて0に戻る場合を考慮し、
-		// リアルモードの場合はeip++ではなくip++するようにした。
-		// ここまでする考慮しなくてもよければ削る(高速化のため)
-		op = mem->read8(get_seg_adr(CS, isRealMode? ip++ : eip++));
-		DAS_pr("%08x %02x", get_seg_adr(CS, eip - 1), op);
+		OP_FETCH();
 
-		switch (op) {
+		OP_SWITCH(op, optbl) {
 
 /******************** ADD ********************/
 /*
@@ -553,42 +2068,42 @@ s32 CPU::exec(void) {
   +--------+-----------+---------+---------+
   OF/SF/ZF/AF/PF/CF:結果による
 */
-		case 0x00: // ADD r/m8, r8
+		OPCASE(0x00): // ADD r/m8, r8
 			CAL_RM_R(ADD, b, 0);
-			break;
-		case 0x01: // ADD r/m16, r16 (ADD r/m32, r32)
+			NEXT_OP;
+		OPCASE(0x01): // ADD r/m16, r16 (ADD r/m32, r32)
 			if (opsize == size16) {
 				CAL_RM_R(ADD, w, 0);
 			} else {
 				CAL_RM_R(ADD, d, 0);
 			}
-			break;
-		case 0x02: // ADD r8, r/m8
+			NEXT_OP;
+		OPCASE(0x02): // ADD r8, r/m8
 			CAL_R_RM(ADD, b, 0);
-			break;
-		case 0x03: // ADD r16, r/m16 (ADD r32, r/m32)
+			NEXT_OP;
+		OPCASE(0x03): // ADD r16, r/m16 (ADD r32, r/m32)
 			if (opsize == size16) {
 				CAL_R_RM(ADD, w, 0);
 			} else {
 				CAL_R_RM(ADD, d, 0);
 			}
-			break;
-		case 0x04: // ADD AL, imm8
+			NEXT_OP;
+		OPCASE(0x04): // ADD AL, imm8
 			CLKS(CLK_CAL_R_IMM);
 			DAS_prt_post_op(1);
-			src = mem->read8(get_seg_adr(CS, eip));
+			src = fetch8(eip);
 			DAS_pr("ADD AL, 0x%02x\n", src);
 			eip++;
 			res = al + src;
 			FLAG8bADD(res, src, al, );
 			OF_ADDb(res, src, al);
 			al = res;
-			break;
-		case 0x05: // ADD AX, imm16 (ADD EAX, imm32)
+			NEXT_OP;
+		OPCASE(0x05): // ADD AX, imm16 (ADD EAX, imm32)
 			CLKS(CLK_CAL_R_IMM);
 			if (opsize == size16) {
 				DAS_prt_post_op(2);
-				src = mem->read16(get_seg_adr(CS, eip));
+				src = fetch16(eip);
 				DAS_pr("ADD AX, 0x%04x\n", src);
 				eip += 2;
 				res = ax + src;
@@ -597,7 +2112,7 @@ s32 CPU::exec(void) {
 				ax = res;
 			}else {
 				DAS_prt_post_op(4);
-				src = mem->read32(get_seg_adr(CS, eip));
+				src = fetch32(eip);
 				DAS_pr("ADD EAX, 0x%08x\n", src);
 				eip += 4;
 				res = eax + src;
@@ -605,46 +2120,48 @@ s32 CPU::exec(void) {
 				OF_ADDd(res, src, eax);
 				eax = res;
 			}
-			break;
+			NEXT_OP;
 
 /******************** ADC ********************/
 
-		case 0x10: // ADC r/m8, r8
+		OPCASE(0x10): // ADC r/m8, r8
 			CAL_RM_R(ADC, b, (flag8 & CF));
-			break;
-		case 0x11: // ADC r/m16, r16 (ADC r/m32, r32)
+			NEXT_OP;
+		OPCASE(0x11): // ADC r/m16, r16 (ADC r/m32, r32)
 			if (opsize == size16) {
 				CAL_RM_R(ADC, w, (flag8 & CF));
 			} else {
 				CAL_RM_R(ADC, d, (flag8 & CF));
 			}
-			break;
-		case 0x12: // ADC r8, r/m8
+			NEXT_OP;
+		OPCASE(0x12): // ADC r8, r/m8
 			CAL_R_RM(ADC, b, (flag8 & CF));
-			break;
-		case 0x13: // ADC r16, r/m16 (ADC r32, r/m32)
+			NEXT_OP;
+		OPCASE(0x13): // ADC r16, r/m16 (ADC r32, r/m32)
 			if (opsize == size16) {
 				CAL_R_RM(ADC, w, (flag8 & CF));
 			} else {
 				CAL_R_RM(ADC, d, (flag8 & CF));
 			}
-			break;
-		case 0x14: // ADC AL, imm8
+			NEXT_OP;
+		OPCASE(0x14): // ADC AL, imm8
+			LF_SYNC();
 			CLKS(CLK_CAL_R_IMM);
 			DAS_prt_post_op(1);
-			src = mem->read8(get_seg_adr(CS, eip));
+			src = fetch8(eip);
 			DAS_pr("ADC AL, 0x%02x\n", src);
 			eip++;
 			res = al + src + (flag8 & CF);
 			FLAG8bADC(res, src, al, );
 			OF_ADCb(res, src, al);
 			al = res;
-			break;
-		case 0x15: // ADC AX, imm16 (ADC EAX, imm32)
+			NEXT_OP;
+		OPCASE(0x15): // ADC AX, imm16 (ADC EAX, imm32)
+			LF_SYNC();
 			CLKS(CLK_CAL_R_IMM);
 			if (opsize == size16) {
 				DAS_prt_post_op(2);
-				src = mem->read16(get_seg_adr(CS, eip));
+				src = fetch16(eip);
 				DAS_pr("ADC AX, 0x%04x\n", src);
 				eip += 2;
 				res = ax + src + (flag8 & CF);
@@ -653,7 +2170,7 @@ s32 CPU::exec(void) {
 				ax = res;
 			} else {
 				DAS_prt_post_op(4);
-				src = mem->read32(get_seg_adr(CS, eip));
+				src = fetch32(eip);
 				DAS_pr("ADC EAX, 0x%08x\n", src);
 				eip += 4;
 				res = eax + src + (flag8 & CF);
@@ -661,7 +2178,7 @@ s32 CPU::exec(void) {
 				OF_ADCd(res, src, eax);
 				eax = res;
 			}
-			break;
+			NEXT_OP;
 
 /******************** OR ********************/
 /*
@@ -670,141 +2187,141 @@ s32 CPU::exec(void) {
   +--------+-----------+---------+---------+
   OF/CF:クリア, SF/ZF/PF:結果による, AF:不定
 */
-		case 0x08: // OR r/m8, r8
+		OPCASE(0x08): // OR r/m8, r8
 			LOGOP_RM_R(|, OR, b);
-			break;
-		case 0x09: // OR r/m16, r16 (OR r/m32, r32)
+			NEXT_OP;
+		OPCASE(0x09): // OR r/m16, r16 (OR r/m32, r32)
 			if (opsize == size16) {
 				LOGOP_RM_R(|, OR, w);
 			} else {
 				LOGOP_RM_R(|, OR, d);
 			}
-			break;
-		case 0x0a: // OR r8, r/m8
+			NEXT_OP;
+		OPCASE(0x0a): // OR r8, r/m8
 			LOGOP_R_RM(|, OR, b);
-			break;
-		case 0x0b: // OR r16, r/m16 (OR r32, r/m32)
+			NEXT_OP;
+		OPCASE(0x0b): // OR r16, r/m16 (OR r32, r/m32)
 			if (opsize == size16) {
 				LOGOP_R_RM(|, OR, w);
 			} else {
 				LOGOP_R_RM(|, OR, d);
 			}
-			break;
-		case 0x0c: // OR AL, imm8
+			NEXT_OP;
+		OPCASE(0x0c): // OR AL, imm8
 			CLKS(CLK_CAL_R_IMM);
 			DAS_prt_post_op(1);
-			src = mem->read8(get_seg_adr(CS, eip));
+			src = fetch8(eip);
 			DAS_pr("OR AL, 0x%02x\n", src);
 			al |= src;
 			FLAG_LOGOPb(al);
 			eip++;
-			break;
-		case 0x0d: // OR AX, imm16 (OR EAX, imm32)
+			NEXT_OP;
+		OPCASE(0x0d): // OR AX, imm16 (OR EAX, imm32)
 			CLKS(CLK_CAL_R_IMM);
 			if (opsize == size16) {
 				DAS_prt_post_op(2);
-				src = mem->read16(get_seg_adr(CS, eip));
+				src = fetch16(eip);
 				DAS_pr("OR AX, 0x%04x\n", src);
 				ax |= src;
 				FLAG_LOGOPw(ax);
 				eip += 2;
 			} else {
 				DAS_prt_post_op(4);
-				src = mem->read32(get_seg_adr(CS, eip));
+				src = fetch32(eip);
 				DAS_pr("OR EAX, 0x%08x\n", src);
 				eax |= src;
 				FLAG_LOGOPd(eax);
 				eip += 4;
 			}
-			break;
+			NEXT_OP;
 
 /******************** PUSH ********************/
 // xxxセグメントオーバーライドされていても、
 // call, pusha, enterではSSを使うらしい
 
-		case 0x06: // PUSH ES
+		OPCASE(0x06): // PUSH ES
 			CLKS(CLK_PUSH_SR);
 			PUSH_SEG(ES);
-			break;
-		case 0x0e: // PUSH CS
+			NEXT_OP;
+		OPCASE(0x0e): // PUSH CS
 			CLKS(CLK_PUSH_SR);
 			PUSH_SEG(CS);
-			break;
-		case 0x16: // PUSH SS
+			NEXT_OP;
+		OPCASE(0x16): // PUSH SS
 			CLKS(CLK_PUSH_SR);
 			PUSH_SEG(SS);
-			break;
-		case 0x1e: // PUSH DS
+			NEXT_OP;
+		OPCASE(0x1e): // PUSH DS
 			CLKS(CLK_PUSH_SR);
 			PUSH_SEG(DS);
-			break;
+			NEXT_OP;
 
-		case 0x50: // PUSH AX (PUSH EAX)
+		OPCASE(0x50): // PUSH AX (PUSH EAX)
 			CLKS(CLK_PUSH_R);
 			if (opsize == size16) {
 				PUSHW_GENREG(ax);
 			} else {
 				PUSHD_GENREG(eax);
 			}
-			break;
-		case 0x51: // PUSH CX (PUSH ECX)
+			NEXT_OP;
+		OPCASE(0x51): // PUSH CX (PUSH ECX)
 			CLKS(CLK_PUSH_R);
 			if (opsize == size16) {
 				PUSHW_GENREG(cx);
 			} else {
 				PUSHD_GENREG(ecx);
 			}
-			break;
-		case 0x52: // PUSH DX (PUSH EDX)
+			NEXT_OP;
+		OPCASE(0x52): // PUSH DX (PUSH EDX)
 			CLKS(CLK_PUSH_R);
 			if (opsize == size16) {
 				PUSHW_GENREG(dx);
 			} else {
 				PUSHD_GENREG(edx);
 			}
-			break;
-		case 0x53: // PUSH BX (PUSH EBX)
+			NEXT_OP;
+		OPCASE(0x53): // PUSH BX (PUSH EBX)
 			CLKS(CLK_PUSH_R);
 			if (opsize == size16) {
 				PUSHW_GENREG(bx);
 			} else {
 				PUSHD_GENREG(ebx);
 			}
-			break;
-		case 0x54: // PUSH SP (PUSH ESP)
+			NEXT_OP;
+		OPCASE(0x54): // PUSH SP (PUSH ESP)
 			CLKS(CLK_PUSH_R);
 			if (opsize == size16) {
 				PUSHW_GENREG(sp);
 			} else {
 				PUSHD_GENREG(esp);
 			}
-			break;
-		case 0x55: // PUSH BP (PUSH EBP)
+			NEXT_OP;
+		OPCASE(0x55): // PUSH BP (PUSH EBP)
 			CLKS(CLK_PUSH_R);
 			if (opsize == size16) {
 				PUSHW_GENREG(bp);
 			} else {
 				PUSHD_GENREG(ebp);
 			}
-			break;
-		case 0x56: // PUSH SI (PUSH ESI)
+			NEXT_OP;
+		OPCASE(0x56): // PUSH SI (PUSH ESI)
 			CLKS(CLK_PUSH_R);
 			if (opsize == size16) {
 				PUSHW_GENREG(si);
 			} else {
 				PUSHD_GENREG(esi);
 			}
-			break;
-		case 0x57: // PUSH DI (PUSH EDI)
+			NEXT_OP;
+		OPCASE(0x57): // PUSH DI (PUSH EDI)
 			CLKS(CLK_PUSH_R);
 			if (opsize == size16) {
 				PUSHW_GENREG(di);
 			} else {
 				PUSHD_GENREG(edi);
 			}
-			break;
+			NEXT_OP;
 
-		case 0x60: // PUSHA (PUSHAD)
+		OPCASE(0x60): // PUSHA (PUSHAD)
 			CLKS(CLK_PUSHA);
 			DAS_prt_post_op(0);
 			if (opsize == size16) {
@@ -830,35 +2347,36 @@ s32 CPU::exec(void) {
 				PUSHD0(esi);
 				PUSHD0(edi);
 			}
-			break;
+			NEXT_OP;
 
-		case 0x68: // PUSH imm16 (PUSH imm32)
+		OPCASE(0x68): // PUSH imm16 (PUSH imm32)
 			CLKS(CLK_PUSH_IMM);
 			if (opsize == size16) {
 				DAS_prt_post_op(2);
-				dst = mem->read16(get_seg_adr(CS, eip));
+				dst = fetch16(eip);
 				DAS_pr("PUSH 0x%04x\n", dst);
 				PUSHW(dst);
 				eip += 2;
 			} else {
 				DAS_prt_post_op(4);
-				dst = mem->read32(get_seg_adr(CS, eip));
+				dst = fetch32(eip);
 				DAS_pr("PUSH 0x%08x\n", dst);
 				PUSHD(dst);
 				eip += 4;
 			}
-			break;
+			NEXT_OP;
 
-		case 0x6a: // PUSH imm8
+		OPCASE(0x6a): // PUSH imm8
 			CLKS(CLK_PUSH_IMM);
 			DAS_prt_post_op(2);
-			dst = mem->read8(get_seg_adr(CS, eip));
+			dst = fetch8(eip);
 			DAS_pr("PUSH 0x%02x\n", dst);
 			PUSH(dst);
 			eip += 1;
-			break;
+			NEXT_OP;
 
-		case 0x9c: // PUSHF (PUSHFD)
+		OPCASE(0x9c): // PUSHF (PUSHFD)
+			LF_SYNC();
 			CLKS(CLK_PUSHF);
 			DAS_prt_post_op(0);
 			if (opsize == size16) {
@@ -868,91 +2386,91 @@ s32 CPU::exec(void) {
 				DAS_pr("PUSHFD\n");
 				PUSHD(eflagsu16 << 16 | flagu8 << 8 | flag8);
 			}
-			break;
+			NEXT_OP;
 
 /******************** POP ********************/
 // xxxセグメントオーバーライドされていても、
 // call, pusha, enterではSSを使うらしい
 
-		case 0x07: // POP ES
-			CLKS(isRealMode?CLK_POP_SR:CLK_PM_POP_SR);
+		OPCASE(0x07): // POP ES
+			CLKS(REAL?CLK_POP_SR:CLK_PM_POP_SR);
 			POP_SEG(ES);
-			break;
-		case 0x17: // POP SS
-			CLKS(isRealMode?CLK_POP_SR:CLK_PM_POP_SR);
+			NEXT_OP;
+		OPCASE(0x17): // POP SS
+			CLKS(REAL?CLK_POP_SR:CLK_PM_POP_SR);
 			POP_SEG(SS);
-			break;
-		case 0x1f: // POP DS
-			CLKS(isRealMode?CLK_POP_SR:CLK_PM_POP_SR);
+			NEXT_OP;
+		OPCASE(0x1f): // POP DS
+			CLKS(REAL?CLK_POP_SR:CLK_PM_POP_SR);
 			POP_SEG(DS);
-			break;
+			NEXT_OP;
 
-		case 0x58: // POP AX (POP EAX)
+		OPCASE(0x58): // POP AX (POP EAX)
 			CLKS(CLK_POP_R);
 			if (opsize == size16) {
 				POPW_GENREG(ax);
 			} else {
 				POPD_GENREG(eax);
 			}
-			break;
-		case 0x59: // POP CX (POP ECX)
+			NEXT_OP;
+		OPCASE(0x59): // POP CX (POP ECX)
 			CLKS(CLK_POP_R);
 			if (opsize == size16) {
 				POPW_GENREG(cx);
 			} else {
 				POPD_GENREG(ecx);
 			}
-			break;
-		case 0x5a: // POP DX (POP EDX)
+			NEXT_OP;
+		OPCASE(0x5a): // POP DX (POP EDX)
 			CLKS(CLK_POP_R);
 			if (opsize == size16) {
 				POPW_GENREG(dx);
 			} else {
 				POPD_GENREG(edx);
 			}
-			break;
-		case 0x5b: // POP BX (POP EBX)
+			NEXT_OP;
+		OPCASE(0x5b): // POP BX (POP EBX)
 			CLKS(CLK_POP_R);
 			if (opsize == size16) {
 				POPW_GENREG(bx);
 			} else {
 				POPD_GENREG(ebx);
 			}
-			break;
-		case 0x5c: // POP SP (POP ESP)
+			NEXT_OP;
+		OPCASE(0x5c): // POP SP (POP ESP)
 			CLKS(CLK_POP_R);
 			if (opsize == size16) {
 				POPW_GENREG(sp);
 			} else {
 				POPD_GENREG(esp);
 			}
-			break;
-		case 0x5d: // POP BP (POP EBP)
+			NEXT_OP;
+		OPCASE(0x5d): // POP BP (POP EBP)
 			CLKS(CLK_POP_R);
 			if (opsize == size16) {
 				POPW_GENREG(bp);
 			} else {
 				POPD_GENREG(ebp);
 			}
-			break;
-		case 0x5e: // POP SI (POP ESI)
+			NEXT_OP;
+		OPCASE(0x5e): // POP SI (POP ESI)
 			CLKS(CLK_POP_R);
 			if (opsize == size16) {
 				POPW_GENREG(si);
 			} else {
 				POPD_GENREG(esi);
 			}
-			break;
-		case 0x5f: // POP DI (POP EDI)
+			NEXT_OP;
+		OPCASE(0x5f): // POP DI (POP EDI)
 			CLKS(CLK_POP_R);
 			if (opsize == size16) {
 				POPW_GENREG(di);
 			} else {
 				POPD_GENREG(edi);
 			}
-			break;
+			NEXT_OP;
 
-		case 0x61: // POPA (POPAD)
+		OPCASE(0x61): // POPA (POPAD)
 			CLKS(CLK_POPA);
 			DAS_prt_post_op(0);
 			if (opsize == size16) {
@@ -976,7 +2494,7 @@ s32 CPU::exec(void) {
 				POPD0(ecx);
 				POPD0(eax);
 			}
-			break;
+			NEXT_OP;
 
 /*
   +--------+-----------+---------+---------+
@@ -984,10 +2502,10 @@ s32 CPU::exec(void) {
   +--------+-----------+---------+---------+
 */
 			// xxx POP r16とPOP m16の違いは？
-		case 0x8f: // POP m16 (POP m32)
+		OPCASE(0x8f): // POP m16 (POP m32)
 			CLKS(CLK_POP_MEM);
 			if (opsize == size16) {
-				modrm = mem->read8(get_seg_adr(CS, eip));
+				modrm = fetch8(eip);
 				DAS_prt_post_op(nr_disp_modrm(modrm) + 1);
 				DAS_pr("POP ");
 				DAS_modrm(modrm, false, true, word);
@@ -999,7 +2517,7 @@ s32 CPU::exec(void) {
 				}
 				sp += 2;
 			} else {
-				modrm = mem->read8(get_seg_adr(CS, eip));
+				modrm = fetch8(eip);
 				DAS_prt_post_op(nr_disp_modrm(modrm) + 1);
 				DAS_pr("POP ");
 				DAS_modrm(modrm, false, true, dword);
@@ -1011,9 +2529,10 @@ s32 CPU::exec(void) {
 				}
 				sp += 4;
 			}
-			break;
+			NEXT_OP;
 
-		case 0x9d: // POPF (POPFD)
+		OPCASE(0x9d): // POPF (POPFD)
+			LF_SYNC();
 			CLKS(CLK_POPF);
 			DAS_prt_post_op(0);
 			if (opsize == size16) {
@@ -1028,7 +2547,7 @@ s32 CPU::exec(void) {
 				flagu8 = (u8)(dst >> 8);
 				flag8  = dst & 0xff;
 			}
-			break;
+			NEXT_OP;
 
 /******************** AND ********************/
 /*
@@ -1038,57 +2557,58 @@ s32 CPU::exec(void) {
   OF/CF:クリア, SF/ZF/PF:結果による, AF:不定
 */
 
-		case 0x20: // AND r/m8, r8
+		OPCASE(0x20): // AND r/m8, r8
 			LOGOP_RM_R(&, AND, b);
-			break;
-		case 0x21: // AND r/m16, r16 (AND r/m32, r32)
+			NEXT_OP;
+		OPCASE(0x21): // AND r/m16, r16 (AND r/m32, r32)
 			if (opsize == size16) {
 				LOGOP_RM_R(&, AND, w);
 			} else {
 				LOGOP_RM_R(&, AND, d);
 			}
-			break;
-		case 0x22: // AND r8, r/m8
+			NEXT_OP;
+		OPCASE(0x22): // AND r8, r/m8
 			LOGOP_R_RM(&, AND, b);
-			break;
-		case 0x23: // AND r16, r/m16 (AND r32, r/m32)
+			NEXT_OP;
+		OPCASE(0x23): // AND r16, r/m16 (AND r32, r/m32)
 			if (opsize == size16) {
 				LOGOP_R_RM(&, AND, w);
 			} else {
 				LOGOP_R_RM(&, AND, d);
 			}
-			break;
+			NEXT_OP;
 /*
   +--------+--------+-------------+
   |0010010w|  data  |(data if w=1)|
   +--------+--------+-------------+
   OF/CF:クリア, SF/ZF/PF:結果による, AF:不定
 */
-		case 0x24: // AND al, imm8
+		OPCASE(0x24): // AND al, imm8
 			CLKS(CLK_CAL_R_IMM);
 			DAS_prt_post_op(1);
-			DAS_pr("AND AL, 0x%02x\n", mem->read8(get_seg_adr(CS, eip)));
-			al &= mem->read8(get_seg_adr(CS, eip++));
+			DAS_pr("AND AL, 0x%02x\n", fetch8(eip));
+			al &= fetch8(eip++);
 			FLAG_LOGOPb(al);
-			break;
-		case 0x25: // AND AX, imm16 (AND EAX, imm32)
+			NEXT_OP;
+		OPCASE(0x25): // AND AX, imm16 (AND EAX, imm32)
 			CLKS(CLK_CAL_R_IMM);
 			DAS_prt_post_op(opsize == size16?2:4);
-			DAS_pr((opsize == size16)?"AND AX, 0x%04x\n":"AND EAX, 0x%08x\n", (opsize == size16)?mem->read16(get_seg_adr(CS, eip)):mem->read32(get_seg_adr(CS, eip)));
+			DAS_pr((opsize == size16)?"AND AX, 0x%04x\n":"AND EAX, 0x%08x\n", (opsize == size16)?fetch16(eip):fetch32(eip));
 			if (opsize == size16) {
-				ax &= mem->read16(get_seg_adr(CS, eip));
+				ax &= fetch16(eip);
 				FLAG_LOGOPw(ax);
 				eip += 2;
 			} else {
-				eax &= mem->read32(get_seg_adr(CS, eip));
+				eax &= fetch32(eip);
 				eip += 4;
 				FLAG_LOGOPd(eax);
 			}
-			break;
+			NEXT_OP;
 
 /******************** DAA/DAS/AAA/AAS/AAM/AAD ********************/
 
-		case 0x27:
+		OPCASE(0x27):
+			LF_SYNC();
 			CLKS(CLK_DAA);
 			DAS_prt_post_op(0);
 			DAS_pr("DAA\n");
@@ -1108,8 +2628,9 @@ s32 CPU::exec(void) {
 			al = (u8)res;
 			// CFは確定しているの判定は8bitで行う
 			flag8 |= flag_calb[al];
-			break;
-		case 0x2f:
+			NEXT_OP;
+		OPCASE(0x2f):
+			LF_SYNC();
 			CLKS(CLK_DAS);
 			DAS_prt_post_op(0);
 			DAS_pr("DAS\n");
@@ -1127,8 +2648,9 @@ s32 CPU::exec(void) {
 			}
 			al = (u8)res;
 			flag8 |= flag_calb[al];
-			break;
-		case 0x37:
+			NEXT_OP;
+		OPCASE(0x37):
+			LF_SYNC();
 			CLKS(CLK_AAA);
 			DAS_prt_post_op(0);
 			DAS_pr("AAA\n");
@@ -1141,8 +2663,9 @@ s32 CPU::exec(void) {
 				// CF, AFも含めてリセット(他は未定義)
 				flag8 = 0;
 			}
-			break;
-		case 0x3f:
+			NEXT_OP;
+		OPCASE(0x3f):
+			LF_SYNC();
 			CLKS(CLK_AAS);
 			DAS_prt_post_op(0);
 			DAS_pr("AAS\n");
@@ -1153,11 +2676,12 @@ s32 CPU::exec(void) {
 			} else {
 				flag8 = 0;
 			}
-			break;
-		case 0xd4:
+			NEXT_OP;
+		OPCASE(0xd4):
+			LF_SYNC();
 			CLKS(CLK_AAM);
 			DAS_prt_post_op(1);
-			tmpb = mem->read8(get_seg_adr(CS, eip));
+			tmpb = fetch8(eip);
 			if (tmpb != 0x0a) {
 				// imm8が0x0aでなければ本当はミーモニックなし
 				DAS_pr("AAM 0x%02x\n", tmpb);
@@ -1168,11 +2692,12 @@ s32 CPU::exec(void) {
 			ah = al / tmpb;
 			al = al % tmpb;
 			flag8 = flag_calb[al]; // CFは未定義(OF, AFも未定義)
-			break;
-		case 0xd5:
+			NEXT_OP;
+		OPCASE(0xd5):
+			LF_SYNC();
 			CLKS(CLK_AAD);
 			DAS_prt_post_op(1);
-			tmpb = mem->read8(get_seg_adr(CS, eip));
+			tmpb = fetch8(eip);
 			if (tmpb != 0x0a) {
 				DAS_pr("AAD 0x%02x\n", tmpb);
 			} else {
@@ -1182,47 +2707,49 @@ s32 CPU::exec(void) {
 			al += (ah + tmpb) & 0xff;
 			ah = 0;
 			flag8 = flag_calb[al];
-			break;
+			NEXT_OP;
 
 /******************** SBB ********************/
 
-		case 0x18: // SBB r/m8, r8
+		OPCASE(0x18): // SBB r/m8, r8
 			CAL_RM_R(SBB, b, -(flag8 & CF));
-			break;
-		case 0x19: // SBB r/m16, r16 (SBB r/m32, r32)
+			NEXT_OP;
+		OPCASE(0x19): // SBB r/m16, r16 (SBB r/m32, r32)
 			if (opsize == size16) {
 				CAL_RM_R(SBB, w, -(flag8 & CF));
 			} else {
 				CAL_RM_R(SBB, d, -(flag8 & CF));
 			}
-			break;
-		case 0x1a: // SBB r8, r/m8
+			NEXT_OP;
+		OPCASE(0x1a): // SBB r8, r/m8
 			CAL_R_RM(SBB, b, -(flag8 & CF));
-			break;
-		case 0x1b: // SBB r16, r/m16 (SBB r32, r/m32)
+			NEXT_OP;
+		OPCASE(0x1b): // SBB r16, r/m16 (SBB r32, r/m32)
 			if (opsize == size16) {
 				CAL_R_RM(SBB, w, -(flag8 & CF));
 			} else {
 				CAL_R_RM(SBB, d, -(flag8 & CF));
 			}
-			break;
-		case 0x1c: // SBB AL, imm8
+			NEXT_OP;
+		OPCASE(0x1c): // SBB AL, imm8
+			LF_SYNC();
 			CLKS(CLK_CAL_R_IMM);
 			DAS_prt_post_op(1);
-			DAS_pr("SBB AL, 0x%02x\n", mem->read8(get_seg_adr(CS, eip)));
+			DAS_pr("SBB AL, 0x%02x\n", fetch8(eip));
 			dst = al;
-			src = mem->read8(get_seg_adr(CS, eip));
+			src = fetch8(eip);
 			res = dst - src - (flag8 & CF);
 			al = (u8)res;
 			eip ++;
 			FLAG8bSBB(res, src, dst, );
 			OF_SBBb(res, src, dst);
-			break;
-		case 0x1d: // SBB AX, imm16 (SBB EAX, imm32)
+			NEXT_OP;
+		OPCASE(0x1d): // SBB AX, imm16 (SBB EAX, imm32)
+			LF_SYNC();
 			CLKS(CLK_CAL_R_IMM);
 			if (opsize == size16) {
 				DAS_prt_post_op(2);
-				src = mem->read16(get_seg_adr(CS, eip));
+				src = fetch16(eip);
 				DAS_pr("SBB AX, 0x%04x\n", src);
 				dst = ax;
 				res = dst - src - (flag8 & CF);
@@ -1232,7 +2759,7 @@ s32 CPU::exec(void) {
 				OF_SBBw(res, src, dst);
 			} else {
 				DAS_prt_post_op(4);
-				src = mem->read32(get_seg_adr(CS, eip));
+				src = fetch32(eip);
 				DAS_pr("SBB EAX, 0x%08x\n", src);
 				dst = eax;
 				res = dst - src - (flag8 & CF);
@@ -1241,34 +2768,34 @@ s32 CPU::exec(void) {
 				FLAG8dSBB(res, src, dst, (flag8 & CF));
 				OF_SBBd(res, src, dst);
 			}
-			break;
+			NEXT_OP;
 
 /******************** SUB ********************/
 
-		case 0x28: // SUB r/m8, r8
+		OPCASE(0x28): // SUB r/m8, r8
 			CAL_RM_R(SUB, b, 0);
-			break;
-		case 0x29: // SUB r/m16, r16 (SUB r/m32, r32)
+			NEXT_OP;
+		OPCASE(0x29): // SUB r/m16, r16 (SUB r/m32, r32)
 			if (opsize == size16) {
 				CAL_RM_R(SUB, w, 0);
 			} else {
 				CAL_RM_R(SUB, d, 0);
 			}
-			break;
-		case 0x2a: // SUB r8, r/m8
+			NEXT_OP;
+		OPCASE(0x2a): // SUB r8, r/m8
 			CAL_R_RM(SUB, b, 0);
-			break;
-		case 0x2b: // SUB r16, r/m16 (SUB r32, r/m32)
+			NEXT_OP;
+		OPCASE(0x2b): // SUB r16, r/m16 (SUB r32, r/m32)
 			if (opsize == size16) {
 				CAL_R_RM(SUB, w, 0);
 			} else {
 				CAL_R_RM(SUB, d, 0);
 			}
-			break;
-		case 0x2c: // SUB AL, imm8
+			NEXT_OP;
+		OPCASE(0x2c): // SUB AL, imm8
 			CLKS(CLK_CAL_R_IMM);
 			DAS_prt_post_op(1);
-			src = mem->read8(get_seg_adr(CS, eip));
+			src = fetch8(eip);
 			DAS_pr("SUB AL, 0x%02x\n", src);
 			dst = al;
 			res = dst - src;
@@ -1276,12 +2803,12 @@ s32 CPU::exec(void) {
 			eip ++;
 			FLAG8bSUB(res, src, dst, );
 			OF_SUBb(res, src, dst);
-			break;
-		case 0x2d: // SUB AX, imm16 (SUB EAX, imm32)
+			NEXT_OP;
+		OPCASE(0x2d): // SUB AX, imm16 (SUB EAX, imm32)
 			CLKS(CLK_CAL_R_IMM);
 			if (opsize == size16) {
 				DAS_prt_post_op(2);
-				src = mem->read16(get_seg_adr(CS, eip));
+				src = fetch16(eip);
 				DAS_pr("SUB AX, 0x%04x\n", src);
 				dst = ax;
 				res = dst - src;
@@ -1291,7 +2818,7 @@ s32 CPU::exec(void) {
 				OF_SUBw(res, src, dst);
 			} else {
 				DAS_prt_post_op(4);
-				src = mem->read32(get_seg_adr(CS, eip));
+				src = fetch32(eip);
 				DAS_pr("SUB EAX, 0x%08x\n", src);
 				dst = eax;
 				res = dst - src;
@@ -1300,7 +2827,7 @@ s32 CPU::exec(void) {
 				FLAG8dSUB(res, src, dst, );
 				OF_SUBd(res, src, dst);
 			}
-			break;
+			NEXT_OP;
 
 /******************** XOR ********************/
 /*
@@ -1311,53 +2838,52 @@ s32 CPU::exec(void) {
   OF/CF:クリア, SF/ZF/PF:結果による, AF:不定
 */
 
-		case 0x30: // XOR r/m8, r8
+		OPCASE(0x30): // XOR r/m8, r8
 			LOGOP_RM_R(^, XOR, b);
-			break;
-		case 0x31: // XOR r/m16, r16 (XOR r/m32, r32)
+			NEXT_OP;
+		OPCASE(0x31): // XOR r/m16, r16 (XOR r/m32, r32)
 			if (opsize == size16) {
 				LOGOP_RM_R(^, XOR, w);
 			} else {
 				LOGOP_RM_R(^, XOR, d);
 			}
-			break;
-		case 0x32: // XOR r8, r/m8
+			NEXT_OP;
+		OPCASE(0x32): // XOR r8, r/m8
 			LOGOP_R_RM(^, XOR, b);
-			break;
-		case 0x33: // XOR r16, r/m16 (XOR r32, r/m32)
+			NEXT_OP;
+		OPCASE(0x33): // XOR r16, r/m16 (XOR r32, r/m32)
 			if (opsize == size16) {
 				LOGOP_R_RM(^, XOR, w);
 			} else {
 				LOGOP_R_RM(^, XOR, d);
 			}
-			break;
-		case 0x34: // XOR AL, imm8
+			NEXT_OP;
+		OPCASE(0x34): // XOR AL, imm8
 			CLKS(CLK_CAL_R_IMM);
 			DAS_prt_post_op(1);
-			DAS_pr("XOR AL, 0x%02x\n", mem->read8(get_seg_adr(CS, eip)));
-			al ^= mem->read8(get_seg_adr(CS, eip));
+			DAS_pr("XOR AL, 0x%02x\n", fetch8(eip));
+			al ^= fetch8(eip);
 			eip++;
-			flag8 = flag_calb[al];
-			flagu8 &= ~OFSET8;
-			break;
-		case 0x35: // XOR AX, imm16 (XOR EAX, imm32)
+			FLAG_LOGOPb(al);
+			NEXT_OP;
+		OPCASE(0x35): // XOR AX, imm16 (XOR EAX, imm32)
 			CLKS(CLK_CAL_R_IMM);
 			if (opsize == size16) {
 				DAS_prt_post_op(2);
-				src = mem->read16(get_seg_adr(CS, eip));
+				src = fetch16(eip);
 				DAS_pr("XOR AX, 0x%04x\n", src);
 				ax ^= src;
 				eip += 2;
 				FLAG_LOGOPw(ax);
 			} else {
 				DAS_prt_post_op(4);
-				src = mem->read32(get_seg_adr(CS, eip));
+				src = fetch32(eip);
 				DAS_pr("XOR EAX, 0x%08x\n", src);
 				eax ^= src;
 				eip += 4;
 				FLAG_LOGOPd(eax);
 			}
-			break;
+			NEXT_OP;
 
 /******************** CMP ********************/
 
@@ -1365,43 +2891,41 @@ s32 CPU::exec(void) {
   3C ib
   CF/OF/SF/ZF/AF/PF:結果による
 */
-		case 0x38: // CMP r/m8, r8
+		OPCASE(0x38): // CMP r/m8, r8
 			CMP_RM_R(b);
-			break;
-		case 0x39: // CMP r/m16, r16 (CMP r/m32, r32)
+			NEXT_OP;
+		OPCASE(0x39): // CMP r/m16, r16 (CMP r/m32, r32)
 			if (opsize == size16) {
 				CMP_RM_R(w);
 			} else {
 				CMP_RM_R(d);
 			}
-			break;
-		case 0x3A: // CMP r8, r/m8
+			NEXT_OP;
+		OPCASE(0x3a): // CMP r8, r/m8
 			CMP_R_RM(b);
-			break;
-		case 0x3B: // CMP r16, r/m16 (CMP r32, r/m32)
+			NEXT_OP;
+		OPCASE(0x3b): // CMP r16, r/m16 (CMP r32, r/m32)
 			if (opsize == size16) {
 				CMP_R_RM(w);
 			} else {
 				CMP_R_RM(d);
 			}
-			break;
-		case 0x3c: // CMP AL, imm8
+			NEXT_OP;
+		OPCASE(0x3c): // CMP AL, imm8
 			CLKS(CLK_CMP_R_IMM);
 			DAS_prt_post_op(1);
-			src = mem->read8(get_seg_adr(CS, eip));
+			src = fetch8(eip);
 			DAS_pr("CMP AL, 0x%02x\n", src);
 			res = al - src;
 			eip++;
-			flag8 = flag_calb[res & 0x1ff];
-			flag8 |= (al ^ src ^ res) & AF;
-			(al ^ res) & (al ^ src) & 0x80?
-				flagu8 |= OFSET8 : flagu8 &= ~OFSET8;
-			break;
-		case 0x3d: // CMP AX, imm16 (CMP EAX, imm32)
+			FLAG8bSUB(res, src, al, );
+			OF_SUBb(res, src, al);
+			NEXT_OP;
+		OPCASE(0x3d): // CMP AX, imm16 (CMP EAX, imm32)
 			CLKS(CLK_CMP_R_IMM);
 			if (opsize == size16) {
 				DAS_prt_post_op(2);
-				src = mem->read16(get_seg_adr(CS, eip));
+				src = fetch16(eip);
 				DAS_pr("CMP AX, 0x%04x\n", src);
 				res = ax - src;
 				eip += 2;
@@ -1409,186 +2933,228 @@ s32 CPU::exec(void) {
 				OF_SUBw(res, src, ax);
 			} else {
 				DAS_prt_post_op(4);
-				src = mem->read32(get_seg_adr(CS, eip));
+				src = fetch32(eip);
 				DAS_pr("CMP EAX, 0x%08x\n", src);
 				res = eax - src;
 				eip += 4;
 				FLAG8dSUB(res, src, eax, );
 				OF_SUBd(res, src, eax);
 			}
-			break;
+			NEXT_OP;
 
 
 /******************** INC ********************/
 /*
   CF:影響なし, OF/SF/ZF/AF/PF:結果による
 */
-		case 0x40: // INC AX (INC EAX)
+		OPCASE(0x40): // INC AX (INC EAX)
 			CLKS(CLK_INCDEC_R);
 			if (opsize == size16) {
 				INC_R16(ax);
 			} else {
 				INC_R32(eax);
 			}
-			break;
-		case 0x41: // INC CX (INC ECX)
+			NEXT_OP;
+		OPCASE(0x41): // INC CX (INC ECX)
 			CLKS(CLK_INCDEC_R);
 			if (opsize == size16) {
 				INC_R16(cx);
 			} else {
 				INC_R32(ecx);
 			}
-			break;
-		case 0x42: // INC DX (INC EDX)
+			NEXT_OP;
+		OPCASE(0x42): // INC DX (INC EDX)
 			CLKS(CLK_INCDEC_R);
 			if (opsize == size16) {
 				INC_R16(dx);
 			} else {
 				INC_R32(edx);
 			}
-			break;
-		case 0x43: // INC BX (INC EBX)
+			NEXT_OP;
+		OPCASE(0x43): // INC BX (INC EBX)
 			CLKS(CLK_INCDEC_R);
 			if (opsize == size16) {
 				INC_R16(bx);
 			} else {
 				INC_R32(ebx);
 			}
-			break;
-		case 0x44: // INC SP (INC ESP)
+			NEXT_OP;
+		OPCASE(0x44): // INC SP (INC ESP)
 			CLKS(CLK_INCDEC_R);
 			if (opsize == size16) {
 				INC_R16(sp);
 			} else {
 				INC_R32(esp);
 			}
-			break;
-		case 0x45: // INC BP (INC EBP)
+			NEXT_OP;
+		OPCASE(0x45): // INC BP (INC EBP)
 			CLKS(CLK_INCDEC_R);
 			if (opsize == size16) {
 				INC_R16(bp);
 			} else {
 				INC_R32(ebp);
 			}
-			break;
-		case 0x46: // INC SI (INC ESI)
+			NEXT_OP;
+		OPCASE(0x46): // INC SI (INC ESI)
 			CLKS(CLK_INCDEC_R);
 			if (opsize == size16) {
 				INC_R16(si);
 			} else {
 				INC_R32(esi);
 			}
-			break;
-		case 0x47: // INC DI (INC EDI)
+			NEXT_OP;
+		OPCASE(0x47): // INC DI (INC EDI)
 			CLKS(CLK_INCDEC_R);
 			if (opsize == size16) {
 				INC_R16(di);
 			} else {
 				INC_R32(edi);
 			}
-			break;
+			NEXT_OP;
 
 /******************** DEC ********************/
 /*
   CF:影響なし, OF/SF/ZF/AF/PF:結果による
 */
-		case 0x48: // DEC AX (DEC EAX)
+		OPCASE(0x48): // DEC AX (DEC EAX)
 			CLKS(CLK_INCDEC_R);
 			if (opsize  == size16) {
 				DEC_R16(ax);
 			} else {
 				DEC_R32(eax);
 			}
-			break;
-		case 0x49: // DEC CX (DEC ECX)
+			NEXT_OP;
+		OPCASE(0x49): // DEC CX (DEC ECX)
 			CLKS(CLK_INCDEC_R);
 			if (opsize  == size16) {
 				DEC_R16(cx);
 			} else {
 				DEC_R32(ecx);
 			}
-			break;
-		case 0x4a: // DEC DX (DEC EDX)
+			NEXT_OP;
+		OPCASE(0x4a): // DEC DX (DEC EDX)
 			CLKS(CLK_INCDEC_R);
 			if (opsize  == size16) {
 				DEC_R16(dx);
 			} else {
 				DEC_R32(edx);
 			}
-			break;
-		case 0x4b: // DEC BX (DEC EBX)
+			NEXT_OP;
+		OPCASE(0x4b): // DEC BX (DEC EBX)
 			CLKS(CLK_INCDEC_R);
 			if (opsize  == size16) {
 				DEC_R16(bx);
 			} else {
 				DEC_R32(ebx);
 			}
-			break;
-		case 0x4c: // DEC SP (DEC ESP)
+			NEXT_OP;
+		OPCASE(0x4c): // DEC SP (DEC ESP)
 			CLKS(CLK_INCDEC_R);
 			if (opsize  == size16) {
 				DEC_R16(sp);
 			} else {
 				DEC_R32(esp);
 			}
-			break;
-		case 0x4d: // DEC BP (DEC EBP)
+			NEXT_OP;
+		OPCASE(0x4d): // DEC BP (DEC EBP)
 			CLKS(CLK_INCDEC_R);
 			if (opsize  == size16) {
 				DEC_R16(bp);
 			} else {
 				DEC_R32(ebp);
 			}
-			break;
-		case 0x4e: // DEC SI (DEC ESI)
+			NEXT_OP;
+		OPCASE(0x4e): // DEC SI (DEC ESI)
 			CLKS(CLK_INCDEC_R);
 			if (opsize  == size16) {
 				DEC_R16(si);
 			} else {
 				DEC_R32(esi);
 			}
-			break;
-		case 0x4f: // DEC DI (DEC EDI)
+			NEXT_OP;
+		OPCASE(0x4f): // DEC DI (DEC EDI)
 			CLKS(CLK_INCDEC_R);
 			if (opsize  == size16) {
 				DEC_R16(di);
 			} else {
 				DEC_R32(edi);
 			}
-			break;
+			NEXT_OP;
 
-		case 0x0f:
-			subop = mem->read8(get_seg_adr(CS, eip));
-			switch (subop) {
-			case 0x01: // LGDT/LIDT
+		OPCASE(0x0f):
+			subop = fetch8(eip);
+			OP_SWITCH(subop, optbl0f) {
+			OPCASE0F(0x00): // SLDT/STR/LLDT/LTR/VERR/VERW
+				DAS_prt_post_op(2);
+				modrm = fetch8(++eip);
+				switch (modrm >> 3 & 7) {
+				case 1: // STR r/m16
+					CLKS(CLK_STR);
+					DAS_pr("STR ");
+					DAS_modrm(modrm, false, true, word);
+					eip++;
+					if ((modrm & 0xc0) == 0xc0) {
+						genregw(modrm & 7) = tr;
+					} else {
+						mem->write16(modrm_seg_ea(modrm), tr);
+					}
+					break;
+				case 3: // LTR r/m16
+					CLKS(CLK_LTR);
+					DAS_pr("LTR ");
+					DAS_modrm(modrm, false, true, word);
+					eip++;
+					if ((modrm & 0xc0) == 0xc0) {
+						tr = genregw(modrm & 7);
+					} else {
+						tr = mem->read16(modrm_seg_ea(modrm));
+					}
+					tmpadr = gdtr.base + (tr & 0xfff8);
+					tr_base = (mem->read32(tmpadr + 2) & 0x00ffffff)
+						+ (mem->read8(tmpadr + 7) << 24);
+					// TSSディスクリプタをビジーにする
+					tmpb = mem->read8(tmpadr + 5) | 0x02;
+					mem->write8(tmpadr + 5, tmpb);
+					tr_type = tmpb & 0x0f;
+					break;
+				default:
+					DAS_pr("xxxxx\n");
+					break;
+				}
+				NEXT_OP;
+			OPCASE0F(0x01): // LGDT/LIDT
 				CLKS(CLK_LGDT_LIDT);
 				DAS_prt_post_op(2);
-				dst = mem->read16(get_seg_adr(CS, ++eip));
+				dst = fetch8(++eip);
 				DAS_pr("%s ", (dst >> 3 & 7) == 2?"LGDT":"LIDT");
 				DAS_modrm(dst, false, true, fword);
+				eip++;
+				// eipはModR/Mの次をポイントしていること
+				tmpadr = modrm_seg_ea(dst);
 				if ((dst >> 3 & 7) == 2) { // LGDT
-					tmpadr = modrm_seg_ea(dst);
 					gdtr.limit = mem->read16(tmpadr);
 					gdtr.base = (opsize == size16)? mem->read32(tmpadr + 2) & 0x00ffffff : mem->read32(tmpadr + 2);
+					desc_gen++; // ディスクリプタキャッシュを無効にする
 				} else if ((dst >> 3 & 7) == 3) { // LIDT
-					DAS_pr("xxxxx\n");
+					idtr.limit = mem->read16(tmpadr);
+					idtr.base = (opsize == size16)? mem->read32(tmpadr + 2) & 0x00ffffff : mem->read32(tmpadr + 2);
+					idt_gen++; // ゲートキャッシュを無効にする
 				}
-				eip++;
-				break;
-			case 0x20: // MOV r32, CR0
+				NEXT_OP;
+			OPCASE0F(0x20): // MOV r32, CR0
 				CLKS(CLK_MOV_R_CR);
 				DAS_prt_post_op(2);
-				modrm = mem->read8(get_seg_adr(CS, ++eip));
+				modrm = fetch8(++eip);
 				DAS_pr("MOV ");
 				DAS_modrm(modrm, false, false, dword);
 				tmpb = modrm >> 3 & 7;
 				DAS_pr("CR%d\n", tmpb);
 				genregd(modrm & 7) = cr[tmpb];
 				eip++;
-				break;
-			case 0x22: // MOV CR0, r32
+				NEXT_OP;
+			OPCASE0F(0x22): // MOV CR0, r32
 				DAS_prt_post_op(2);
-				modrm = mem->read8(get_seg_adr(CS, ++eip));
+				modrm = fetch8(++eip);
 				tmpb = modrm >> 3 & 7;
 				DAS_pr("MOV CR%d, ", tmpb);
 				DAS_modrm(modrm, false, true, dword);
@@ -1605,77 +3171,84 @@ s32 CPU::exec(void) {
 						eip &= 0x0000ffff;
 						DAS_pr("ProtectedMode -> RealMode\n");
 					}
+					update_cpu_mode();
+					// ページング (PG)
+					mem->set_paging(cr[0] & 0x80000000);
+				} else if (tmpb == 3) {
+					// ページディレクトリのベースアドレス
+					// (TLBを捨てる)
+					mem->set_cr3(cr[3]);
 				}
 				eip++;
-				break;
+				NEXT_OP;
 
-			case 0x80: // JO rel16 (JO rel32)
+			OPCASE0F(0x80): // JO rel16 (JO rel32)
 				JCCWD(JO, flagu8 & OFSET8);
-				break;
-			case 0x81: // JNO rel16 (JNO rel32)
+				NEXT_OP;
+			OPCASE0F(0x81): // JNO rel16 (JNO rel32)
 				JCCWD(JNO, !(flagu8 & OFSET8));
-				break;
-			case 0x82: // JB/JC/JNAE rel16 (JC/JNAE rel32)
+				NEXT_OP;
+			OPCASE0F(0x82): // JB/JC/JNAE rel16 (JC/JNAE rel32)
 				JCCWD(JB/JC/JNAE, flag8 & CF);
-				break;
-			case 0x83: // JNB/JNC/JAE rel16 (JNB/JNC rel32)
+				NEXT_OP;
+			OPCASE0F(0x83): // JNB/JNC/JAE rel16 (JNB/JNC rel32)
 				JCCWD(JNB/JNC/JAE, !(flag8 & CF));
-				break;
-			case 0x84: // JE/JZ rel16 (JE/JZ rel32)
+				NEXT_OP;
+			OPCASE0F(0x84): // JE/JZ rel16 (JE/JZ rel32)
 				JCCWD(JE/JZ, flag8 & ZF);
-				break;
-			case 0x85: // JNE/JNZ rel16 (JNE/JNZ rel32)
+				NEXT_OP;
+			OPCASE0F(0x85): // JNE/JNZ rel16 (JNE/JNZ rel32)
 				JCCWD(JNE/JNZ, !(flag8 & ZF));
-				break;
-			case 0x86: // JBE/JNA rel16 (JBE/JNA rel32)
+				NEXT_OP;
+			OPCASE0F(0x86): // JBE/JNA rel16 (JBE/JNA rel32)
 				JCCWD(JBE/JNA, flag8 & CF || flag8 & ZF);
-				break;
-			case 0x87: // JNBE/JA rel16 (JNBE/JA rel32)
+				NEXT_OP;
+			OPCASE0F(0x87): // JNBE/JA rel16 (JNBE/JA rel32)
 				JCCWD(JNBE/JA, !(flag8 & CF) && !(flag8 & ZF));
-				break;
-			case 0x88: // JS rel16 (JS rel32)
+				NEXT_OP;
+			OPCASE0F(0x88): // JS rel16 (JS rel32)
 				JCCWD(JS, flag8 & SF);
-				break;
-			case 0x89: // JNS rel16 (JNS rel32)
+				NEXT_OP;
+			OPCASE0F(0x89): // JNS rel16 (JNS rel32)
 				JCCWD(JNS, !(flag8 & SF));
-				break;
-			case 0x8a: // JP/JPE rel16 (JP/JPE rel32)
+				NEXT_OP;
+			OPCASE0F(0x8a): // JP/JPE rel16 (JP/JPE rel32)
 				JCCWD(JP/JPE, flag8 & PF);
-				break;
-			case 0x8b: // JNP/JPO rel16 (JP/JPE rel32)
+				NEXT_OP;
+			OPCASE0F(0x8b): // JNP/JPO rel16 (JP/JPE rel32)
 				JCCWD(JNP/JPO, !(flag8 & PF));
-				break;
-			case 0x8c: // JL/JNGE rel16 (JL/JNGE rel32)
+				NEXT_OP;
+			OPCASE0F(0x8c): // JL/JNGE rel16 (JL/JNGE rel32)
 				JCCWD(JL/JNGE, (flag8 ^ flagu8 << 4) & 0x80);
-				break;
-			case 0x8d: // JGE/JNL rel16 (JGE/JNL rel32)
+				NEXT_OP;
+			OPCASE0F(0x8d): // JGE/JNL rel16 (JGE/JNL rel32)
 				JCCWD(JGE/JNL, !((flag8 ^ flagu8 << 4) & 0x80));
-				break;
-			case 0x8e: // JLE/JNG rel8
+				NEXT_OP;
+			OPCASE0F(0x8e): // JLE/JNG rel8
 				JCCWD(JLE/JNG, flag8 & ZF || (flag8 ^ flagu8 << 4) & 0x80);
-				break;
-			case 0x8f: // JNLE/JG rel8
+				NEXT_OP;
+			OPCASE0F(0x8f): // JNLE/JG rel8
 				JCCWD(JNLE/JG, !(flag8 & ZF) && !((flag8 ^ flagu8 << 4) & 0x80));
-				break;
+				NEXT_OP;
 
-			case 0xa0: // PUSH FS
+			OPCASE0F(0xa0): // PUSH FS
 				CLKS(CLK_PUSH_SR);
 				PUSH_SEG2(FS); // 2バイト命令用マクロ
-				break;
-			case 0xa1: // POP FS
-				CLKS(isRealMode?CLK_POP_SR:CLK_PM_POP_SR);
+				NEXT_OP;
+			OPCASE0F(0xa1): // POP FS
+				CLKS(REAL?CLK_POP_SR:CLK_PM_POP_SR);
 				POP_SEG2(FS);
-				break;
-			case 0xa8: // PUSH GS
+				NEXT_OP;
+			OPCASE0F(0xa8): // PUSH GS
 				CLKS(CLK_PUSH_SR);
 				PUSH_SEG2(GS);
-				break;
-			case 0xa9: // POP GS
-				CLKS(isRealMode?CLK_POP_SR:CLK_PM_POP_SR);
+				NEXT_OP;
+			OPCASE0F(0xa9): // POP GS
+				CLKS(REAL?CLK_POP_SR:CLK_PM_POP_SR);
 				POP_SEG2(GS);
-				break;
-			case 0xb6: // MOVZX r16,r/m8 (MOVZX r32, r/m8)
-				modrm = mem->read8(get_seg_adr(CS, eip + 1));
+				NEXT_OP;
+			OPCASE0F(0xb6): // MOVZX r16,r/m8 (MOVZX r32, r/m8)
+				modrm = fetch8(eip + 1);
 				DAS_prt_post_op(nr_disp_modrm(modrm) + 2);
 				eip++;
 				DAS_pr("MOVZX ");
@@ -1700,9 +3273,9 @@ s32 CPU::exec(void) {
 						genregd(modrm >> 3 & 7) = mem->read8(modrm_seg_ea(modrm));
 					}
 				}
-				break;
-			case 0xb7: // MOVZX r32,r/m16
-				modrm = mem->read8(get_seg_adr(CS, eip + 1));
+				NEXT_OP;
+			OPCASE0F(0xb7): // MOVZX r32,r/m16
+				modrm = fetch8(eip + 1);
 				DAS_prt_post_op(nr_disp_modrm(modrm) + 2);
 				eip++;
 				DAS_pr("MOVZX ");
@@ -1717,9 +3290,9 @@ s32 CPU::exec(void) {
 					CLKS(CLK_MOVZX_R_MEM);
 					genregd(modrm >> 3 & 7) = mem->read16(modrm_seg_ea(modrm));
 				}
-				break;
-			case 0xbe: // MOVSX r16,r/m8 (MOVSX r32, r/m8)
-				modrm = mem->read8(get_seg_adr(CS, eip + 1));
+				NEXT_OP;
+			OPCASE0F(0xbe): // MOVSX r16,r/m8 (MOVSX r32, r/m8)
+				modrm = fetch8(eip + 1);
 				DAS_prt_post_op(nr_disp_modrm(modrm) + 2);
 				eip++;
 				DAS_pr("MOVSX ");
@@ -1746,9 +3319,9 @@ s32 CPU::exec(void) {
 					}
 					genregd(modrm >> 3 & 7) = ((src & 0x80)?0xffffff00:0x0000000) | src;
 				}
-				break;
-			case 0xbf: // MOVSX r32,r/m16
-				modrm = mem->read8(get_seg_adr(CS, eip + 1));
+				NEXT_OP;
+			OPCASE0F(0xbf): // MOVSX r32,r/m16
+				modrm = fetch8(eip + 1);
 				DAS_prt_post_op(nr_disp_modrm(modrm) + 2);
 				eip++;
 				DAS_pr("MOVSX ");
@@ -1764,68 +3337,70 @@ s32 CPU::exec(void) {
 					src = mem->read16(modrm_seg_ea(modrm));
 				}
 				genregd(modrm >> 3 & 7) = ((src & 0x8000)?0xffff0000:0x0000000) | src;
-				break;
+				NEXT_OP;
 
-			default:
+			OPDEFAULT0F:
 				DAS_pr("xxxxx\n");
+				TRACE_DUMP();
 				// LFS/LGS/LSS... (80386)
+				NEXT_OP;
 			}
-			break;
+			NEXT_OP;
 
 /******************** Jcc ********************/
 
-		case 0x70: // JO rel8
+		OPCASE(0x70): // JO rel8
 			JCC(JO, flagu8 & OFSET8);
-			break;
-		case 0x71: // JNO rel8
+			NEXT_OP;
+		OPCASE(0x71): // JNO rel8
 			JCC(JNO, !(flagu8 & OFSET8));
-			break;
-		case 0x72: // JB/JC/JNAE rel8
+			NEXT_OP;
+		OPCASE(0x72): // JB/JC/JNAE rel8
 			JCC(JB/JC/JNAE, flag8 & CF);
-			break;
-		case 0x73: // JNB/JNC/JAE rel8
+			NEXT_OP;
+		OPCASE(0x73): // JNB/JNC/JAE rel8
 			JCC(JNB/JNC/JAE, !(flag8 & CF));
-			break;
-		case 0x74: // JE/JZ rel8
+			NEXT_OP;
+		OPCASE(0x74): // JE/JZ rel8
 			JCC(JE/JZ, flag8 & ZF);
-			break;
-		case 0x75: // JNE/JNZ rel8
+			NEXT_OP;
+		OPCASE(0x75): // JNE/JNZ rel8
 			JCC(JNE/JNZ, !(flag8 & ZF));
-			break;
-		case 0x76: // JBE/JNA rel8
+			NEXT_OP;
+		OPCASE(0x76): // JBE/JNA rel8
 			JCC(JBE/JNA, flag8 & CF || flag8 & ZF);
-			break;
-		case 0x77: // JNBE/JA rel8
+			NEXT_OP;
+		OPCASE(0x77): // JNBE/JA rel8
 			JCC(JNBE/JA, !(flag8 & CF) && !(flag8 & ZF));
-			break;
-		case 0x78: // JS rel8
+			NEXT_OP;
+		OPCASE(0x78): // JS rel8
 			JCC(JS, flag8 & SF);
-			break;
-		case 0x79: // JNS rel8
+			NEXT_OP;
+		OPCASE(0x79): // JNS rel8
 			JCC(JNS, !(flag8 & SF));
-			break;
-		case 0x7a: // JP/JPE rel8
+			NEXT_OP;
+		OPCASE(0x7a): // JP/JPE rel8
 			JCC(JP/JPE, flag8 & PF);
-			break;
-		case 0x7b: // JNP/JPO rel8
+			NEXT_OP;
+		OPCASE(0x7b): // JNP/JPO rel8
 			JCC(JNP/JPO, !(flag8 & PF));
-			break;
-		case 0x7c: // JL/JNGE rel8
+			NEXT_OP;
+		OPCASE(0x7c): // JL/JNGE rel8
 			JCC(JL/JNGE, (flag8 ^ flagu8 << 4) & 0x80);
-			break;
-		case 0x7d: // JNL/JGE rel8
+			NEXT_OP;
+		OPCASE(0x7d): // JNL/JGE rel8
 			JCC(JNL/JGE, !((flag8 ^ flagu8 << 4) & 0x80));
-			break;
-		case 0x7e: // JLE/JNG rel8
+			NEXT_OP;
+		OPCASE(0x7e): // JLE/JNG rel8
 			JCC(JLE/JNG, flag8 & ZF || (flag8 ^ flagu8 << 4) & 0x80);
-			break;
-		case 0x7f: // JNLE/JG rel8
+			NEXT_OP;
+		OPCASE(0x7f): // JNLE/JG rel8
 			JCC(JNLE/JG, !(flag8 & ZF) && !((flag8 ^ flagu8 << 4) & 0x80));
-			break;
+			NEXT_OP;
 
-		case 0xe3:
+		OPCASE(0xe3):
 			JCC(JCXZ, !cx);
-			break;
+			NEXT_OP;
 
 /******************** ADD/OR/ADC/SBB/AND/SUB/XOR/CMP ********************/
 /*
@@ -1836,15 +3411,15 @@ s32 CPU::exec(void) {
   ???(ここではregではなく、opの拡張。これにより以下の様に命令が変わる):
   000:ADD, 001:OR, 010:ADC, 011:SBB, 100:AND, 101:SUB, 110:XOR, 111:CMP
 */
-		case 0x80:
+		OPCASE(0x80):
 			// go through
-		case 0x82:
-			modrm = mem->read8(get_seg_adr(CS, eip));
+		OPCASE(0x82):
+			modrm = fetch8(eip);
 			subop = modrm >> 3 & 7;
 			DAS_prt_post_op(nr_disp_modrm(modrm) + 2);
 			DAS_pr("%s ", str8x[subop]);
 			DAS_modrm(modrm, false, false, byte);
-			DAS_pr("0x%02x\n", mem->read8(get_seg_adr(CS, eip + nr_disp_modrm(modrm) + 1)));
+			DAS_pr("0x%02x\n", fetch8(eip + nr_disp_modrm(modrm) + 1));
 
 			switch (subop) {
 			case 0: // ADD r/m8, imm8
@@ -1872,15 +3447,15 @@ s32 CPU::exec(void) {
 				CMP_RM_IM(b, b);
 				break;
 			}
-			break;
+			NEXT_OP;
 
-		case 0x81:
-			modrm = mem->read8(get_seg_adr(CS, eip));
+		OPCASE(0x81):
+			modrm = fetch8(eip);
 			subop = modrm >> 3 & 7;
 			DAS_prt_post_op(nr_disp_modrm(modrm) + (opsize == size16)?3:5);
 			DAS_pr("%s ", str8x[subop]);
 			DAS_modrm(modrm, false, false, word);
-			DAS_pr((opsize == size16)?"0x%04x\n":"0x%08x\n", (opsize == size16)?mem->read16(get_seg_adr(CS, eip + 1)):mem->read32(get_seg_adr(CS, eip + 1)));
+			DAS_pr((opsize == size16)?"0x%04x\n":"0x%08x\n", (opsize == size16)?fetch16(eip + 1):fetch32(eip + 1));
 
 			switch (subop) {
 
@@ -1942,78 +3517,78 @@ s32 CPU::exec(void) {
 				}
 				break;
 			}
-			break;
+			NEXT_OP;
 
 		// ADD/ADC/AND/SUB/SBB/CMP r/m16, imm8 (... r/m32, imm8)
-		case 0x83:
+		OPCASE(0x83):
 			//w-bit 1なのでワード動作、s-bit 0なので即値は byte
-			modrm = mem->read8(get_seg_adr(CS, eip));
+			modrm = fetch8(eip);
 			subop = modrm >> 3 & 7;
 			DAS_prt_post_op(nr_disp_modrm(modrm) + 2);
 			DAS_pr("%s ", str8x[subop]);
 			// xxx size32を要考慮
 			DAS_modrm(modrm, false, false, word);
-			DAS_pr("0x%02x\n", mem->read8(get_seg_adr(CS, eip + 1)));
+			DAS_pr("0x%02x\n", fetch8(eip + 1));
 
 			switch (subop) {
 			case 0: // ADD r/m16, imm8 (ADD r/m32, imm8)
 				if (opsize == size16) {
-					CAL_RM_IM(w, b, ADD, u16, 0);
+					CAL_RM_IM(w, bw, ADD, u16, 0);
 				} else {
-					CAL_RM_IM(d, b, ADD, u32, 0);
+					CAL_RM_IM(d, bd, ADD, u32, 0);
 				}
 				break;
 			case 1: // OR r/m16, imm8 (OR r/m32, imm8)
 				if (opsize == size16) {
-					LOGOP_RM_IM(w, b, |);
+					LOGOP_RM_IM(w, bw, |);
 				} else {
-					LOGOP_RM_IM(d, b, |);
+					LOGOP_RM_IM(d, bd, |);
 				}
 				break;
 			case 2: // ADC r/m16, imm8 (ADC r/m32, imm8)
 				if (opsize == size16) {
-					CAL_RM_IM(w, b, ADC, u16, (flag8 & CF));
+					CAL_RM_IM(w, bw, ADC, u16, (flag8 & CF));
 				} else {
-					CAL_RM_IM(d, b, ADC, u32, (flag8 & CF));
+					CAL_RM_IM(d, bd, ADC, u32, (flag8 & CF));
 				}
 				break;
 			case 3: // SBB r/m16, imm8 (SBB r/m32, imm8)
 				if (opsize == size16) {
-					CAL_RM_IM(w, b, SBB, u16, -(flag8 & CF));
+					CAL_RM_IM(w, bw, SBB, u16, -(flag8 & CF));
 				} else {
-					CAL_RM_IM(d, b, SBB, u32, -(flag8 & CF));
+					CAL_RM_IM(d, bd, SBB, u32, -(flag8 & CF));
 				}
 				break;
 			case 4: // AND r/m16, imm8 (AND r/m32, imm8)
 				if (opsize == size16) {
-					LOGOP_RM_IM(w, b, &);
+					LOGOP_RM_IM(w, bw, &);
 				} else {
-					LOGOP_RM_IM(d, b, &);
+					LOGOP_RM_IM(d, bd, &);
 				}
 				break;
 			case 5: // SUB r/m16, imm8 (SUB r/m32, imm8)
 				if (opsize == size16) {
-					CAL_RM_IM(w, b, SUB, u16, 0);
+					CAL_RM_IM(w, bw, SUB, u16, 0);
 				} else {
-					CAL_RM_IM(d, b, SUB, u32, 0);
+					CAL_RM_IM(d, bd, SUB, u32, 0);
 				}
 				break;
 			case 6: // XOR r/m16, imm8 (XOR r/m32, imm8)
 				if (opsize == size16) {
-					LOGOP_RM_IM(w, b, ^);
+					LOGOP_RM_IM(w, bw, ^);
 				} else {
-					LOGOP_RM_IM(d, b, ^);
+					LOGOP_RM_IM(d, bd, ^);
 				}
 				break;
 			case 7: // CMP r/m16, imm8 (CMP r/m32, imm8)
 				if (opsize == size16) {
-					CMP_RM_IM(w, b);
+					CMP_RM_IM(w, bw);
 				} else {
-					CMP_RM_IM(d, b);
+					CMP_RM_IM(d, bd);
 				}
 				break;
 			}
-			break;
+			NEXT_OP;
 
 /******************** XCHG ********************/
 /*
@@ -2023,16 +3598,16 @@ s32 CPU::exec(void) {
   +--------+-----------+---------+---------+
   フラグは影響なし
 */
-		case 0x86: // XCHG r8, r/m8 or XCHG r/m8, r8
+		OPCASE(0x86): // XCHG r8, r/m8 or XCHG r/m8, r8
 			XCHG_R_RM(b);
-			break;
-		case 0x87: // XCHG r16, r/m16 or XCHG r/m16, r16 (XCHG r32, r/m32 or XCHG r/m32, r32)
+			NEXT_OP;
+		OPCASE(0x87): // XCHG r16, r/m16 or XCHG r/m16, r16 (XCHG r32, r/m32 or XCHG r/m32, r32)
 			if (opsize == size16) {
 				XCHG_R_RM(w);
 			} else {
 				XCHG_R_RM(d);
 			}
-			break;
+			NEXT_OP;
 
 #define XCHG_GENREGW(reg)				\
 			DAS_prt_post_op(0);		\
@@ -2048,70 +3623,70 @@ s32 CPU::exec(void) {
 			eax = reg;			\
 			reg = dst;
 
-		case 0x90: // XCHG AX (XCHG EAX) -> NOP
+		OPCASE(0x90): // XCHG AX (XCHG EAX) -> NOP
 			CLKS(CLK_NOP);
 			if (opsize == size16) {
 				XCHG_GENREGW(ax);
 			} else {
-				XCHG_GENREGW(eax);
+				XCHG_GENREGD(eax);
 			}
-			break;
-		case 0x91: // XCHG CX (XCHG ECX)
+			NEXT_OP;
+		OPCASE(0x91): // XCHG CX (XCHG ECX)
 			CLKS(CLK_XCHG_R_R);
 			if (opsize == size16) {
 				XCHG_GENREGW(cx);
 			} else {
-				XCHG_GENREGW(ecx);
+				XCHG_GENREGD(ecx);
 			}
-			break;
-		case 0x92: // XCHG DX (XCHG EDX)
+			NEXT_OP;
+		OPCASE(0x92): // XCHG DX (XCHG EDX)
 			CLKS(CLK_XCHG_R_R);
 			if (opsize == size16) {
 				XCHG_GENREGW(dx);
 			} else {
-				XCHG_GENREGW(edx);
+				XCHG_GENREGD(edx);
 			}
-			break;
-		case 0x93: // XCHG BX (XCHG EBX)
+			NEXT_OP;
+		OPCASE(0x93): // XCHG BX (XCHG EBX)
 			CLKS(CLK_XCHG_R_R);
 			if (opsize == size16) {
 				XCHG_GENREGW(bx);
 			} else {
-				XCHG_GENREGW(ebx);
+				XCHG_GENREGD(ebx);
 			}
-			break;
-		case 0x94: // XCHG SP (XCHG ESP)
+			NEXT_OP;
+		OPCASE(0x94): // XCHG SP (XCHG ESP)
 			CLKS(CLK_XCHG_R_R);
 			if (opsize == size16) {
 				XCHG_GENREGW(sp);
 			} else {
-				XCHG_GENREGW(esp);
+				XCHG_GENREGD(esp);
 			}
-			break;
-		case 0x95: // XCHG BP (XCHG EBP)
+			NEXT_OP;
+		OPCASE(0x95): // XCHG BP (XCHG EBP)
 			CLKS(CLK_XCHG_R_R);
 			if (opsize == size16) {
 				XCHG_GENREGW(bp);
 			} else {
-				XCHG_GENREGW(ebp);
+				XCHG_GENREGD(ebp);
 			}
-			break;
-		case 0x96: // XCHG SI (XCHG ESI)
+			NEXT_OP;
+		OPCASE(0x96): // XCHG SI (XCHG ESI)
 			CLKS(CLK_XCHG_R_R);
 			if (opsize == size16) {
 				XCHG_GENREGW(si);
 			} else {
-				XCHG_GENREGW(esi);
+				XCHG_GENREGD(esi);
 			}
-			break;
-		case 0x97: // XCHG DI (XCHG EDI)
+			NEXT_OP;
+		OPCASE(0x97): // XCHG DI (XCHG EDI)
 			CLKS(CLK_XCHG_R_R);
 			if (opsize == size16) {
 				XCHG_GENREGW(di);
 			} else {
-				XCHG_GENREGW(edi);
+				XCHG_GENREGD(edi);
 			}
-			break;
+			NEXT_OP;
 
 /******************** MOV ********************/
 /*
@@ -2120,9 +3695,9 @@ s32 CPU::exec(void) {
   |100010dw|mod reg r/m|(DISP-LO)|(DISP-HI)|
   +--------+-----------+---------+---------+
 */
-		case 0x88: // MOV r/m8, r8
+		OPCASE(0x88): // MOV r/m8, r8
 			CLKS(CLK_MOV_RM_R);
-			modrm = mem->read8(get_seg_adr(CS, eip));
+			modrm = fetch8(eip);
 			DAS_prt_post_op(nr_disp_modrm(modrm) + 1);
 			DAS_pr("MOV ");
 			DAS_modrm(modrm, true, false, byte);
@@ -2132,11 +3707,11 @@ s32 CPU::exec(void) {
 			} else {
 				mem->write8(modrm_seg_ea(modrm), genregb(modrm >> 3 & 7));
 			}
-			break;
+			NEXT_OP;
 
-		case 0x89: // MOV r/m16, r16 (MOV r/m32, r32)
+		OPCASE(0x89): // MOV r/m16, r16 (MOV r/m32, r32)
 			CLKS(CLK_MOV_RM_R);
-			modrm = mem->read8(get_seg_adr(CS, eip));
+			modrm = fetch8(eip);
 			DAS_prt_post_op(nr_disp_modrm(modrm) + 1);
 			DAS_pr("MOV ");
 			DAS_modrm(modrm, true, false, word);
@@ -2154,10 +3729,10 @@ s32 CPU::exec(void) {
 					mem->write32(modrm_seg_ea(modrm), genregd(modrm >> 3 & 7));
 				}
 			}
-			break;
+			NEXT_OP;
 
-		case 0x8a: // MOV r8, r/m8
-			modrm = mem->read8(get_seg_adr(CS, eip));
+		OPCASE(0x8a): // MOV r8, r/m8
+			modrm = fetch8(eip);
 			DAS_prt_post_op(nr_disp_modrm(modrm) + 1);
 			DAS_pr("MOV ");
 			DAS_modrm(modrm, true, true, byte);
@@ -2169,10 +3744,10 @@ s32 CPU::exec(void) {
 				CLKS(CLK_MOV_R_MEM);
 				genregb(modrm >> 3 & 7) = mem->read8(modrm_seg_ea(modrm));
 			}
-			break;
+			NEXT_OP;
 
-		case 0x8b: // MOV r16, r/m16 (MOV r32, r/m32)
-			modrm = mem->read8(get_seg_adr(CS, eip));
+		OPCASE(0x8b): // MOV r16, r/m16 (MOV r32, r/m32)
+			modrm = fetch8(eip);
 			DAS_prt_post_op(nr_disp_modrm(modrm) + 1);
 			DAS_pr("MOV ");
 			DAS_modrm(modrm, true, true, word);
@@ -2196,7 +3771,7 @@ s32 CPU::exec(void) {
 						mem->read32(modrm_seg_ea(modrm));
 				}
 			}
-			break;
+			NEXT_OP;
 /*
   76  543 210
   +--------+-----------+---------+---------+
@@ -2207,9 +3782,9 @@ s32 CPU::exec(void) {
   参考文献(7)p3-491 本命令には32bitモードで動作時にOPサイズプリフィックスが
   つくことがあるが、気にしない。
 */
-		case 0x8c: // MOV r/m16, Sreg
+		OPCASE(0x8c): // MOV r/m16, Sreg
 			CLKS(CLK_MOV_RM_SR);
-			modrm = mem->read8(get_seg_adr(CS, eip));
+			modrm = fetch8(eip);
 			sreg = modrm >> 3 & 3;
 			DAS_prt_post_op(nr_disp_modrm(modrm) + 1);
 			DAS_pr("MOV ");
@@ -2221,7 +3796,7 @@ s32 CPU::exec(void) {
 			} else {
 				mem->write16(modrm_seg_ea(modrm), segreg[sreg]);
 			}
-			break;
+			NEXT_OP;
 
 /*
   76  543 210
@@ -2229,28 +3804,31 @@ s32 CPU::exec(void) {
   |10001101|mod reg r/m|(DISP-LO)|(DISP-HI)|
   +--------+-----------+---------+---------+
 */
-		case 0x8d: // LEA r16, m (LEA r32, m)
+		OPCASE(0x8d): // LEA r16, m (LEA r32, m)
 			CLKS(CLK_LEA);
-			modrm = mem->read8(get_seg_adr(CS, eip));
+			modrm = fetch8(eip);
 			greg = modrm >> 3 & 7;
 			DAS_prt_post_op(nr_disp_modrm(modrm) + 1);
 			DAS_pr("LEA ");
 			DAS_modrm(modrm, true, true, opsize == size16? word : dword);
 			eip++;
+			// アドレスはアドレスサイズで求め、オペランドサイズで格納する
+			darg1 = (addrsize == size16)?
+				modrm16_ea(modrm) : modrm32_ea(modrm);
 			if (opsize == size16) {
-				genregw(greg) = modrm16_ea(modrm);
+				genregw(greg) = darg1;
 			} else {
-				genregd(greg) = modrm32_ea(modrm);
+				genregd(greg) = darg1;
 			}
-			break;
+			NEXT_OP;
 /*
   76  543 210
   +--------+-----------+---------+---------+
   |10001110|mod 0SR r/m|(DISP-LO)|(DISP-HI)|
   +--------+-----------+---------+---------+
 */
-		case 0x8e: // MOV Sreg, r/m16
-			modrm = mem->read8(get_seg_adr(CS, eip));
+		OPCASE(0x8e): // MOV Sreg, r/m16
+			modrm = fetch8(eip);
 			sreg = modrm >> 3 & 7;
 			DAS_prt_post_op(nr_disp_modrm(modrm) + 1);
 			DAS_pr("MOV %s, ", segreg_name[sreg]);
@@ -2258,67 +3836,67 @@ s32 CPU::exec(void) {
 			eip++;
 			// セグメントはbaseも更新
 			if ((modrm & 0xc0) == 0xc0) {
-				CLKS(isRealMode?CLK_MOV_SR_R:CLK_PM_MOV_SR_R);
+				CLKS(REAL?CLK_MOV_SR_R:CLK_PM_MOV_SR_R);
 				update_segreg(sreg, genregw(modrm & 7));
 			} else {
-				CLKS(isRealMode?CLK_MOV_SR_MEM:CLK_PM_MOV_SR_MEM);
+				CLKS(REAL?CLK_MOV_SR_MEM:CLK_PM_MOV_SR_MEM);
 				update_segreg(sreg, mem->read16(modrm_seg_ea(modrm)));
 			}
-			break;
+			NEXT_OP;
 
 /*
   +---------+--------+--------+
   |1010 000w|addr-lo |addr-hi |
   +---------+--------+--------+
 */
-		case 0xa0: // MOV AL, moffs8
+		OPCASE(0xa0): // MOV AL, moffs8
 			CLKS(CLK_MOV_MOF);
 			DAS_prt_post_op(2);
-			src = mem->read16(get_seg_adr(CS, eip));
+			src = fetch16(eip);
 			DAS_pr("MOV AL, byte ptr [0x%04x]\n", src);
-			al = mem->read8(get_seg_adr(DS, src));
+			al = mem->read8(get_seg_adr(eff_seg[DS], src));
 			eip += 2;
-			break;
-		case 0xa1: // MOV AX, moffs16 (MOV EAX moffs32)
+			NEXT_OP;
+		OPCASE(0xa1): // MOV AX, moffs16 (MOV EAX moffs32)
 			CLKS(CLK_MOV_MOF);
 			if (opsize == size16) {
 				DAS_prt_post_op(2);
-				src = mem->read16(get_seg_adr(CS, eip));
+				src = fetch16(eip);
 				DAS_pr("MOV AX, word ptr [0x%04x]\n", src);
-				ax = mem->read16(get_seg_adr(DS, src));
+				ax = mem->read16(get_seg_adr(eff_seg[DS], src));
 				eip += 2;
 			} else {
 				DAS_prt_post_op(4);
-				src = mem->read32(get_seg_adr(CS, eip));
+				src = fetch32(eip);
 				DAS_pr("MOV EAX, word ptr [0x%08x]\n", src);
-				eax = mem->read32(get_seg_adr(DS, src));
+				eax = mem->read32(get_seg_adr(eff_seg[DS], src));
 				eip += 4;
 			}
-			break;
-		case 0xa2: // MOV moffs8, AL
+			NEXT_OP;
+		OPCASE(0xa2): // MOV moffs8, AL
 			CLKS(CLK_MOV_MOF);
 			DAS_prt_post_op(2);
-			src = mem->read16(get_seg_adr(CS, eip));
+			src = fetch16(eip);
 			DAS_pr("MOV AL, byte ptr [0x%04x]\n", src);
-			mem->write8(get_seg_adr(DS, src), al);
+			mem->write8(get_seg_adr(eff_seg[DS], src), al);
 			eip += 2;
-			break;
-		case 0xa3: // MOV moffs16, AX (MOV moffs32, EAX)
+			NEXT_OP;
+		OPCASE(0xa3): // MOV moffs16, AX (MOV moffs32, EAX)
 			CLKS(CLK_MOV_MOF);
 			if (opsize == size16) {
 				DAS_prt_post_op(2);
-				src = mem->read16(get_seg_adr(CS, eip));
+				src = fetch16(eip);
 				DAS_pr("MOV AX, word ptr [0x%04x]\n", src);
-				mem->write16(get_seg_adr(DS, src), ax);
+				mem->write16(get_seg_adr(eff_seg[DS], src), ax);
 				eip += 2;
 			} else {
 				DAS_prt_post_op(4);
-				src = mem->read32(get_seg_adr(CS, eip));
+				src = fetch32(eip);
 				DAS_pr("MOV EAX, word ptr [0x%08x]\n", src);
-				mem->write32(get_seg_adr(DS, src), eax);
+				mem->write32(get_seg_adr(eff_seg[DS], src), eax);
 				eip += 4;
 			}
-			break;
+			NEXT_OP;
 
 /*
   76543 210
@@ -2326,54 +3904,54 @@ s32 CPU::exec(void) {
   |1011w reg|  data  |(data if w=1)|
   +---------+--------+-------------+
 */
-		case 0xb0: // MOV AL, imm8
+		OPCASE(0xb0): // MOV AL, imm8
 			// go through
-		case 0xb1: // MOV CL, imm8
+		OPCASE(0xb1): // MOV CL, imm8
 			// go through
-		case 0xb2: // MOV DL, imm8
+		OPCASE(0xb2): // MOV DL, imm8
 			// go through
-		case 0xb3: // MOV BL, imm8
+		OPCASE(0xb3): // MOV BL, imm8
 			// go through
-		case 0xb4: // MOV AH, imm8
+		OPCASE(0xb4): // MOV AH, imm8
 			// go through
-		case 0xb5: // MOV CH, imm8
+		OPCASE(0xb5): // MOV CH, imm8
 			// go through
-		case 0xb6: // MOV DH, imm8
+		OPCASE(0xb6): // MOV DH, imm8
 			// go through
-		case 0xb7: // MOV BH, imm8
+		OPCASE(0xb7): // MOV BH, imm8
 			CLKS(CLK_MOV_R_IMM);
 			DAS_prt_post_op(1);
-			DAS_pr("MOV %s, 0x%02x\n", genreg_name[0][op & 7], mem->read8(get_seg_adr(CS, eip)));
-			*genregb[op & 7] = mem->read8(get_seg_adr(CS, eip++));
-			break;
-		case 0xb8: // MOV AX, imm16 (MOV EAX, imm32)
+			DAS_pr("MOV %s, 0x%02x\n", genreg_name[0][op & 7], fetch8(eip));
+			*genregb[op & 7] = fetch8(eip++);
+			NEXT_OP;
+		OPCASE(0xb8): // MOV AX, imm16 (MOV EAX, imm32)
 			// go through
-		case 0xb9: // MOV CX, imm16 (MOV ECX, imm32)
+		OPCASE(0xb9): // MOV CX, imm16 (MOV ECX, imm32)
 			// go through
-		case 0xba: // MOV DX, imm16 (MOV EDX, imm32)
+		OPCASE(0xba): // MOV DX, imm16 (MOV EDX, imm32)
 			// go through
-		case 0xbb: // MOV BX, imm16 (MOV EBX, imm32)
+		OPCASE(0xbb): // MOV BX, imm16 (MOV EBX, imm32)
 			// go through
-		case 0xbc: // MOV SP, imm16 (MOV ESP, imm32)
+		OPCASE(0xbc): // MOV SP, imm16 (MOV ESP, imm32)
 			// go through
-		case 0xbd: // MOV BP, imm16 (MOV EBP, imm32)
+		OPCASE(0xbd): // MOV BP, imm16 (MOV EBP, imm32)
 			// go through
-		case 0xbe: // MOV SI, imm16 (MOV ESI, imm32)
+		OPCASE(0xbe): // MOV SI, imm16 (MOV ESI, imm32)
 			// go through
-		case 0xbf: // MOV DI, imm16 (MOV EDI, imm32)
+		OPCASE(0xbf): // MOV DI, imm16 (MOV EDI, imm32)
 			CLKS(CLK_MOV_R_IMM);
 			if (opsize == size16) {
 				DAS_prt_post_op(2);
-				DAS_pr("MOV %s, 0x%04x\n", genreg_name[1][op & 7], mem->read16(get_seg_adr(CS, eip)));
-				genregw(op & 7) = mem->read16(get_seg_adr(CS, eip));
+				DAS_pr("MOV %s, 0x%04x\n", genreg_name[1][op & 7], fetch16(eip));
+				genregw(op & 7) = fetch16(eip);
 				eip += 2;
 			} else {
 				DAS_prt_post_op(4);
-				DAS_pr("MOV %s, 0x%08x\n", genreg_name[2][op & 7], mem->read32(get_seg_adr(CS, eip)));
-				genregd(op & 7) = mem->read32(get_seg_adr(CS, eip));
+				DAS_pr("MOV %s, 0x%08x\n", genreg_name[2][op & 7], fetch32(eip));
+				genregd(op & 7) = fetch32(eip);
 				eip += 4;
 			}
-			break;
+			NEXT_OP;
 
 /*
   76  543 210
@@ -2381,103 +3959,103 @@ s32 CPU::exec(void) {
   |1100011w|mod 000 r/m|(DISP-LO)|(DISP-HI)|  data  |(data if w=1)|
   +--------+-----------+---------+---------+--------+-------------+
 */
-		case 0xc6: // MOV r/m8, imm8
+		OPCASE(0xc6): // MOV r/m8, imm8
 			CLKS(CLK_MOV_R_IMM);
-			modrm = mem->read8(get_seg_adr(CS, eip));
+			modrm = fetch8(eip);
 			DAS_prt_post_op(nr_disp_modrm(modrm) + 2);
 			DAS_pr("MOV ");
 			DAS_modrm(modrm, false, false, byte);
-			DAS_pr("0x%02x\n", mem->read8(get_seg_adr(CS, eip + nr_disp_modrm(modrm) + 1)));
+			DAS_pr("0x%02x\n", fetch8(eip + nr_disp_modrm(modrm) + 1));
 			eip++;
 			if ((modrm & 0xc0) == 0xc0) {
-				genregb(modrm & 7) = mem->read8(get_seg_adr(CS, eip));
+				genregb(modrm & 7) = fetch8(eip);
 			} else {
 				// modrm_seg_ea()内でeipが更新されるので注意
 				tmpadr = modrm_seg_ea(modrm);
-				mem->write8(tmpadr, mem->read8(get_seg_adr(CS, eip)));
+				mem->write8(tmpadr, fetch8(eip));
 			}
 			eip++;
-			break;
-		case 0xc7: // MOV r/m16, imm16 (MOV r/m32, imm32)
+			NEXT_OP;
+		OPCASE(0xc7): // MOV r/m16, imm16 (MOV r/m32, imm32)
 			CLKS(CLK_MOV_R_IMM);
 			if (opsize == size16) {
-				modrm = mem->read8(get_seg_adr(CS, eip));
+				modrm = fetch8(eip);
 				DAS_prt_post_op(nr_disp_modrm(modrm) + 3);
 				DAS_pr("MOV ");
 				DAS_modrm(modrm, false, false, word);
-				DAS_pr("0x%04x\n", mem->read16(get_seg_adr(CS, eip + nr_disp_modrm(modrm) + 1)));
+				DAS_pr("0x%04x\n", fetch16(eip + nr_disp_modrm(modrm) + 1));
 				eip++;
 				if ((modrm & 0xc0) == 0xc0) {
-					genregw(modrm & 7) = mem->read16(get_seg_adr(CS, eip));
+					genregw(modrm & 7) = fetch16(eip);
 				} else {
 					tmpadr = modrm_seg_ea(modrm);
-					mem->write16(tmpadr, mem->read16(get_seg_adr(CS, eip)));
+					mem->write16(tmpadr, fetch16(eip));
 				}
 				eip += 2;
 			} else {
-				modrm = mem->read8(get_seg_adr(CS, eip));
+				modrm = fetch8(eip);
 				DAS_prt_post_op(nr_disp_modrm(modrm) + 5);
 				DAS_pr("MOV ");
 				DAS_modrm(modrm, false, false, dword);
-				DAS_pr("0x%08x\n", mem->read32(get_seg_adr(CS, eip + nr_disp_modrm(modrm) + 1)));
+				DAS_pr("0x%08x\n", fetch32(eip + nr_disp_modrm(modrm) + 1));
 				eip++;
 				if ((modrm & 0xc0) == 0xc0) {
-					genregd(modrm & 7) = mem->read32(get_seg_adr(CS, eip));
+					genregd(modrm & 7) = fetch32(eip);
 				} else {
 					tmpadr = modrm_seg_ea(modrm);
-					mem->write32(tmpadr, mem->read32(get_seg_adr(CS, eip)));
+					mem->write32(tmpadr, fetch32(eip));
 				}
 				eip += 4;
 			}
-			break;
+			NEXT_OP;
 
 /******************** TEST ********************/
 // OF/CF:0, SF/ZF/PF:結果による, AF:未定義
 
-		case 0x84: // TEST r/m8, r8
+		OPCASE(0x84): // TEST r/m8, r8
 			TEST_RM_R(b);
-			break;
-		case 0x85: // TEST r/m16, r16 (TEST rm/32, r32)
+			NEXT_OP;
+		OPCASE(0x85): // TEST r/m16, r16 (TEST rm/32, r32)
 			if (opsize == size16) {
 				TEST_RM_R(w);
 			} else {
 				TEST_RM_R(d);
 			}
-			break;
+			NEXT_OP;
 
-		case 0xa8: // test al, imm8
+		OPCASE(0xa8): // test al, imm8
 			CLKS(CLK_TEST_R_IMM);
 			DAS_prt_post_op(1);
-			DAS_pr("TEST AL, 0x%02x\n", mem->read8(get_seg_adr(CS, eip)));
-			dst = al & mem->read8(get_seg_adr(CS, eip++));
+			DAS_pr("TEST AL, 0x%02x\n", fetch8(eip));
+			dst = al & fetch8(eip++);
 			FLAG_LOGOPb(dst);
-			break;
-		case 0xa9: // test ax, imm16 (test eax, imm32)
+			NEXT_OP;
+		OPCASE(0xa9): // test ax, imm16 (test eax, imm32)
 			CLKS(CLK_TEST_R_IMM);
 			if (opsize == size16) {
 				DAS_prt_post_op(2);
-				DAS_pr("TEST AX, 0x%04x\n", mem->read16(get_seg_adr(CS, eip)));
-				dst = ax & mem->read16(get_seg_adr(CS, eip));
+				DAS_pr("TEST AX, 0x%04x\n", fetch16(eip));
+				dst = ax & fetch16(eip);
 				eip += 2;
 				FLAG_LOGOPw(dst);
 			} else {
 				DAS_prt_post_op(4);
-				DAS_pr("TEST EAX, 0x%08x\n", mem->read32(get_seg_adr(CS, eip)));
-				dst = eax & mem->read32(get_seg_adr(CS, eip));
+				DAS_pr("TEST EAX, 0x%08x\n", fetch32(eip));
+				dst = eax & fetch32(eip);
 				eip += 4;
 				FLAG_LOGOPd(dst);
 			}
-			break;
+			NEXT_OP;
 
 /******************** CBW/CWD/CDQ ********************/
 
-		case 0x98: // CBW
+		OPCASE(0x98): // CBW
 			CLKS(CLK_CBW);
 			DAS_prt_post_op(0);
 			DAS_pr("CBW\n");
 			ah = (al & 0x80)? 0xff : 0x0 ;
-			break;
-		case 0x99: // CWD (CDQ)
+			NEXT_OP;
+		OPCASE(0x99): // CWD (CDQ)
 			CLKS(CLK_CWD);
 			DAS_prt_post_op(0);
 			if (opsize == size16) {
@@ -2495,309 +4073,105 @@ s32 CPU::exec(void) {
 					edx = 0;
 				}
 			}
-			break;
+			NEXT_OP;
 
 /******************** WAIT ********************/
 
-		case 0x9b:
-			DAS_prt_post_op(0);
-			DAS_pr("WAIT\n");
-			// コプロ未実装なのでなにもしない
-			break;
-
-/******************** SAHF/LAHF ********************/
-
-		case 0x9e:
-			CLKS(CLK_SAHF);
-			DAS_prt_post_op(0);
-			DAS_pr("SAHF\n");
-			flag8 = 0x2; // xxx eflagsのbit 1は常に1らしい
-			flag8 |= ah;
-			break;
-		case 0x9f:
-			CLKS(CLK_LAHF);
-			DAS_prt_post_op(0);
-			DAS_pr("LAHF\n");
-			ah = flag8;
-			break;
-
-
-/******************** MOVS ********************/
-
-		case 0xa4: // MOVS m8, m8
+		OPCASE(0x9b):
 			DAS_prt_post_op(0);
-			DAS_pr("MOVSB\n");
-			if (opsize == size16) {
-				(repe_prefix)? cnt = cx, cx = 0 : cnt = 1;
-				while (cnt != 0) {
-					mem->write8(get_seg_adr(ES, di), mem->read8(get_seg_adr(DS, si)));
-					di++;
-					si++;
-					cnt--;
-					CLKS(CLK_MOVS);
-					if (clks <= 0 && cnt != 0) {
-						cx = cnt;
-						isRealMode? ip-- : eip--;
-						OP_CONTINUE();
-						return clks;
-					}
-				}
-			} else { // 8bit処理でもopsize32用の対応が必要
-				(repe_prefix)? cnt = ecx, ecx = 0 : cnt = 1;
-				while (cnt != 0) {
-					mem->write8(get_seg_adr(ES, edi), mem->read8(get_seg_adr(DS, esi)));
-					edi++;
-					esi++;
-					cnt--;
-					CLKS(CLK_MOVS);
-					if (clks <= 0 && cnt != 0) {
-						ecx = cnt;
-						isRealMode? ip-- : eip--;
-						OP_CONTINUE();
-						return clks;
-					}
-				}
-			}
-			break;
-		case 0xa5: // MOVS m16, m16 (MOVS m32, m32)
+			DAS_pr("WAIT\n");
+			// コプロ未実装なのでなにもしない
+			NEXT_OP;
+
+/******************** SAHF/LAHF ********************/
+
+		OPCASE(0x9e):
+			LF_SYNC();
+			CLKS(CLK_SAHF);
+			DAS_prt_post_op(0);
+			DAS_pr("SAHF\n");
+			flag8 = 0x2; // xxx eflagsのbit 1は常に1らしい
+			flag8 |= ah;
+			NEXT_OP;
+		OPCASE(0x9f):
+			LF_SYNC();
+			CLKS(CLK_LAHF);
+			DAS_prt_post_op(0);
+			DAS_pr("LAHF\n");
+			ah = flag8;
+			NEXT_OP;
+
+
+/******************** MOVS ********************/
+
+		OPCASE(0xa4): // MOVS m8, m8
+			DAS_prt_post_op(0);
+			DAS_pr("MOVSB\n");
+			STRING_OP(string_movs, 1);
+			NEXT_OP;
+		OPCASE(0xa5): // MOVS m16, m16 (MOVS m32, m32)
 			DAS_prt_post_op(0);
 			if (opsize == size16) {
 				DAS_pr("MOVSW\n");
-				(repe_prefix)? cnt = cx, cx = 0 : cnt = 1;
-				while (cnt != 0) {
-					mem->write16(get_seg_adr(ES, di), mem->read16(get_seg_adr(DS, si)));
-					di += 2;
-					si += 2;
-					cnt--;
-					CLKS(CLK_MOVS);
-					if (clks <= 0 && cnt != 0) {
-						cx = cnt;
-						isRealMode? ip-- : eip--;
-						OP_CONTINUE();
-						return clks;
-					}
-				}
+				STRING_OP(string_movs, 2);
 			} else {
 				DAS_pr("MOVSD\n");
-				(repe_prefix)? cnt = ecx, ecx = 0 : cnt = 1;
-				while (cnt != 0) {
-					mem->write32(get_seg_adr(ES, edi), mem->read32(get_seg_adr(DS, esi)));
-					edi++;
-					esi++;
-					cnt--;
-					CLKS(CLK_MOVS);
-					if (clks <= 0 && cnt != 0) {
-						ecx = cnt;
-						isRealMode? ip-- : eip--;
-						OP_CONTINUE();
-						return clks;
-					}
-				}
+				STRING_OP(string_movs, 4);
 			}
-			break;
+			NEXT_OP;
 
 /******************** CMPS ********************/
 
-		case 0xa6:
+		OPCASE(0xa6): // CMPSB
 			DAS_prt_post_op(0);
 			DAS_pr("CMPSB\n");
-			if (opsize == size16) {
-				(repne_prefix)?	cnt = cx : cnt = 1;
-				incdec = (flagu8 & DF8)? -1 : +1;
-				while (cnt != 0) {
-					CLKS(CLK_CMPS);
-					dst = mem->read8(get_seg_adr(DS, si));
-					src = mem->read8(get_seg_adr(ES, di));
-					res = dst - src;
-					if (res == 0) { // ZF==1
-						break;
-					}
-					si += incdec;
-					di += incdec;
-					cnt--;
-					if (clks <= 0 && cnt != 0) {
-						cx = cnt;
-						isRealMode? ip-- : eip--;
-						OP_CONTINUE();
-						return clks;
-					}
-				}
-				cx = cnt;
-				FLAG8bSUB(res, src, dst, );
-				OF_SUBb(res, src, dst);
-			} else { // 8bit処理でもopsize32用の対応が必要
-				(repne_prefix)?	cnt = ecx : cnt = 1;
-				incdec = (flagu8 & DF8)? -1 : +1;
-				while (cnt != 0) {
-					CLKS(CLK_CMPS);
-					dst = mem->read8(get_seg_adr(DS, esi));
-					src = mem->read8(get_seg_adr(ES, edi));
-					res = dst - src;
-					if (res == 0) { // ZF==1
-						break;
-					}
-					esi += incdec;
-					edi += incdec;
-					cnt--;
-					if (clks <= 0 && cnt != 0) {
-						ecx = cnt;
-						isRealMode? ip-- : eip--;
-						OP_CONTINUE();
-						return clks;
-					}
-				}
-				ecx = cnt;
-				FLAG8bSUB(res, src, dst, );
-				OF_SUBb(res, src, dst);
-			}
-			break;
-		case 0xa7: // CMPSW (CMPSD)
+			STRING_CMP_OP(1, false);
+			NEXT_OP;
+		OPCASE(0xa7): // CMPSW (CMPSD)
 			DAS_prt_post_op(0);
 			if (opsize == size16) {
 				DAS_pr("CMPSW\n");
-				(repne_prefix)?	cnt = cx : cnt = 1;
-				incdec = (flagu8 & DF8)? -2 : +2;
-				while (cnt != 0) {
-					CLKS(CLK_CMPS);
-					dst = mem->read16(get_seg_adr(DS, si));
-					src = mem->read16(get_seg_adr(ES, di));
-					res = dst - src;
-					if (res == 0) { // ZF==1
-						break;
-					}
-					si += incdec;
-					di += incdec;
-					cnt--;
-					if (clks <= 0 && cnt != 0) {
-						cx = cnt;
-						isRealMode? ip-- : eip--;
-						OP_CONTINUE();
-						return clks;
-					}
-				}
-				cx = cnt;
-				FLAG8wSUB(res, src, dst, );
-				OF_SUBw(res, src, dst);
+				STRING_CMP_OP(2, false);
 			} else {
 				DAS_pr("CMPSD\n");
-				(repne_prefix)?	cnt = ecx : cnt = 1;
-				incdec = (flagu8 & DF8)? -4 : +4;
-				while (cnt != 0) {
-					CLKS(CLK_CMPS);
-					dst = mem->read32(get_seg_adr(DS, esi));
-					src = mem->read32(get_seg_adr(ES, edi));
-					res = dst - src;
-					if (res == 0) { // ZF==1
-						break;
-					}
-					esi += incdec;
-					edi += incdec;
-					cnt--;
-					if (clks <= 0 && cnt != 0) {
-						ecx = cnt;
-						isRealMode? ip-- : eip--;
-						OP_CONTINUE();
-						return clks;
-					}
-				}
-				ecx = cnt;
-				FLAG8dSUB(res, src, dst, );
-				OF_SUBd(res, src, dst);
+				STRING_CMP_OP(4, false);
 			}
-			break;
+			NEXT_OP;
 
 /******************** STOS ********************/
 
-		case 0xaa:
+		OPCASE(0xaa):
 			DAS_prt_post_op(0);
 			DAS_pr("STOSB\n");
-			if (opsize == size16) {
-				(repe_prefix)? cnt = cx, cx = 0 : cnt = 1;
-				// whileの中で毎回ifするのは無駄なので
-				// あらかじめ加減値を算出する
-				incdec = (flagu8 & DF8)? -1 : +1;
-				while (cnt != 0) {
-					mem->write8(get_seg_adr(ES, di), al);
-					di += incdec;
-					cnt--;
-					CLKS(CLK_STOS);
-					if (clks <= 0 && cnt != 0) {
-						cx = cnt;
-						isRealMode? ip-- : eip--;
-						OP_CONTINUE();
-						return clks;
-					}
-				}
-			} else { // 8bit処理でもopsize32用の対応が必要
-				(repe_prefix)? cnt = ecx, ecx = 0 : cnt = 1;
-				incdec = (flagu8 & DF8)? -1 : +1;
-				while (cnt != 0) {
-					mem->write8(get_seg_adr(ES, edi), al);
-					edi += incdec;
-					cnt--;
-					CLKS(CLK_STOS);
-					if (clks <= 0 && cnt != 0) {
-						ecx = cnt;
-						isRealMode? ip-- : eip--;
-						OP_CONTINUE();
-						return clks;
-					}
-				}
-			}
-			break;
-		case 0xab:
+			STRING_OP(string_stos, 1);
+			NEXT_OP;
+		OPCASE(0xab):
 			DAS_prt_post_op(0);
 			if (opsize == size16) {
 				DAS_pr("STOSW\n");
-				(repe_prefix)? cnt = cx, cx = 0 : cnt = 1;
-				incdec = (flagu8 & DF8)? -2 : +2;
-				while (cnt != 0) {
-					mem->write16(get_seg_adr(ES, di), ax);
-					di += incdec;
-					cnt--;
-					CLKS(CLK_STOS);
-					if (clks <= 0 && cnt != 0) {
-						cx = cnt;
-						isRealMode? ip-- : eip--;
-						OP_CONTINUE();
-						return clks;
-					}
-				}
+				STRING_OP(string_stos, 2);
 			} else {
 				DAS_pr("STOSD\n");
-				(repe_prefix)? cnt = ecx, ecx = 0 : cnt = 1;
-				incdec = (flagu8 & DF8)? -4 : +4;
-				while (cnt != 0) {
-					mem->write32(get_seg_adr(ES, edi), eax);
-					edi += incdec;
-					cnt--;
-					CLKS(CLK_STOS);
-					if (clks <= 0 && cnt != 0) {
-						ecx = cnt;
-						isRealMode? ip-- : eip--;
-						OP_CONTINUE();
-						return clks;
-					}
-				}
+				STRING_OP(string_stos, 4);
 			}
-			break;
+			NEXT_OP;
 
 /******************** LODS ********************/
 
 		// xxx これにリピートプリフィックスつける意味あるのか？
-		case 0xac:
+		OPCASE(0xac):
 			DAS_prt_post_op(0);
 			DAS_pr("LODSB\n");
 			if (opsize == size16) {
 				(repe_prefix)? cnt = cx, cx = 0 : cnt = 1;
 				while (cnt != 0) {
-					al = mem->read8(get_seg_adr(DS, si));
+					al = mem->read8(get_seg_adr(eff_seg[DS], si));
 					si++;
 					cnt--;
 					CLKS(CLK_LODS);
 					if (clks <= 0 && cnt != 0) {
 						cx = cnt;
-						isRealMode? ip-- : eip--;
+						REAL? ip-- : eip--;
 						OP_CONTINUE();
 						return clks;
 					}
@@ -2805,20 +4179,20 @@ s32 CPU::exec(void) {
 			} else {
 				(repe_prefix)? cnt = ecx, ecx = 0 : cnt = 1;
 				while (cnt != 0) {
-					al = mem->read8(get_seg_adr(DS, esi));
+					al = mem->read8(get_seg_adr(eff_seg[DS], esi));
 					esi++;
 					cnt--;
 					CLKS(CLK_LODS);
 					if (clks <= 0 && cnt != 0) {
 						ecx = cnt;
-						isRealMode? ip-- : eip--;
+						REAL? ip-- : eip--;
 						OP_CONTINUE();
 						return clks;
 					}
 				}
 			}
-			break;
-		case 0xad: // LODSW (LODSD)
+			NEXT_OP;
+		OPCASE(0xad): // LODSW (LODSD)
 			DAS_prt_post_op(0);
 			if (opsize == size16) {
 				DAS_pr("LODSW\n");
@@ -2828,13 +4202,13 @@ s32 CPU::exec(void) {
 					// オペレーションサイズオーバーライド
 					// した時だけ上位16bitも参照する?
 					// それともリアルモードでも参照する?
-					ax = mem->read16(get_seg_adr(DS, esi));
+					ax = mem->read16(get_seg_adr(eff_seg[DS], esi));
 					si += 2;
 					cnt--;
 					CLKS(CLK_LODS);
 					if (clks <= 0 && cnt != 0) {
 						cx = cnt;
-						isRealMode? ip-- : eip--;
+						REAL? ip-- : eip--;
 						OP_CONTINUE();
 						return clks;
 					}
@@ -2843,143 +4217,37 @@ s32 CPU::exec(void) {
 				DAS_pr("LODSD\n");
 				(repe_prefix)? cnt = ecx, ecx = 0 : cnt = 1;
 				while (cnt != 0) {
-					eax = mem->read32(get_seg_adr(DS, esi));
+					eax = mem->read32(get_seg_adr(eff_seg[DS], esi));
 					esi += 4;
 					cnt--;
 					CLKS(CLK_LODS);
 					if (clks <= 0 && cnt != 0) {
 						ecx = cnt;
-						isRealMode? ip-- : eip--;
+						REAL? ip-- : eip--;
 						OP_CONTINUE();
 						return clks;
 					}
 				}
 			}
-			break;
+			NEXT_OP;
 
 /******************** SCAS ********************/
 
-		case 0xae:
+		OPCASE(0xae): // SCASB
 			DAS_prt_post_op(0);
 			DAS_pr("SCASB\n");
-			if (opsize == size16) {
-				(repe_prefix || repne_prefix)? cnt = cx : cnt = 1;
-				incdec = (flagu8 & DF8)? -1 : +1;
-				while (cnt != 0) {
-					CLKS(CLK_SCAS);
-					dst = al;
-					src = mem->read8(get_seg_adr(ES, di));
-					res = dst - src;
-					// ZF==1
-					if (repne_prefix && res == 0) {
-						break;
-					}
-					// ZF==0
-					if (repe_prefix && res != 0) {
-						break;
-					}
-					di += incdec;
-					cnt--;
-					if (clks <= 0 && cnt != 0) {
-						cx = cnt;
-						isRealMode? ip-- : eip--;
-						OP_CONTINUE();
-						return clks;
-					}
-				}
-				cx = cnt;
-			} else { // 8bit処理でもopsize32用の対応が必要
-				(repe_prefix || repne_prefix)? cnt = ecx : cnt = 1;
-				incdec = (flagu8 & DF8)? -1 : +1;
-				while (cnt != 0) {
-					CLKS(CLK_SCAS);
-					dst = al;
-					src = mem->read8(get_seg_adr(ES, edi));
-					res = dst - src;
-					// ZF==1
-					if (repne_prefix && res == 0) {
-						break;
-					}
-					// ZF==0
-					if (repe_prefix && res != 0) {
-						break;
-					}
-					edi += incdec;
-					cnt--;
-					if (clks <= 0 && cnt != 0) {
-						ecx = cnt;
-						isRealMode? ip-- : eip--;
-						OP_CONTINUE();
-						return clks;
-					}
-				}
-				ecx = cnt;
-			}
-			FLAG8bSUB(res, src, dst, );
-			OF_SUBb(res, src, dst);
-			break;
-		case 0xaf: // SCASW (SCASD)
+			STRING_CMP_OP(1, true);
+			NEXT_OP;
+		OPCASE(0xaf): // SCASW (SCASD)
 			DAS_prt_post_op(0);
 			if (opsize == size16) {
 				DAS_pr("SCASW\n");
-				(repe_prefix || repne_prefix)? cnt = cx : cnt = 1;
-				incdec = (flagu8 & DF8)? -2 : +2;
-				while (cnt != 0) {
-					CLKS(CLK_SCAS);
-					dst = ax;
-					src = mem->read16(get_seg_adr(ES, di));
-					res = dst - src;
-					// ZF==1
-					if (repne_prefix && res == 0) {
-						break;
-					}
-					// ZF==0
-					if (repe_prefix && res != 0) {
-						break;
-					}
-					di += incdec;
-					cnt--;
-					if (clks <= 0 && cnt != 0) {
-						cx = cnt;
-						isRealMode? ip-- : eip--;
-						OP_CONTINUE();
-						return clks;
-					}
-				}
-				cx = cnt;
-				FLAG8wSUB(res, src, dst, );
-				OF_SUBw(res, src, dst);
+				STRING_CMP_OP(2, true);
 			} else {
 				DAS_pr("SCASD\n");
-				(repe_prefix || repne_prefix)? cnt = ecx : cnt = 1;
-				incdec = (flagu8 & DF8)? -4 : +4;
-				while (cnt != 0) {
-					CLKS(CLK_SCAS);
-					dst = eax;
-					src = mem->read32(get_seg_adr(ES, edi));
-					res = dst - src;
-					// ZF==1
-					if (repne_prefix && res == 0) {
-						break;
-					}
-					// ZF==0
-					if (repe_prefix && res != 0) {
-						break;
-					}
-					edi += incdec;
-					cnt--;
-					if (clks <= 0 && cnt != 0) {
-						ecx = cnt;
-						isRealMode? ip-- : eip--;
-						OP_CONTINUE();
-						return clks;
-					}
-				}
-				ecx = cnt;
-				FLAG8dSUB(res, src, dst, );
-				OF_SUBd(res, src, dst);
+				STRING_CMP_OP(4, true);
 			}
-			break;
+			NEXT_OP;
 
 /******************** Rotate/Shift ********************/
 /*
@@ -2988,15 +4256,15 @@ s32 CPU::exec(void) {
   |11000000|mod op2 r/m|(DISP-LO)|(DISP-HI)|  data  |
   +--------+-----------+---------+---------+--------+
 */
-		case 0xc0: // 80386
-			modrm = mem->read8(get_seg_adr(CS, eip));
+		OPCASE(0xc0): // 80386
+			modrm = fetch8(eip);
 			subop = modrm >> 3 & 7;
 			ndisp = nr_disp_modrm(modrm);
 			DAS_prt_post_op(ndisp + 2);
 			DAS_pr("%s ", strdx[subop]);
 			DAS_modrm(modrm, false, false, byte);
-			DAS_pr("0x%02x\n", mem->read8(get_seg_adr(CS, eip + ndisp + 1)));
-			src = mem->read8(get_seg_adr(CS, ndisp + eip + 1));
+			DAS_pr("0x%02x\n", fetch8(eip + ndisp + 1));
+			src = fetch8(ndisp + eip + 1);
 			src %= 8;
 			switch (subop) {
 			case 0x0: // ROL r/m8, imm8
@@ -3028,7 +4296,7 @@ s32 CPU::exec(void) {
 				break;
 			}
 			eip++;
-			break;
+			NEXT_OP;
 
 /*
   76  543 210
@@ -3036,15 +4304,15 @@ s32 CPU::exec(void) {
   |11000001|mod op2 r/m|(DISP-LO)|(DISP-HI)|  data  |
   +--------+-----------+---------+---------+--------+
 */
-		case 0xc1: // 80386
-			modrm = mem->read8(get_seg_adr(CS, eip));
+		OPCASE(0xc1): // 80386
+			modrm = fetch8(eip);
 			subop = modrm >> 3 & 7;
 			ndisp = nr_disp_modrm(modrm);
 			DAS_prt_post_op(ndisp + 2);
 			DAS_pr("%s ", strdx[subop]);
 			DAS_modrm(modrm, false, false, word);
-			DAS_pr("0x%02x\n", mem->read8(get_seg_adr(CS, eip + ndisp + 1)));
-			src = mem->read8(get_seg_adr(CS, ndisp + eip + 1));
+			DAS_pr("0x%02x\n", fetch8(eip + ndisp + 1));
+			src = fetch8(ndisp + eip + 1);
 			src = (opsize == size16)? src % 16 : src % 32;
 			switch (subop) {
 			case 0x0: // ROL r/m16, imm8 (ROL r/m32, imm8)
@@ -3108,7 +4376,7 @@ s32 CPU::exec(void) {
 				break;
 			}
 			eip++;
-			break;
+			NEXT_OP;
 
 /*
   76  543 210
@@ -3116,8 +4384,8 @@ s32 CPU::exec(void) {
   |110100vw|mod op2 r/m|(DISP-LO)|(DISP-HI)|
   +--------+-----------+---------+---------+
 */
-		case 0xd0:
-			modrm = mem->read8(get_seg_adr(CS, eip));
+		OPCASE(0xd0):
+			modrm = fetch8(eip);
 			subop = modrm >> 3 & 7;
 			DAS_prt_post_op(nr_disp_modrm(modrm) + 1);
 			DAS_pr("%s ", strdx[subop]);
@@ -3152,10 +4420,10 @@ s32 CPU::exec(void) {
 				SFT_SAR(b, 1);
 				break;
 			}
-			break;
+			NEXT_OP;
 
-		case 0xd1:
-			modrm = mem->read8(get_seg_adr(CS, eip));
+		OPCASE(0xd1):
+			modrm = fetch8(eip);
 			subop = modrm >> 3 & 7;
 			DAS_prt_post_op(nr_disp_modrm(modrm) + 1);
 			DAS_pr("%s ", strdx[subop]);
@@ -3222,10 +4490,10 @@ s32 CPU::exec(void) {
 				}
 				break;
 			}
-			break;
+			NEXT_OP;
 
-		case 0xd2:
-			modrm = mem->read8(get_seg_adr(CS, eip));
+		OPCASE(0xd2):
+			modrm = fetch8(eip);
 			subop = modrm >> 3 & 7;
 			DAS_prt_post_op(nr_disp_modrm(modrm) + 1);
 			DAS_pr("%s ", strdx[subop]);
@@ -3269,10 +4537,10 @@ s32 CPU::exec(void) {
 				SFT_SAR(b, cl);
 				break;
 			}
-			break;
+			NEXT_OP;
 
-		case 0xd3:
-			modrm = mem->read8(get_seg_adr(CS, eip));
+		OPCASE(0xd3):
+			modrm = fetch8(eip);
 			subop = modrm >> 3 & 7;
 			DAS_prt_post_op(nr_disp_modrm(modrm) + 1);
 			DAS_pr("%s ", strdx[subop]);
@@ -3349,120 +4617,120 @@ s32 CPU::exec(void) {
 				}
 				break;
 			}
-			break;
+			NEXT_OP;
 
 /******************** RET ********************/
 
 // xxx プロテクトモードでcall/retに対して
 // オペレーションサイズプリフィックスが使われることはないよね？
 
-		case 0xc3: // RET  nearリターンする
+		OPCASE(0xc3): // RET  nearリターンする
 			DAS_prt_post_op(0);
 			DAS_pr("RET\n");
+			SAMPLE_RET();
 			POPW(ip);
-			break;
-		case 0xcb: // RET  farリターンする
+			NEXT_OP;
+		OPCASE(0xcb): // RET  farリターンする
 			DAS_prt_post_op(0);
 			DAS_pr("RET\n");
+			SAMPLE_RET();
 			POPW(ip);
 			POPW(dst);
 			update_segreg(CS, (u16)dst);
-			break;
-		case 0xc2: // RET  nearリターンする
+			NEXT_OP;
+		OPCASE(0xc2): // RET  nearリターンする
 			DAS_prt_post_op(1);
 			// eipは後で書き換わるのであらかじめ取得しておく
-			src = mem->read16(get_seg_adr(CS, eip));
+			src = fetch16(eip);
 			DAS_pr("RET 0x%04x\n", src);
+			SAMPLE_RET();
 			POPW(ip);
 			sp += src;
-			break;
-		case 0xca: // RET  farリターンする
+			NEXT_OP;
+		OPCASE(0xca): // RET  farリターンする
 			DAS_prt_post_op(1);
-			src = mem->read16(get_seg_adr(CS, eip));
+			src = fetch16(eip);
 			DAS_pr("RET 0x%04x\n", src);
+			SAMPLE_RET();
 			POPW(ip);
 			POPW(dst);
 			update_segreg(CS, (u16)dst);
 			sp += src;
-			break;
+			NEXT_OP;
 
 /******************** LES/LDS ********************/
 
-		case 0xc4: // LES r16, m16:16 (LES r32, m16:32)
-			CLKS(isRealMode?CLK_LES:CLK_PM_LES);
+		OPCASE(0xc4): // LES r16, m16:16 (LES r32, m16:32)
+			CLKS(REAL?CLK_LES:CLK_PM_LES);
 			LxS(LES, ES);
-			break;
-		case 0xc5: // LDS r16, m16:16 (LDS r32, m16:32)
-			CLKS(isRealMode?CLK_LDS:CLK_PM_LDS);
+			NEXT_OP;
+		OPCASE(0xc5): // LDS r16, m16:16 (LDS r32, m16:32)
+			CLKS(REAL?CLK_LDS:CLK_PM_LDS);
 			LxS(LDS, DS);
-			break;
+			NEXT_OP;
 
 /******************** INT ********************/
 
-		case 0xcc: // INT 3
+		OPCASE(0xcc): // INT 3
 			DAS_prt_post_op(0);
 			DAS_pr("INT 3\n");
-			PUSHW0(flagu8 << 8 | flag8);
-			PUSHW0(segreg[CS]);
-			PUSHW0(ip);
-			flagu8 &= ~(TFSET8 | IFSET8);
-			tmpadr = 3 * 4;
-			eip = mem->read16(tmpadr);
-			update_segreg(CS, mem->read16(tmpadr + 2));
-			break;
-		case 0xcd: // INT n
+			interrupt(3, 1);
+			NEXT_OP;
+		OPCASE(0xcd): // INT n
 			DAS_prt_post_op(1);
-			tmpb = mem->read8(get_seg_adr(CS, eip));
+			tmpb = fetch8(eip);
 			DAS_pr("INT %d\n", tmpb);
 			eip++;
-			PUSHW0(flagu8 << 8 | flag8);
-			PUSHW0(segreg[CS]);
-			PUSHW0(ip);
-			flagu8 &= ~(TFSET8 | IFSET8);
-			tmpadr = tmpb * 4;
-			eip = mem->read16(tmpadr);
-			update_segreg(CS, mem->read16(tmpadr + 2));
-			break;
-		case 0xce: // INTO
+			interrupt(tmpb, 2);
+			NEXT_OP;
+		OPCASE(0xce): // INTO
 			DAS_prt_post_op(0);
 			DAS_pr("INTO\n");
-			PUSHW0(flagu8 << 8 | flag8);
-			PUSHW0(segreg[CS]);
-			PUSHW0(ip);
-			flagu8 &= ~(TFSET8 | IFSET8);
-			eip = mem->read16(0x10);
-			update_segreg(CS, mem->read16(0x12));
-			break;
-		case 0xcf: // IRET
+			if (!(flagu8 & OFSET8)) {
+				CLKS(CLK_INTO_OF0);
+				NEXT_OP;
+			}
+			interrupt(4, 1);
+			NEXT_OP;
+		OPCASE(0xcf): // IRET
+			DAS_prt_post_op(0);
+			DAS_pr("IRET\n");
+			if (!REAL) {
+				iret();
+				NEXT_OP;
+			}
+			LF_SYNC();
+			CLKS(CLK_IRET);
+			SAMPLE_RET();
 			POPW0(ip);
 			POPW0(warg1);
 			update_segreg(CS, warg1);
 			POPW0(warg1);
 			flag8 = warg1 & 0xff;
 			flagu8 = warg1 >> 8;
-			break;
+			NEXT_OP;
 
 /******************** XLAT ********************/
 
-		case 0xd7:
+		OPCASE(0xd7):
 			CLKS(CLK_XLAT);
 			DAS_prt_post_op(0);
 			DAS_pr("XLAT\n");
-			al = mem->read8(get_seg_adr(DS, (bx + al) & 0xffff));
-			break;
+			al = mem->read8(get_seg_adr(eff_seg[DS], (bx + al) & 0xffff));
+			NEXT_OP;
 
 /******************** ESC ********************/
 
-		case 0xd8:
+		OPCASE(0xd8):
 			// go through
-		case 0xd9:
+		OPCASE(0xd9):
 			// go through
-		case 0xda:
+		OPCASE(0xda):
 			// nothing to do
-			break;
-		case 0xdb: // ESC 3
+			NEXT_OP;
+		OPCASE(0xdb): // ESC 3
 			DAS_prt_post_op(1);
-			subop = mem->read8(get_seg_adr(CS, eip));
+			subop = fetch8(eip);
 			switch (subop) {
 			case 0xe3: // FNINIT
 				DAS_pr("FNINIT\n");
@@ -3470,49 +4738,54 @@ s32 CPU::exec(void) {
 				eip++;
 				break;
 			}
-			break;
-		case 0xdc:
+			NEXT_OP;
+		OPCASE(0xdc):
 			// go through
-		case 0xdd:
+		OPCASE(0xdd):
 			// go through
-		case 0xde:
+		OPCASE(0xde):
 			// go through
-		case 0xdf:
+		OPCASE(0xdf):
 			// nothing to do
-			break;
+			NEXT_OP;
 
 /******************** LOOP ********************/
 
-		case 0xe0: // LOOPNE/LOOPNZ rel8
+		OPCASE(0xe0): // LOOPNE/LOOPNZ rel8
+			LF_SYNC();
 			DAS_prt_post_op(1);
-			tmpb = mem->read8(get_seg_adr(CS, eip));
+			tmpb = fetch8(eip);
 			DAS_pr("LOOPNE/LOOPNZ 0x%02x\n", tmpb);
 			eip++; // jmpする前にインクリメントしておく必要がある
 			cx--;
 			if (cx != 0 && !(flag8 & ZF)) {
 				eip += (s8)tmpb;
 			}
-			break;
-		case 0xe1: // LOOPE/LOOPZ rel8
+			NEXT_OP;
+		OPCASE(0xe1): // LOOPE/LOOPZ rel8
+			LF_SYNC();
 			DAS_prt_post_op(1);
-			tmpb = mem->read8(get_seg_adr(CS, eip));
+			tmpb = fetch8(eip);
 			DAS_pr("LOOPE/LOOPZ 0x%02x\n", tmpb);
 			eip++;
 			cx--;
 			if (cx != 0 && flag8 & ZF) {
 				eip += (s8)tmpb;
 			}
-			break;
-		case 0xe2: // LOOP rel8
+			NEXT_OP;
+		OPCASE(0xe2): // LOOP rel8
 			DAS_prt_post_op(1);
-			tmpb = mem->read8(get_seg_adr(CS, eip));
+			tmpb = fetch8(eip);
 			DAS_pr("LOOP 0x%02x\n", tmpb);
 			eip++;
 			cx--;
 			if (cx != 0) {
 				eip += (s8)tmpb;
+				SPIN_TAKEN(tmpb);
+			} else {
+				SPIN_EXIT(tmpb);
 			}
-			break;
+			NEXT_OP;
 
 /******************** IN/OUT ********************/
 /*
@@ -3520,64 +4793,64 @@ s32 CPU::exec(void) {
   |1110010w| data-8 |
   +--------+--------+
 */
-		case 0xe4: // IN AL, imm8
-			CLKS(isRealMode?CLK_IN:CLK_PM_IN);
+		OPCASE(0xe4): // IN AL, imm8
+			CLKS(REAL?CLK_IN:CLK_PM_IN);
 			DAS_prt_post_op(1);
-			DAS_pr("IN AL, 0x%02x\n", mem->read8(get_seg_adr(CS, eip)));
-			al = io->read8(mem->read8(get_seg_adr(CS, eip++)));
-			break;
-		case 0xe5: // IN AX, imm8 (IN EAX, imm8)
-			CLKS(isRealMode?CLK_IN:CLK_PM_IN);
+			DAS_pr("IN AL, 0x%02x\n", fetch8(eip));
+			al = io->read8(fetch8(eip++));
+			NEXT_OP;
+		OPCASE(0xe5): // IN AX, imm8 (IN EAX, imm8)
+			CLKS(REAL?CLK_IN:CLK_PM_IN);
 			DAS_prt_post_op(1);
 			if (opsize == size16) {
 				DAS_pr("IN AX, 0x%02x\n",
-				       mem->read8(get_seg_adr(CS, eip)));
-				ax = io->read16(mem->read8(get_seg_adr(CS, eip++)));
+				       fetch8(eip));
+				ax = io->read16(fetch8(eip++));
 			} else {
 				DAS_pr("IN EAX, 0x%02x\n",
-				       mem->read8(get_seg_adr(CS, eip)));
-				eax = io->read32(mem->read8(get_seg_adr(CS, eip++)));
+				       fetch8(eip));
+				eax = io->read32(fetch8(eip++));
 			}
-			break;
+			NEXT_OP;
 
 /*
   +--------+--------+
   |1110011w| data-8 |
   +--------+--------+
 */
-		case 0xe6: // OUT imm8, AL
-			CLKS(isRealMode?CLK_OUT:CLK_PM_OUT);
+		OPCASE(0xe6): // OUT imm8, AL
+			CLKS(REAL?CLK_OUT:CLK_PM_OUT);
 			DAS_prt_post_op(1);
-			DAS_pr("OUT 0x%02x, AL\n", mem->read8(get_seg_adr(CS, eip)));
-			io->write8(mem->read8(get_seg_adr(CS, eip++)), al);
-			break;
-		case 0xe7: // OUT imm8, AX (OUT imm8, EAX)
-			CLKS(isRealMode?CLK_OUT:CLK_PM_OUT);
+			DAS_pr("OUT 0x%02x, AL\n", fetch8(eip));
+			io->write8(fetch8(eip++), al);
+			NEXT_OP;
+		OPCASE(0xe7): // OUT imm8, AX (OUT imm8, EAX)
+			CLKS(REAL?CLK_OUT:CLK_PM_OUT);
 			DAS_prt_post_op(1);
 			if (opsize == size16) {
 				DAS_pr("OUT 0x%02x, AX\n",
-				       mem->read8(get_seg_adr(CS, eip)));
-				io->write16(mem->read8(get_seg_adr(CS, eip++)), ax);
+				       fetch8(eip));
+				io->write16(fetch8(eip++), ax);
 			} else {
 				DAS_pr("OUT 0x%02x, EAX\n",
-				       mem->read8(get_seg_adr(CS, eip)));
-				io->write32(mem->read8(get_seg_adr(CS, eip++)), eax);
+				       fetch8(eip));
+				io->write32(fetch8(eip++), eax);
 			}
-			break;
+			NEXT_OP;
 
 /*
   +--------+
   |1110110w|
   +--------+
 */
-		case 0xec: // IN AL, DX
-			CLKS(isRealMode?CLK_IN_DX:CLK_PM_IN_DX);
+		OPCASE(0xec): // IN AL, DX
+			CLKS(REAL?CLK_IN_DX:CLK_PM_IN_DX);
 			DAS_prt_post_op(0);
 			DAS_pr("IN AL, DX\n");
 			al = io->read8(dx);
-			break;
-		case 0xed: // IN AX, DX (IN EAX, DX)
-			CLKS(isRealMode?CLK_IN_DX:CLK_PM_IN_DX);
+			NEXT_OP;
+		OPCASE(0xed): // IN AX, DX (IN EAX, DX)
+			CLKS(REAL?CLK_IN_DX:CLK_PM_IN_DX);
 			DAS_prt_post_op(0);
 			if (opsize == size16) {
 				DAS_pr("IN AX, DX\n");
@@ -3586,21 +4859,21 @@ s32 CPU::exec(void) {
 				DAS_pr("IN EAX, DX\n");
 				eax = io->read32(dx);
 			}
-			break;
+			NEXT_OP;
 
 /*
   +--------+
   |1110111w|
   +--------+
 */
-		case 0xee: // OUT DX, AL
-			CLKS(isRealMode?CLK_OUT_DX:CLK_PM_OUT_DX);
+		OPCASE(0xee): // OUT DX, AL
+			CLKS(REAL?CLK_OUT_DX:CLK_PM_OUT_DX);
 			DAS_prt_post_op(0);
 			DAS_pr("OUT DX, AL\n");
 			io->write8(dx, al);
-			break;
-		case 0xef: // OUT DX, AX (OUT DX, EAX)
-			CLKS(isRealMode?CLK_OUT_DX:CLK_PM_OUT_DX);
+			NEXT_OP;
+		OPCASE(0xef): // OUT DX, AX (OUT DX, EAX)
+			CLKS(REAL?CLK_OUT_DX:CLK_PM_OUT_DX);
 			DAS_prt_post_op(0);
 			if (opsize == size16) {
 				DAS_pr("OUT DX, AX\n");
@@ -3609,34 +4882,36 @@ s32 CPU::exec(void) {
 				DAS_pr("OUT DX, EAX\n");
 				io->write32(dx, eax);
 			}
-			break;
+			NEXT_OP;
 
 /******************** CALL ********************/
 
-		case 0xe8: // CALL rel16
+		OPCASE(0xe8): // CALL rel16
 			DAS_prt_post_op(2);
-			warg1 = mem->read16(get_seg_adr(CS, eip));
+			warg1 = fetch16(eip);
 			eip += 2;
 			DAS_pr("CALL 0x%04x\n", warg1);
 			PUSHW0(ip);
 			eip += (s16)warg1;
-			break;
+			SAMPLE_CALL();
+			NEXT_OP;
 /*
   +--------+--------+--------+--------+--------+
   |10011010| IP-lo  | IP-hi  | CS-lo  | CS-hi  |
   +--------+--------+--------+--------+--------+
 */
-		case 0x9a: // CALL ptr16:16 セグメント外直接
+		OPCASE(0x9a): // CALL ptr16:16 セグメント外直接
 			DAS_prt_post_op(4);
-			warg1 = mem->read16(get_seg_adr(CS, eip));
-			warg2 = mem->read16(get_seg_adr(CS, eip + 2));
+			warg1 = fetch16(eip);
+			warg2 = fetch16(eip + 2);
 			eip += 4;
 			DAS_pr("CALL %04x:%04x\n", warg2, warg1);
 			PUSHW0(segreg[CS]);
 			PUSHW0(ip);
 			update_segreg(CS, warg2);
 			eip = warg1;
-			break;
+			SAMPLE_CALL();
+			NEXT_OP;
 
 /******************** JMP ********************/
 /*
@@ -3644,55 +4919,57 @@ s32 CPU::exec(void) {
   |11101001|IP-INC-LO|IP-INC-HI|
   +--------+---------+---------+
 */
-		case 0xe9: // JMP rel16 (JMP rel32) セグメント内直接ジャンプ
+		OPCASE(0xe9): // JMP rel16 (JMP rel32) セグメント内直接ジャンプ
 			if (opsize == size16) {
 				DAS_prt_post_op(2);
-				DAS_pr("JMP 0x%04x\n", mem->read16(get_seg_adr(CS, eip)));
-				eip += (s16)mem->read16(get_seg_adr(CS, eip)) + 2;
+				DAS_pr("JMP 0x%04x\n", fetch16(eip));
+				eip += (s16)fetch16(eip) + 2;
 			} else {
 				DAS_prt_post_op(4);
-				DAS_pr("JMP 0x%08x\n", mem->read32(get_seg_adr(CS, eip)));
-				eip += (s16)mem->read32(get_seg_adr(CS, eip)) + 4;
+				DAS_pr("JMP 0x%08x\n", fetch32(eip));
+				eip += (s32)fetch32(eip) + 4;
 			}
-			break;
+			NEXT_OP;
 
 /*
   +--------+--------+--------+--------+--------+
   |11101010| IP-lo  | IP-hi  | CS-lo  | CS-hi  |
   +--------+--------+--------+--------+--------+
 */
-		case 0xea: // セグメント外直接ジャンプ
+		OPCASE(0xea): // セグメント外直接ジャンプ
 			if (opsize == size16) {
 				DAS_prt_post_op(4);
-				warg1 = mem->read16(get_seg_adr(CS, eip));
-				warg2 = mem->read16(get_seg_adr(CS, eip + 2));
+				warg1 = fetch16(eip);
+				warg2 = fetch16(eip + 2);
 				DAS_pr("JMP %04x:%04x\n", warg2, warg1);
 				update_segreg(CS, warg2);
 				eip = warg1;
 			} else{
 				DAS_prt_post_op(6);
-				darg1 = mem->read32(get_seg_adr(CS, eip));
-				warg2 = mem->read16(get_seg_adr(CS, eip + 4));
+				darg1 = fetch32(eip);
+				warg2 = fetch16(eip + 4);
 				DAS_pr("JMP %04x:%08x\n", warg2, darg1);
 				update_segreg(CS, warg2);
 				eip = darg1;
 			}
-			break;
+			NEXT_OP;
 /*
   +--------+--------+
   |11101011|IP-INC8 |
   +--------+--------+
 */
-		case 0xeb: //無条件ジャンプ/セグメントショート内直接
+		OPCASE(0xeb): //無条件ジャンプ/セグメントショート内直接
 			DAS_prt_post_op(1);
-			DAS_pr("JMP 0x%02x\n", mem->read8(get_seg_adr(CS, eip)));
-			eip += (s8)mem->read8(get_seg_adr(CS, eip)) + 1;
-			break;
+			DAS_pr("JMP 0x%02x\n", fetch8(eip));
+			tmpb = fetch8(eip);
+			eip += (s8)tmpb + 1;
+			SPIN_TAKEN(tmpb);
+			NEXT_OP;
 
 /******************** TEST/NOT/NEG/MUL/IMUL/DIV/IDIV ********************/
 
-		case 0xf6:
-			modrm = mem->read8(get_seg_adr(CS, eip));
+		OPCASE(0xf6):
+			modrm = fetch8(eip);
 			subop = modrm >> 3 & 7;
 			DAS_prt_post_op(nr_disp_modrm(modrm) + (subop < 2)?2:1);
 			DAS_pr("%s ", strf6[subop]);
@@ -3709,15 +4986,16 @@ s32 CPU::exec(void) {
 			case 0x0: // TEST r/m8, imm8
 				// go through
 			case 0x1:
-				DAS_pr("0x%02x\n", mem->read8(get_seg_adr(CS, eip + nr_disp_modrm(modrm))));
+				DAS_pr("0x%02x\n", fetch8(eip + nr_disp_modrm(modrm)));
 				if ((modrm & 0xc0) == 0xc0) {
 					CLKS(CLK_TEST_R_IMM);
-					flag8 = flag_calb[genregb(modrm & 7) & mem->read8(get_seg_adr(CS, eip))];
+					dst = genregb(modrm & 7);
 				} else {
 					CLKS(CLK_TEST_MEM_IMM);
-					flag8 = flag_calb[mem->read8(modrm_seg_ea(modrm)) & mem->read8(get_seg_adr(CS, eip))];
+					dst = mem->read8(modrm_seg_ea(modrm));
 				}
-				flagu8 &= ~OFSET8;
+				dst &= fetch8(eip);
+				FLAG_LOGOPb(dst);
 				eip++;
 				break;
 			case 0x2: // NOT r/m8
@@ -3745,6 +5023,7 @@ s32 CPU::exec(void) {
 					res = 0 - src;
 					mem->write8(tmpadr, (u8)res);
 				}
+				LF_SYNC();
 				flag8 = flag_calb[res & 0xff];
 				(res == 0)? flag8 &= ~CF : flag8 |= CF;
 				(res & src & 0x80)?
@@ -3756,6 +5035,7 @@ s32 CPU::exec(void) {
 				} else {
 					ax = mem->read8(modrm_seg_ea(modrm)) * al;
 				}
+				LF_SYNC();
 				if (ah == 0) {
 					flag8 = 0;
 					flagu8 &= ~OFSET8;
@@ -3770,6 +5050,7 @@ s32 CPU::exec(void) {
 				} else {
 					ax = (s8)mem->read8(modrm_seg_ea(modrm)) * (s8)al;
 				}
+				LF_SYNC();
 				if (ah == 0) {
 					flag8 = 0;
 					flagu8 &= ~OFSET8;
@@ -3803,10 +5084,10 @@ s32 CPU::exec(void) {
 				ah = (s16)dst % (s8)src;
 				break;
 			}
-			break;
+			NEXT_OP;
 
-		case 0xf7:
-			modrm = mem->read8(get_seg_adr(CS, eip));
+		OPCASE(0xf7):
+			modrm = fetch8(eip);
 			subop = modrm >> 3 & 7;
 			DAS_prt_post_op(nr_disp_modrm(modrm) + (subop < 2)?3:1);
 			DAS_pr("%s ", strf6[subop]);
@@ -3817,15 +5098,16 @@ s32 CPU::exec(void) {
 			case 0x0: // TEST r/m16, imm16 (TEST r/m32, imm32)
 				// go through
 			case 0x1:
-				DAS_pr("0x%04x\n", mem->read16(get_seg_adr(CS, eip + nr_disp_modrm(modrm))));
+				DAS_pr("0x%04x\n", fetch16(eip + nr_disp_modrm(modrm)));
 				if ((modrm & 0xc0) == 0xc0) {
 					CLKS(CLK_TEST_R_IMM);
-					flag8 = flag_calw[genregw(modrm & 7) & mem->read16(get_seg_adr(CS, eip))];
+					dst = genregw(modrm & 7);
 				} else {
 					CLKS(CLK_TEST_MEM_IMM);
-					flag8 = flag_calw[mem->read16(modrm_seg_ea(modrm)) & mem->read16(get_seg_adr(CS, eip))];
+					dst = mem->read16(modrm_seg_ea(modrm));
 				}
-				flagu8 &= ~OFSET8;
+				dst &= fetch16(eip);
+				FLAG_LOGOPw(dst);
 				eip += 2;
 				break;
 			case 0x2: // NOT r/m16 (xxx NOT r/m32)
@@ -3853,7 +5135,8 @@ s32 CPU::exec(void) {
 					res = 0 - src;
 					mem->write8(tmpadr, (u16)res);
 				}
-				flag8 = flag_calw[res & 0xffff];
+				LF_SYNC();
+				flag8 = FLAG_CALw(res & 0xffff);
 				(res == 0)? flag8 &= ~CF : flag8 |= CF;
 				(res & src & 0x8000)?
 					flagu8 |= OFSET8 : flagu8 &= ~OFSET8;
@@ -3866,6 +5149,7 @@ s32 CPU::exec(void) {
 				}
 				ax = res & 0xffff;
 				dx = res >> 16;
+				LF_SYNC();
 				if (dx == 0) {
 					flag8 = 0;
 					flagu8 &= ~OFSET8;
@@ -3882,6 +5166,7 @@ s32 CPU::exec(void) {
 				}
 				ax = res & 0xffff;
 				dx = res >> 16;
+				LF_SYNC();
 				if (dx == 0) {
 					flag8 = 0;
 					flagu8 &= ~OFSET8;
@@ -3941,63 +5226,59 @@ s32 CPU::exec(void) {
 				}
 				break;
 			}
-			break;
+			NEXT_OP;
 
 /******************** セグメントオーバーライド ********************/
 
-		case 0x26: // SEG=ES
+		OPCASE(0x26): // SEG=ES
 			SEG_OVRIDE(ES);
 			return clks; // リターンする
-		case 0x2e: // SEG=CS
+		OPCASE(0x2e): // SEG=CS
 			SEG_OVRIDE(CS);
 			return clks; // リターンする
-		case 0x36: // SEG=SS
+		OPCASE(0x36): // SEG=SS
 			SEG_OVRIDE(SS);
 			return clks; // リターンする
-		case 0x3e: // SEG=DS
+		OPCASE(0x3e): // SEG=DS
 			SEG_OVRIDE(DS);
 			return clks; // リターンする
 
 
 /*************** オペランドサイズオーバーライドプリフィックス ***************/
 
-		case 0x66:
+		OPCASE(0x66):
 			DAS_prt_post_op(0);
 			DAS_pr("Ope Size Override\n");
 			opsize_ovride = true;
-			opsize = isRealMode?
-				size32 : (sdcr[CS].attr & 0x400)?
-				size16 : size32;
+			opsize = DEF32? size16 : size32;
 			return clks; // リターンする
 
 /*************** アドレスサイズオーバーライドプリフィックス ***************/
 
-		case 0x67:
+		OPCASE(0x67):
 			DAS_prt_post_op(0);
 			DAS_pr("Addr Size Override\n");
 			addrsize_ovride = true;
-			addrsize = isRealMode?
-				size32 : (sdcr[CS].attr & 0x400)?
-				size16 : size32;
+			addrsize = DEF32? size16 : size32;
 			return clks; // リターンする
 
 /*************** LOCK ***************/
 
-		case 0xf0:
+		OPCASE(0xf0):
 			DAS_prt_post_op(0);
 			DAS_pr("LOCK\n");
 			// nothing to do
-			break;
+			NEXT_OP;
 
 /*************** リピートプリフィックス ***************/
 
-		case 0xf2:
+		OPCASE(0xf2):
 			// repneでZFをチェックするのはCMPSとSCASのみ
 			DAS_prt_post_op(0);
 			DAS_pr("Repne Prefix\n");
 			repne_prefix = true;
 			return clks;
-		case 0xf3:
+		OPCASE(0xf3):
 			// repeでZFをチェックするのはCMPSとSCASのみ
 			DAS_prt_post_op(0);
 			DAS_pr("Repe Prefix\n");
@@ -4006,7 +5287,7 @@ s32 CPU::exec(void) {
 
 /******************** HLT ********************/
 
-		case 0xf4:
+		OPCASE(0xf4):
 			CLKS(CLK_HLT);
 #ifdef CORE_DAS
 			if (!DAS_hlt) {
@@ -4015,58 +5296,69 @@ s32 CPU::exec(void) {
 			}
 			DAS_hlt = true; // xxx いつかfalseに戻す
 #endif
+			halted = true;
 			eip--;
-			return clks; // リターンする？
+			// 割り込みを受け付けられなければ、次のイベント(なければ
+			// スライスの終わり)まで何もしないので、そこまでクロックを進める
+			if (!(intr_pending && (flagu8 & IFSET8)) && clks > exit_clks) {
+				idle_clks += clks - exit_clks;
+				clks = exit_clks;
+			}
+			return clks;
 
 /******************** プロセッサコントロール ********************/
 
-		case 0xf5:
+		OPCASE(0xf5):
+			LF_SYNC();
 			CLKS(CLK_CMC);
 			DAS_prt_post_op(0);
 			DAS_pr("CMC\n");
 			(flag8 & CF)? flag8 &= ~CF : flag8 |= CF;
-			break;
-		case 0xf8:
+			NEXT_OP;
+		OPCASE(0xf8):
+			LF_SYNC();
 			CLKS(CLK_CLC);
 			DAS_prt_post_op(0);
 			DAS_pr("CLC\n");
 			flag8 &= ~CF;
-			break;
-		case 0xf9:
+			NEXT_OP;
+		OPCASE(0xf9):
+			LF_SYNC();
 			CLKS(CLK_STC);
 			DAS_prt_post_op(0);
 			DAS_pr("STC\n");
 			flag8 |= CF;
-			break;
-		case 0xfa:
+			NEXT_OP;
+		OPCASE(0xfa):
 			CLKS(CLK_CLI);
 			DAS_prt_post_op(0);
 			DAS_pr("CLI\n");
 			flagu8 &= ~IFSET8;
-			break;
-		case 0xfb: // STI
+			NEXT_OP;
+		OPCASE(0xfb): // STI
 			CLKS(CLK_STI);
 			DAS_prt_post_op(0);
 			DAS_pr("STI\n");
 			flagu8 |= IFSET8;
-			break;
-		case 0xfc:
+			intr_shadow = true;
+			NEXT_OP;
+		OPCASE(0xfc):
 			CLKS(CLK_CLD);
 			DAS_prt_post_op(0);
 			DAS_pr("CLD\n");
 			flagu8 &= ~DFSET8;
-			break;
-		case 0xfd:
+			NEXT_OP;
+		OPCASE(0xfd):
 			CLKS(CLK_STD);
 			DAS_prt_post_op(0);
 			DAS_pr("STD\n");
 			flagu8 |= DFSET8;
-			break;
+			NEXT_OP;
 
 /******************** INC/DEC/CALL/JMP/PUSH ********************/
 
-		case 0xfe:
-			modrm = mem->read8(get_seg_adr(CS, eip));
+		OPCASE(0xfe):
+			modrm = fetch8(eip);
 			subop = modrm >> 3 & 7;
 			DAS_prt_post_op(nr_disp_modrm(modrm) + 1);
 			DAS_pr("%s ", strfe[subop]);
@@ -4082,21 +5374,29 @@ s32 CPU::exec(void) {
 			default:
 				printf("xxxxx\n");
 			}
-			break;
+			NEXT_OP;
 
-		case 0xff: 
-			modrm = mem->read8(get_seg_adr(CS, eip));
+		OPCASE(0xff): 
+			modrm = fetch8(eip);
 			subop = modrm >> 3 & 7;
 			DAS_prt_post_op(nr_disp_modrm(modrm) + 1);
 			DAS_pr("%s ", strff[subop]);
 			DAS_modrm(modrm, false, true, word);
 			eip++;
 			switch (subop) {
-			case 0: // INC r/m16
-				INCDEC_RM(w, +);
+			case 0: // INC r/m16 (INC r/m32)
+				if (opsize == size16) {
+					INCDEC_RM(w, +);
+				} else {
+					INCDEC_RM(d, +);
+				}
 				break;
-			case 1: // DEC r/m16
-				INCDEC_RM(w, -);
+			case 1: // DEC r/m16 (DEC r/m32)
+				if (opsize == size16) {
+					INCDEC_RM(w, -);
+				} else {
+					INCDEC_RM(d, -);
+				}
 				break;
 			case 2: // CALL r/m16 (CALL r/m32) 絶対間接nearコール
 				if ((modrm & 0xc0) == 0xc0) {
@@ -4107,6 +5407,7 @@ s32 CPU::exec(void) {
 					PUSHW0(ip);
 					eip = mem->read16(tmpadr);
 				}
+				SAMPLE_CALL();
 				break;
 			case 3: // CALL m16:16 (CALL m16:32) 絶対間接farコール
 				if ((modrm & 0xc0) == 0xc0) {
@@ -4119,6 +5420,7 @@ s32 CPU::exec(void) {
 					PUSHW0(ip);
 					update_segreg(CS, warg2);
 					eip = warg1;
+					SAMPLE_CALL();
 				}
 				break;
 			case 4: // JMPL r/m16 (JMP r/m32) 絶対間接nearジャンプ
@@ -4148,38 +5450,33 @@ s32 CPU::exec(void) {
 			default:
 				printf("xxxxx\n");
 			}
-			break;
+			NEXT_OP;
 
-		default:
+		OPDEFAULT:
 			DAS_prt_post_op(0);
 			printf("xxxxxxxxxx\n");
+			TRACE_DUMP();
 		}
 
-		if (seg_ovride > 0) {
-			seg_ovride--;
-			// オーバーライドしたセグメントを元に戻す
-			if (seg_ovride == 0) {
-				update_segreg(DS, segreg[DS]);
-				update_segreg(SS, segreg[SS]);
-			}
-		}
-
-		// {オペランド|アドレス}サイズオーバーライドプリフィックスを
-		// 元に戻す
-		opsize_ovride = false;
-		addrsize_ovride = false;
-		repne_prefix = false;
-		repe_prefix = false;
-		opsize = isRealMode?
-			size16 : (sdcr[CS].attr & 0x400)?
-			size32 : size16;
-		addrsize = isRealMode?
-			size16 : (sdcr[CS].attr & 0x400)?
-			size32 : size16;
-#ifdef CORE_DAS
-		op_continue = false;
-#endif
+		OP_EPILOGUE();
 	}
 
 	return clks;
 }
+
+/*
+  実行モード(cpu_mode)に合わせて特殊化したインタプリタを呼ぶ
+  - モードが変わる命令(MOV CR0、CSのロード)を実行すると、
+    exec_mode()はその命令の後でリターンするので、次に呼ばれた時に
+    新しいモードのインタプリタに切り替わる
+ */
+s32 CPU::exec(void) {
+	switch (cpu_mode) {
+	case MODE_PM16:
+		return exec_mode<MODE_PM16>();
+	case MODE_PM32:
+		return exec_mode<MODE_PM32>();
+	default:
+		return exec_mode<MODE_RM16>();
+	}
+}
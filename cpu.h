@@ -1,7 +1,11 @@
 // [2019-06-20] 書き始め
 #include "types.h"
 #include "bus.h"
+#include "memory.h"
 #include "dmac.h"
+#include "pic.h"
+#include "trace.h"
+#include "profile.h"
 
 /*
   * 80386 General Registers
@@ -86,8 +90,12 @@ edi|                |        di       |
 // 高速化のためu8* genregb[8] = {&al, &cl, &dl, &bl, &ah, &ch, &dh, &bh};にする
 #endif
 
+class JIT;
+class Sampler;
+
 // とりあえず親クラスはなし
 class CPU {
+	friend class JIT;
 private:
 	union g_reg {
 		u32 reg32;
@@ -172,7 +180,16 @@ private:
 	struct _gdtr {
 		u16 limit;
 		u32 base;
-	} gdtr;
+	} gdtr, idtr;
+
+	/*
+	  タスクレジスタ
+	  - xxx タスクスイッチは未実装。割り込みで内側の特権レベルに移る時に
+	    TSSからスタック(SS:ESP)を得るのにだけ使う
+	 */
+	u16 tr;
+	u32 tr_base;
+	u8 tr_type; // 1, 3: 286TSS / 9, 11: 386TSS
 
 
 
@@ -206,6 +223,54 @@ private:
 		u8 d; // Default operation size
 	} sdcr[NR_SEGREG];
 
+	/*
+	  ディスクリプタキャッシュ
+	  - プロテクトモードのセグメントロードで、デコード済みのディスクリプタ
+	    (_sdcr)をセレクタで引く(ダイレクトマップ)。当たればコピーするだけ
+	  - タグはRPLを除いたセレクタなので、TIビットでGDTとLDTを区別できる
+	  - LGDTでdesc_genを進めて全エントリを無効にする
+	  - ディスクリプタのあるページは書き込みを監視し(Memory::watch_page())、
+	    ページの書き込み世代が変わっていたらエントリを使わない
+	  - ページをまたぐディスクリプタとホスト側のメモリにないディスクリプタ
+	    は登録しない
+	 */
+#define DESC_CACHE_SIZE 256
+	struct _desc_cache {
+		u16 sel; // RPLを除いたセレクタ
+		u32 gen; // 登録した時のdesc_gen (0は無効)
+		u32 page_gen; // 登録した時のディスクリプタのページの書き込み世代
+		struct _sdcr sd;
+	} desc_cache[DESC_CACHE_SIZE];
+	u32 desc_gen;
+
+	/*
+	  ゲートキャッシュ
+	  - プロテクトモードの割り込みで、デコード済みのIDTのゲートを
+	    ベクタ番号で引く
+	  - LIDTでidt_genを進めて全エントリを無効にする
+	  - ゲートのあるページの書き込みはディスクリプタキャッシュと同様に
+	    ページの書き込み世代で検出する
+	 */
+	struct _gate {
+		u32 gen; // 登録した時のidt_gen (0は無効)
+		u32 page_gen; // 登録した時のゲートのページの書き込み世代
+		u32 offset;
+		u16 sel;
+		u8 type; // 6, 7: 286割り込み/トラップゲート, 14, 15: 386
+		u8 dpl;
+	} gate_cache[256];
+	u32 idt_gen;
+
+	/*
+	  実効セグメント
+	  - DS, SSがデフォルトのメモリオペランドはeff_seg[DS], eff_seg[SS]の
+	    セグメントでアクセスする(オーバーライドがなければDS, SSのまま)
+	  - セグメントオーバーライドプリフィックスで書き換え、命令の終わりで
+	    元に戻す(ディスクリプタを読み直す必要はない)
+	  - スタック操作とストリング命令のES:[(E)DI]はオーバーライドされない
+	 */
+	SEGREG eff_seg[NR_SEGREG] = {ES, CS, SS, DS, FS, GS};
+
 // インストラクションポインタ
 #define eip ueip.ip32
 #define ip ueip.ip16.ip16l
@@ -262,13 +327,26 @@ private:
 #define IFSET8 0x02 // flagu8のIFをセットするための数
 #define DFSET8 0x04 // flagu8のDFをセットするための数
 #define OFSET8 0x08 // flagu8のOFをセットするための数
+#define NTSET8 0x40 // flagu8のNTをセットするための数
 	u8 flag8; // フラグの下位8ビット
 	u8 flagu8; // フラグの上位8ビット
 	u16 eflagsu16; // eflagsの上位16ビット
 	u8 flag_calb[0x200]; // 512バイト
-	u8 flag_calw[0x20000]; // 128Kバイト
 	u8 pflag_cal[0x100]; // 256バイト
 
+#ifdef LAZY_FLAGS
+	// 遅延フラグ評価 (cpu_macros.hのLF_SET(), LF_SYNC()参照)
+	enum {LF_NONE, LF_ADD, LF_SUB, LF_LOG, LF_INCDEC}; // lf_op
+	enum {LF_b, LF_w, LF_d}; // lf_size
+	u8 lf_op; // LF_NONEならflag8とflagu8のOFは確定している
+	u8 lf_size;
+	u8 lf_cry; // ADC/SBBのキャリー、INC/DECでは直前のCF
+	u32 lf_res, lf_src, lf_dst;
+
+	void lazy_flags(void);
+	u8 lazy_cf(void);
+#endif
+
 	u8 modrm_add_seg[2][3][8] = {
 		{{DS, DS, SS, SS, DS, DS, DS, DS},
 		 {DS, DS, SS, SS, DS, DS, SS, DS},
@@ -314,12 +392,117 @@ private:
 	SIZEPRFX opsize, addrsize;
 	bool isRealMode;
 
-	BUS *mem, *io;
+	/*
+	  実行モード
+	  - リアルモード、プロテクトモードの16bit/32bitセグメント(CSのDビット)
+	    ごとにexec_mode()を特殊化し、命令ごとのモード判定を省く
+	  - リアルモードのデフォルトは常に16bitなので3種類
+	 */
+	enum {MODE_RM16, MODE_PM16, MODE_PM32};
+	u8 cpu_mode;
+	void update_cpu_mode(void);
+	template <int MODE> s32 exec_mode(void);
+
+	Memory *mem;
+	BUS *io;
 	DMAC *dmac;
+	PIC *pic;
+
+	/*
+	  外部割り込み
+	  - intr_pendingはPICのINT出力。PICが状態の変わった時だけ書き換えるので、
+	    命令の境界ではこのフラグを見るだけでよい(INTR_CHECK())
+	  - STIの直後の1命令は割り込みを受け付けない(intr_shadow)
+	  - HLT中(halted)に受け付けたら、戻り先はHLTの次の命令にする
+	  - HLTで割り込みを受け付けられない間は、次のイベントまでクロックを
+	    進める(idle_clksに数える)
+	 */
+	u8 intr_pending;
+	bool intr_shadow;
+	bool halted;
+	u64 idle_clks;
+	void intr(void);
+	struct _gate *get_gate(u8 n);
+	void interrupt(u8 n, u8 len, s32 err = -1);
+	void iret(void);
+
+	/*
+	  ビジーウェイトの検出
+	  - 短い後方分岐(SPIN_BODY_MAXバイト以内)が成立した時に、ループ本体が
+	    メモリにもI/Oにも書かない命令(IN, MOV AL/eAX,moffs, TEST/CMP/AND
+	    AL/eAX,imm, DEC r, NOP/PAUSE)と最後の分岐だけなら、前回の分岐の
+	    時のレジスタと比べる
+	  - 変化がなければ、イベントか割り込みが何かを変えるまで同じことを
+	    繰り返すだけなので、exit_clksを超えない回数分のクロックを引いて
+	    飛ばす
+	  - 1つのレジスタ(DEC rかLOOPのカウンタ)だけが1減っていれば、
+	    下位16ビットが0になる手前までの回数分、レジスタとクロックを進める
+	  - 飛ばす回数は1回分のクロック(前回の分岐からのclksの差)で割って
+	    求め、最後の1回は実行するので、どの命令の位置でexecから戻るかは
+	    1命令ずつ実行した場合と変わらない
+	  - 分岐が成立しなかった時(ループを抜けた)、割り込み、execの先頭では
+	    前回の状態(valid)を捨てる
+	  - ループのあるページの世代が進んだら、Memoryからの通知
+	    (spin_gen_hook())で判定し直す
+	 */
+#define SPIN_BODY_MAX 16
+	struct _spin {
+		u32 head; // ループの先頭のリニアアドレス
+		u8 len; // ループ本体のバイト数 (分岐命令を含む)
+		bool ok; // 飛ばせるループか
+		s8 counter; // カウンタのレジスタ (-1ならなし)
+		bool valid; // reg, clksが前回の分岐の時のものか
+		u32 reg[8];
+		s32 clks;
+	} spin;
+	static void spin_gen_hook(void *arg, u32 page);
+	bool spin_decode(const u8 *p, u8 len);
+	void spin_check(s8 rel);
+
+	/*
+	  命令キャッシュ
+	  - 命令の先頭のリニアアドレスで引くダイレクトマップ
+	  - 命令長はオペランド/アドレスサイズで変わるので、モードも一致した
+	    場合だけヒットとする
+	  - 登録時のページの書き込み世代を持っておき、ページに書き込みが
+	    あった(世代が進んだ)エントリは使わない(自己書き換え対策)
+	  - ページをまたぐ命令、ホスト側のメモリにない命令、解釈できない命令は
+	    登録せず、従来通りメモリからフェッチする
+	 */
+#define ICACHE_SIZE 4096
+#define ICACHE_MAX_LEN 15 // 386の命令長の最大値
+	struct _icache {
+		u32 adr; // 命令の先頭のリニアアドレス
+		u32 gen; // 登録時のページの書き込み世代
+		u8 mode; // opsize | addrsize << 1 | isRealMode << 2
+		u8 len; // 命令長 (0なら無効)
+		u8 bytes[ICACHE_MAX_LEN];
+	} icache[ICACHE_SIZE];
+	// 実行中の命令
+	u32 ic_eip; // 命令の先頭のeip
+	u32 ic_len; // キャッシュされたバイト数 (0ならキャッシュなし)
+	u8 *ic_bytes;
+
+	void icache_lookup(void);
+
+#ifdef USE_JIT
+	JIT *jit;
+	bool jit_enabled;
+#endif
+	u8 insn_len(const u8 *p, u32 n);
+	inline u8 fetch8(u32 a);
+	inline u16 fetch16(u32 a);
+	inline u32 fetch32(u32 a);
 
 	u32 get_seg_adr(const SEGREG seg, const u32 a);
 	void update_segreg(const u8 seg, const u16 n);
 
+	// MOVS/STOS/CMPS/SCASの一括処理
+	u32 string_todo(u32 clk, u32 cnt);
+	u32 string_movs(u8 size, u32 cnt);
+	u32 string_stos(u8 size, u32 cnt);
+	u32 string_cmps(u8 size, u32 cnt, bool scas, bool &stop);
+
 #ifdef CORE_DAS
 	bool DAS_hlt;
 	bool op_continue = false;
@@ -328,6 +511,14 @@ private:
 	void DAS_prt_post_op(u8 n);
 	void DAS_modrm(u8 modrm, bool isReg, bool isDest, REGSIZE regsize);
 #endif
+	Trace *trace; // NULLならトレースしない
+	void trace_insn(void);
+	Sampler *sampler; // NULLならコールを追跡しない
+	u64 insns; // 実行した命令数 (プリフィックスは命令に含める)
+#ifdef OP_PROFILE
+	OpProfile prof;
+#endif
+
 	u8 nr_disp_modrm(u8 modrm);
 	u16 modrm16_ea(u8 modrm);
 	u32 modrm32_ea(u8 modrm);
@@ -341,6 +532,21 @@ public:
 	CPU(BUS* bus);
 	void reset();
 	s32 exec(void);
+	void set_trace(Trace *t) {
+		trace = t;
+		mem->set_write_log(t? Trace::log_write : NULL, t);
+	}
+	void set_sampler(Sampler *s) { sampler = s; }
+	// 実行中の命令のリニアアドレス
+	u32 get_pc(void) { return sdcr[CS].base + (isRealMode? ip : eip); }
+	u64 get_idle_clks(void) { return idle_clks; }
+	u64 get_insns(void) { return insns; }
+#ifdef OP_PROFILE
+	void report_profile(void) { prof.report(); }
+#endif
+#ifdef USE_JIT
+	void set_jit(bool on) { jit_enabled = on; }
+#endif
 };
 
 /* 参考文献
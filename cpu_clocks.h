@@ -56,6 +56,10 @@
 #define CLK_INTO_OF0		3
 #define CLK_INTO_OF1		35 
 #define CLK_IRET		22 
+#define CLK_PM_INT		59 // 同じ特権レベル
+#define CLK_PM_INT_PRIV		99 // 内側の特権レベル
+#define CLK_PM_IRET		38 // 同じ特権レベル
+#define CLK_PM_IRET_PRIV	82 // 外側の特権レベル
 
 #define CLK_LDS			7
 #define CLK_PM_LDS		22
@@ -66,6 +70,9 @@
 
 #define CLK_LGDT_LIDT		11
 
+#define CLK_LTR			23
+#define CLK_STR			23
+
 #define CLK_LOCK		0
 
 #define CLK_MOV_RM_R		2
@@ -1,6 +1,12 @@
 #define readb read8
 #define readw read16
 #define readd read32
+#define fetchb fetch8
+#define fetchw fetch16
+#define fetchd fetch32
+// 符号拡張するimm8 (0x83用)
+#define fetchbw(a) ((u16)(s8)fetch8(a))
+#define fetchbd(a) ((u32)(s8)fetch8(a))
 #define writeb write8
 #define writew write16
 #define writed write32
@@ -13,11 +19,19 @@
 #define wCAST u16
 #define dCAST u32
 
-#define bALLF 0xff
-#define wALLF 0xffff
+/*
+  ワード同士の演算によるフラグSF/ZF/PF/CF
+  (以前はflag_calw[0x20000]の表を引いていたが、128Kバイトもあり
+   キャッシュを汚すので、PFだけ表を引いて残りはその都度求める)
+  xは17ビット(CFの算出のため)
+ */
+#define FLAG_CALb(x) flag_calb[x]
+#define FLAG_CALw(x)						\
+	(pflag_cal[(x) & 0xff] | (((x) & 0xffff)? 0 : ZF)	\
+	 | ((x) >> 8 & SF) | ((x) >> 16 & CF))
 
-#define bMSB1 0x80
-#define wMSB1 0x8000
+#ifndef LAZY_FLAGS
+#define LF_SYNC()
 
 // OverFlag
 #define OF_ADDb(r, s, d)			\
@@ -58,7 +72,7 @@
 	flag8 |= (d ^ s ^ r) & AF;
 
 #define FLAG8w(r, s, d, ANDN, CRY)	\
-	flag8 = flag_calw[r ANDN];	\
+	flag8 = FLAG_CALw(r ANDN);	\
 	flag8 |= (d ^ s ^ r) & AF;
 
 #define FLAG8bADD(r, s, d, CRY) FLAG8b(r, s, d, , )
@@ -97,13 +111,76 @@
 	/* CF */						\
 	flag8 |= ((r >> 1) + (s >> 1) + (((r & 1) + (s & 1) + (CRY & 1)) >> 1)) >> 31;
 
+#else // LAZY_FLAGS
+/*
+  遅延フラグ評価
+  - 演算命令はフラグを求めずに、演算の種類とオペランド、結果を記録する
+    だけにする (LF_SET)
+  - フラグを参照する命令(Jcc, PUSHF, ADC/SBB, LAHF, INT, IRETなど)や、
+    フラグの一部だけを書き換える命令の直前でLF_SYNC()を呼び、
+    flag8とflagu8のOFを求める
+  - flag8やflagu8のOFを直接読み書きする前には必ずLF_SYNC()すること
+ */
+#define LF_SYNC()				\
+	if (lf_op != LF_NONE) {			\
+		lazy_flags();			\
+	}
+
+// 現在のCFを求める(LF_SYNC()はしない)
+#define LF_CF ((lf_op != LF_NONE)? lazy_cf() : (flag8 & CF))
+
+#define LF_SET(OP, SIZE, r, s, d, cry)	\
+	lf_op = OP;			\
+	lf_size = SIZE;			\
+	lf_res = r;			\
+	lf_src = s;			\
+	lf_dst = d;			\
+	lf_cry = cry
+
+// ADC/SBBの直前にはLF_SYNC()しているので、flag8のCFがそのまま使える
+#define FLAG8bADD(r, s, d, CRY) LF_SET(LF_ADD, LF_b, r, s, d, 0)
+#define FLAG8bADC(r, s, d, CRY) LF_SET(LF_ADD, LF_b, r, s, d, flag8 & CF)
+#define FLAG8bSUB(r, s, d, CRY) LF_SET(LF_SUB, LF_b, r, s, d, 0)
+#define FLAG8bSBB(r, s, d, CRY) LF_SET(LF_SUB, LF_b, r, s, d, flag8 & CF)
+#define FLAG8wADD(r, s, d, CRY) LF_SET(LF_ADD, LF_w, r, s, d, 0)
+#define FLAG8wADC(r, s, d, CRY) LF_SET(LF_ADD, LF_w, r, s, d, flag8 & CF)
+#define FLAG8wSUB(r, s, d, CRY) LF_SET(LF_SUB, LF_w, r, s, d, 0)
+#define FLAG8wSBB(r, s, d, CRY) LF_SET(LF_SUB, LF_w, r, s, d, flag8 & CF)
+#define FLAG8dADD(r, s, d, CRY) LF_SET(LF_ADD, LF_d, r, s, d, 0)
+#define FLAG8dADC(r, s, d, CRY) LF_SET(LF_ADD, LF_d, r, s, d, flag8 & CF)
+#define FLAG8dSUB(r, s, d, CRY) LF_SET(LF_SUB, LF_d, r, s, d, 0)
+#define FLAG8dSBB(r, s, d, CRY) LF_SET(LF_SUB, LF_d, r, s, d, flag8 & CF)
+
+// OFもlazy_flags()で求める
+#define OF_ADDb(r, s, d)
+#define OF_ADDw(r, s, d)
+#define OF_ADDd(r, s, d)
+#define OF_ADCb(r, s, d)
+#define OF_ADCw(r, s, d)
+#define OF_ADCd(r, s, d)
+#define OF_SUBb(r, s, d)
+#define OF_SUBw(r, s, d)
+#define OF_SUBd(r, s, d)
+#define OF_SBBb(r, s, d)
+#define OF_SBBw(r, s, d)
+#define OF_SBBd(r, s, d)
+
+#endif // LAZY_FLAGS
+
 #define OPADD +
 #define OPADC +
 #define OPSUB -
 #define OPSBB -
 
+// キャリーを使う演算の前だけフラグを確定させる
+#define LF_SYNC_ADD()
+#define LF_SYNC_ADC() LF_SYNC()
+#define LF_SYNC_SUB()
+#define LF_SYNC_SBB() LF_SYNC()
+
 #define CAL_RM_R(STR, BWD, CRY)				\
-	modrm = mem->read8(get_seg_adr(CS, eip));	\
+	LF_SYNC_##STR();				\
+	modrm = fetch8(eip);				\
 	DAS_prt_post_op(nr_disp_modrm(modrm) + 1);	\
 	DAS_pr(#STR" ");				\
 	DAS_modrm(modrm, true, false, BWD##word);	\
@@ -125,7 +202,8 @@
 	OF_##STR##BWD(res, src, dst);
 
 #define CAL_R_RM(STR, BWD, CRY)					\
-	modrm = mem->read8(get_seg_adr(CS, eip));		\
+	LF_SYNC_##STR();					\
+	modrm = fetch8(eip);					\
 	DAS_prt_post_op(nr_disp_modrm(modrm) + 1);		\
 	DAS_pr(#STR" ");					\
 	DAS_modrm(modrm, true, true, BWD##word);		\
@@ -145,21 +223,27 @@
 
 /******************** ADD ********************/
 
+#ifndef LAZY_FLAGS
 #define FLAG_LOGOPb(d)		\
 	flag8 = flag_calb[d];	\
 	flagu8 &= ~OFSET8;
 #define FLAG_LOGOPw(d)		\
-	flag8 = flag_calw[d];	\
+	flag8 = FLAG_CALw(d);	\
 	flagu8 &= ~OFSET8;
 #define FLAG_LOGOPd(d)				\
 	flag8 = pflag_cal[d & 0xff];		\
 	flag8 |= (d == 0)? ZF : 0;		\
 	flag8 |= (d & 0x80000000)? SF : 0;	\
 	flagu8 &= ~OFSET8;
+#else
+#define FLAG_LOGOPb(d) LF_SET(LF_LOG, LF_b, d, 0, 0, 0)
+#define FLAG_LOGOPw(d) LF_SET(LF_LOG, LF_w, d, 0, 0, 0)
+#define FLAG_LOGOPd(d) LF_SET(LF_LOG, LF_d, d, 0, 0, 0)
+#endif
 
 // LOGical OPeration (OP r, r/m)
 #define LOGOP_R_RM(OP, STR, BWD)				\
-	modrm = mem->read8(get_seg_adr(CS, eip));		\
+	modrm = fetch8(eip);					\
 	DAS_prt_post_op(nr_disp_modrm(modrm) + 1);		\
 	DAS_pr(#STR" ");					\
 	DAS_modrm(modrm, true, true, BWD##word);		\
@@ -178,7 +262,7 @@
 
 // LOGical OPeration (OP r/m, r)
 #define LOGOP_RM_R(OP, STR, BWD)			\
-	modrm = mem->read8(get_seg_adr(CS, eip));	\
+	modrm = fetch8(eip);				\
 	DAS_prt_post_op(nr_disp_modrm(modrm) + 1);	\
 	DAS_pr(#STR" ");				\
 	DAS_modrm(modrm, true, false, BWD##word);	\
@@ -288,7 +372,7 @@
 /******************** CMP ********************/
 
 #define CMP_R_RM(BWD)					\
-	modrm = mem->read8(get_seg_adr(CS, eip));	\
+	modrm = fetch8(eip);				\
 	DAS_prt_post_op(nr_disp_modrm(modrm) + 1);	\
 	DAS_pr("CMP ");					\
 	DAS_modrm(modrm, true, true, BWD##word);	\
@@ -306,7 +390,7 @@
 	OF_SUB##BWD(res, src, dst)
 
 #define CMP_RM_R(BWD)					\
-	modrm = mem->read8(get_seg_adr(CS, eip));	\
+	modrm = fetch8(eip);				\
 	DAS_prt_post_op(nr_disp_modrm(modrm) + 1);	\
 	DAS_pr("CMP ");					\
 	DAS_modrm(modrm, true, false, BWD##word);	\
@@ -328,60 +412,72 @@
 
 /******************** INC ********************/
 
-// xxx OFの計算がNP2と違う
+/*
+  INC/DECのフラグ (CFは変化しない)
+  xxx OFの計算がNP2と違う
+ */
+#ifndef LAZY_FLAGS
+#define FLAG_INCDECb(r, d)				\
+	flag8 &= CF; /* CF以外はリセット*/		\
+	flag8 |= flag_calb[r & 0xff];			\
+	flag8 |= (d ^ r) & AF;				\
+	(d ^ r) & 0x80?flagu8 |= OFSET8:flagu8 &= ~OFSET8
+#define FLAG_INCDECw(r, d)				\
+	flag8 &= CF; /* CF以外はリセット*/		\
+	flag8 |= FLAG_CALw(r & 0xffff);			\
+	flag8 |= (d ^ r) & AF;				\
+	(d ^ r) & 0x8000?flagu8 |= OFSET8:flagu8 &= ~OFSET8
+#define FLAG_INCDECd(r, d)					\
+	flag8 &= CF; /* CF以外はリセット*/			\
+	flag8 |= pflag_cal[r & 0xff]; /* ここが|=なのでFLAG8dALL()は使えない */ \
+	flag8 |= (r == 0)? ZF : 0;				\
+	flag8 |= (r & 0x80000000)? SF : 0;			\
+	flag8 |= (d ^ r) & AF;					\
+	(d ^ r) & 0x80000000?flagu8 |= OFSET8:flagu8 &= ~OFSET8
+#else
+// CFは変化しないので、直前のCFをlf_cryに覚えておく
+#define FLAG_INCDECb(r, d) lf_cry = LF_CF; LF_SET(LF_INCDEC, LF_b, r, 1, d, lf_cry)
+#define FLAG_INCDECw(r, d) lf_cry = LF_CF; LF_SET(LF_INCDEC, LF_w, r, 1, d, lf_cry)
+#define FLAG_INCDECd(r, d) lf_cry = LF_CF; LF_SET(LF_INCDEC, LF_d, r, 1, d, lf_cry)
+#endif
+
 #define INC_R16(reg)						\
 	DAS_prt_post_op(0);					\
 	DAS_pr("INC %s\n", #reg);				\
 	dst = reg;						\
 	reg++;							\
-	flag8 &= CF; /* CF以外はリセット*/			\
-	flag8 |= flag_calw[reg];				\
-	flag8 |= (dst ^ reg) & AF;				\
-	(dst ^ reg) & 0x8000?flagu8 |= OFSET8:flagu8 &= ~OFSET8
+	FLAG_INCDECw(reg, dst)
 
 #define INC_R32(reg)						\
 	DAS_prt_post_op(0);					\
 	DAS_pr("INC %s\n", #reg);				\
 	dst = reg;						\
 	reg++;							\
-	flag8 &= CF; /* CF以外はリセット*/			\
-	flag8 |= pflag_cal[reg & 0xff];				\
-	flag8 |= (reg == 0)? ZF : 0;				\
-	flag8 |= (eax & 0x80000000)? SF : 0;			\
-	flag8 |= (dst ^ reg) & AF;				\
-	(dst ^ reg) & 0x80000000?flagu8 |= OFSET8:flagu8 &= ~OFSET8
+	FLAG_INCDECd(reg, dst)
 
 /******************** DEC ********************/
 
-// xxx OFの計算がNP2と違う
 #define DEC_R16(reg)						\
 	DAS_prt_post_op(0);					\
 	DAS_pr("DEC %s\n", #reg);				\
 	dst = reg;						\
 	reg--;							\
-	flag8 &= CF; /* CF以外はリセット*/			\
-	flag8 |= flag_calw[reg];				\
-	flag8 |= (dst ^ reg) & AF;				\
-	(dst ^ reg) & 0x8000?flagu8 |= OFSET8:flagu8 &= ~OFSET8
+	FLAG_INCDECw(reg, dst)
 
 #define DEC_R32(reg)						\
 	DAS_prt_post_op(0);					\
 	DAS_pr("DEC %s\n", #reg);				\
 	dst = reg;						\
 	reg--;							\
-	flag8 &= CF; /* CF以外はリセット*/			\
-	flag8 |= pflag_cal[reg & 0xff]; /* ここが|=なのでFLAG8dALL()は使えない */ \
-	flag8 |= (reg == 0)? ZF : 0;				\
-	flag8 |= (eax & 0x80000000)? SF : 0;			\
-	flag8 |= (dst ^ reg) & AF;				\
-	(dst ^ reg) & 0x80000000?flagu8 |= OFSET8:flagu8 &= ~OFSET8
+	FLAG_INCDECd(reg, dst)
 
 /******************** Jcc ********************/
 
 #define JCCWD(STR, COND)					\
+	LF_SYNC();						\
 	if (opsize == size16) {					\
 		DAS_prt_post_op(3);				\
-		dst = mem->read16(get_seg_adr(CS, ++eip));	\
+		dst = fetch16(++eip);				\
 		DAS_pr(#STR" 0x%04x\n", dst);			\
 		if (COND) {			   		\
 			eip += (s16)(dst + 2);			\
@@ -390,7 +486,7 @@
 		}						\
 	} else {						\
 		DAS_prt_post_op(5);				\
-		dst = mem->read32(get_seg_adr(CS, ++eip));	\
+		dst = fetch32(++eip);				\
 		DAS_pr(#STR" 0x%08x\n", dst);			\
 		if (COND) {			   		\
 			eip += (s32)(dst + 4);			\
@@ -401,13 +497,16 @@
 
 
 #define JCC(STR, COND)				\
+	LF_SYNC();				\
 	DAS_prt_post_op(1);			\
-	dst = mem->read8(get_seg_adr(CS, eip));	\
+	dst = fetch8(eip);			\
 	DAS_pr(#STR" 0x%02x\n", dst);		\
 	if (COND) {			   	\
 		eip += (s8)dst + 1;		\
+		SPIN_TAKEN(dst);		\
 	} else {				\
 		eip++;				\
+		SPIN_EXIT(dst);			\
 	}
 
 /******************** ADD/OR/ADC/SBB/AND/SUB/XOR/CMP ********************/
@@ -415,20 +514,23 @@
 #define IPINCb 1
 #define IPINCw 2
 #define IPINCd 4
+#define IPINCbw 1
+#define IPINCbd 1
 
 #define CAL_RM_IM(BWD, BWD2, STR, CAST, CRY)			\
+	LF_SYNC_##STR();					\
 	eip++;							\
 	if ((modrm & 0xc0) == 0xc0) {				\
 		CLKS(CLK_CAL_R_IMM);				\
 		dst = genreg##BWD(modrm & 7);			\
-		src = mem->read##BWD2(get_seg_adr(CS, eip));	\
+		src = fetch##BWD2(eip);				\
 		res = dst OP##STR src + CRY;			\
 		genreg##BWD(modrm & 7) = (CAST)res;		\
 	} else {						\
 		CLKS(CLK_CAL_MEM_IMM);				\
 		tmpadr = modrm_seg_ea(modrm);			\
 		dst = mem->read##BWD(tmpadr);			\
-		src = mem->read##BWD2(get_seg_adr(CS, eip));	\
+		src = fetch##BWD2(eip);				\
 		res = dst OP##STR src + CRY;			\
 		mem->write##BWD(tmpadr, (CAST)res);		\
 	}						       	\
@@ -440,13 +542,13 @@
 	eip++;							\
 	if ((modrm & 0xc0) == 0xc0) {				\
 		dst = genreg##BWD(modrm & 7);			\
-		src = mem->read##BWD2(get_seg_adr(CS, eip));	\
+		src = fetch##BWD2(eip);				\
 		dst OP##= src;					\
 		genreg##BWD(modrm & 7) = dst;			\
 	} else {						\
 		tmpadr = modrm_seg_ea(modrm);			\
 		dst = mem->read##BWD(tmpadr);			\
-		src = mem->read##BWD2(get_seg_adr(CS, eip));	\
+		src = fetch##BWD2(eip);				\
 		dst OP##= src;					\
 		mem->write##BWD(tmpadr, dst);			\
 	}							\
@@ -457,12 +559,12 @@
 	eip++;							\
 	if ((modrm & 0xc0) == 0xc0) {				\
 		dst = genreg##BWD(modrm & 7);			\
-		src = mem->read##BWD2(get_seg_adr(CS, eip));	\
+		src = fetch##BWD2(eip);				\
 		res = dst - src;				\
 	} else {						\
 		tmpadr = modrm_seg_ea(modrm);			\
 		dst = mem->read##BWD(tmpadr);			\
-		src = mem->read##BWD2(get_seg_adr(CS, eip));	\
+		src = fetch##BWD2(eip);				\
 		res = dst - src;				\
 	}							\
 	eip += IPINC##BWD2;					\
@@ -472,7 +574,7 @@
 /******************** XCHG ********************/
 
 #define XCHG_R_RM(BWD)						\
-	modrm = mem->read8(get_seg_adr(CS, eip));		\
+	modrm = fetch8(eip);					\
 	DAS_prt_post_op(nr_disp_modrm(modrm) + 1);		\
 	DAS_pr("XCHG ");					\
 	DAS_modrm(modrm, true, true, BWD##word);		\
@@ -493,7 +595,7 @@
 /******************** TEST ********************/
 
 #define TEST_RM_R(BWD)						\
-	modrm = mem->read8(get_seg_adr(CS, eip));		\
+	modrm = fetch8(eip);					\
 	DAS_prt_post_op(nr_disp_modrm(modrm) + 1);		\
 	DAS_pr("TEST ");					\
 	DAS_modrm(modrm, true, false, BWD##word);		\
@@ -530,6 +632,7 @@
 #define DorR_R res
 
 #define ROT_RM(OP, BWD, DIR, CNT, FUNC)					\
+	LF_SYNC();							\
 	eip++;								\
 	if ((modrm & 0xc0) == 0xc0) {					\
 		CLKS(CLK_##OP##_R);					\
@@ -562,7 +665,7 @@
 #define MSBd 0x80000000
 
 #define FLAG8bSALSHL(r, cnt) flag8 = flag_calb[r & 0x1ff]
-#define FLAG8wSALSHL(r, cnt) flag8 = flag_calw[r & 0x1ffff]
+#define FLAG8wSALSHL(r, cnt) flag8 = FLAG_CALw(r & 0x1ffff)
 #define FLAG8dSALSHL(r, cnt)			\
 	flag8 = pflag_cal[r & 0xff];		\
 	flag8 |= (r == 0)? ZF : 0;		\
@@ -571,6 +674,7 @@
 	flag8 |= dst >> (cnt - 1) & 1;
 
 #define SFT_SALSHL(BWD, CNT)					\
+	LF_SYNC();						\
 	eip++;							\
 	if ((modrm & 0xc0) == 0xc0) {				\
 		CLKS(CLK_SALSHL_R);				\
@@ -595,13 +699,14 @@
 	}
 
 #define FLAG8bSHRSAR(r) flag8 = flag_calb[r]
-#define FLAG8wSHRSAR(r) flag8 = flag_calw[r]
+#define FLAG8wSHRSAR(r) flag8 = FLAG_CALw(r)
 #define FLAG8dSHRSAR(r)				\
 	flag8 = pflag_cal[r & 0xff];		\
 	flag8 |= (r == 0)? ZF : 0;		\
 	flag8 |= (r & 0x80000000)? SF : 0;
 
 #define SFT_SHR(BWD, CNT)					\
+	LF_SYNC();						\
 	eip++;							\
 	if ((modrm & 0xc0) == 0xc0) {				\
 		CLKS(CLK_SHR_R);				\
@@ -627,6 +732,7 @@
 	}
 
 #define SFT_SAR(BWD, CNT)					\
+	LF_SYNC();						\
 	eip++;							\
 	if ((modrm & 0xc0) == 0xc0) {				\
 		CLKS(CLK_SAR_R);				\
@@ -659,7 +765,7 @@
 /******************** LES/LDS ********************/
 
 #define LxS(STR, seg)							\
-	modrm = mem->read8(get_seg_adr(CS, eip));			\
+	modrm = fetch8(eip);						\
 	DAS_prt_post_op(nr_disp_modrm(modrm) + 1);			\
 	DAS_pr(#STR" ");						\
 	eip++;								\
@@ -678,8 +784,8 @@
 	DAS_prt_post_op(0);						\
 	DAS_pr("SEG="#SEG"\n");						\
 		seg_ovride++;						\
-		sdcr[DS].base = sdcr[SEG].base;				\
-		sdcr[SS].base = sdcr[SEG].base;				\
+		eff_seg[DS] = SEG;					\
+		eff_seg[SS] = SEG;					\
 		if (seg_ovride >= 8) { /* xxx ここら辺の情報不足*/	\
 			/* xxx ソフトウェア例外 */ 			\
 		}
@@ -699,8 +805,4 @@
 		res = dst OP 1;					\
 		mem->write##BWD(tmpadr, (BWD##CAST)res);	\
 	}							\
-	flag8 &= CF; /* CF以外はリセット*/			\
-	flag8 |= flag_cal##BWD[res & BWD##ALLF];		\
-	flag8 |= (dst ^ res) & AF;				\
-	(dst ^ res) & BWD##MSB1?				\
-		flagu8 |= OFSET8:flagu8 &= ~OFSET8;
+	FLAG_INCDEC##BWD(res, dst);
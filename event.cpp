@@ -1,79 +1,63 @@
 #include <cstdlib> // for malloc()
-#include <cstdio> // for printf()
 #include "event.h"
 #include "cpu.h"
 
 Event::Event(CPU *cpu) {
 	this->cpu = cpu;
+	head = NULL;
+	last_clks = 0;
 }
+
 void Event::add(s32 clks, void (*func)()) {
-	struct _event *event, *prev, *next, *last, *tmp;
+	struct _event *event, **pp;
+
 	event = (struct _event *)malloc(sizeof(struct _event));
-	if (head != NULL) {
-		for (tmp = head; tmp != NULL; last = tmp, tmp = tmp->next) {
-			if (clks < tmp->fired_clks) {
-				event->prev = tmp->prev;
-				tmp->prev = event;
-				event->next = tmp;
-				break;
-			}
-		}
-		if (tmp == NULL) {
-			event->prev = last;
-			last->next = event;
-			event->next = NULL;
-		}
-	} else {
-		head = event;
-	}
-	event->now_clks = cpu->clks;
 	event->fired_clks = cpu->clks - clks;
-	cpu->exit_clks = event->fired_clks < 0? 0 : cpu->clks - clks;
-	prev = event->prev;
-	if (prev) {
-		event->delta_clks = prev->fired_clks - event->fired_clks;
+	event->func = func;
+	// 同じ時刻のイベントは登録した順に発火する
+	for (pp = &head; *pp != NULL; pp = &(*pp)->next) {
+		if ((*pp)->fired_clks < event->fired_clks) {
+			break;
+		}
 	}
-	next = event->next;
-	if (next) {
-		next->delta_clks = event->fired_clks - next->fired_clks;
+	event->next = *pp;
+	*pp = event;
+	set_exit_clks();
+}
+
+// 先頭のイベントの時刻でexec()から戻らせる
+void Event::set_exit_clks(void) {
+	if (head == NULL || head->fired_clks < 0) {
+		cpu->exit_clks = 0;
+	} else {
+		cpu->exit_clks = head->fired_clks;
 	}
 }
 
+// スライスの始めに増えた分だけ、イベントの時刻をずらす
 void Event::check0(void) {
-	if (head == NULL) {
-		return;
-	}
-	if (head->fired_clks < 0) {
-		head->fired_clks += cpu->remains_clks;
-		if (head->fired_clks < 0) {
-			return;
+	s32 delta = cpu->remains_clks - last_clks;
+
+	if (delta != 0) {
+		for (struct _event *event = head; event != NULL;
+		     event = event->next) {
+			event->fired_clks += delta;
 		}
-		cpu->exit_clks = head->fired_clks;
-		return;
+		last_clks = cpu->remains_clks;
 	}
-	printf("xxx check0()\n");
+	set_exit_clks();
 }
 
 void Event::check(void) {
 	struct _event *event;
-	if (head == NULL) {
-		return;
-	}
-	for (event = head; event != NULL; event = event->next) {
-		if (event->fired_clks > 0 && cpu->clks <= event->fired_clks) {
-			(*event->func)();
-			// リストから外す		
-			if (event->prev) {
-				event->prev->next = event->next;
-			} else {
-				head = event->next;
-			}
-			if (event->next) {
-				event->next->prev = event->prev;
-			}
-			free(event);
-		} else {
-			break;
-		}
+
+	// 関数の中でadd()されてもいいように、リストから外してから呼ぶ
+	while (head != NULL && cpu->remains_clks <= head->fired_clks) {
+		event = head;
+		head = event->next;
+		(*event->func)();
+		free(event);
 	}
+	last_clks = cpu->remains_clks;
+	set_exit_clks();
 }
@@ -2,18 +2,26 @@
 
 class CPU;
 
+/*
+  イベント
+  - add()でclksクロック後に呼ぶ関数を登録する。登録したイベントは
+    発火する順(fired_clksの大きい順)にリストに並べる
+  - fired_clksはCPU::clksと同じ数え方(減っていく)で、先頭のイベントの
+    fired_clksをCPU::exit_clksにして、そこでexec()から戻らせる
+  - スライスの始めにremains_clksが増えた分は、check0()で全イベントの
+    fired_clksに足す
+ */
 class Event {
 private:
 	struct _event {
-		struct _event *prev;
 		struct _event *next;
-		s32 now_clks;
 		s32 fired_clks;
-		s32 delta_clks;
 		void (*func)();
 	};
 	struct _event *head;
+	s32 last_clks; // 前回のcheck0()/check()の時のremains_clks
 	CPU *cpu;
+	void set_exit_clks(void);
 public:
 	Event(CPU* cpu);
 	void add(s32 clks, void (*func)());
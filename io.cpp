@@ -2,6 +2,7 @@
 #include <cstdio> // for printf()
 #include <fstream>
 #include "io.h"
+#include "memory.h"
 
 /*-----
   xxx *.cppにはusing namespace hoge;ではなくてnamespace hoge {}を使う?
@@ -20,7 +21,7 @@ IO::IO(u32 size) {
 	// SRAM読み込み(UNZ互換)
 	std::ifstream fin("cmos.dat", std::ios::in | std::ios::binary);
 	if (!fin) {
-		printf("can't open cmos.dat");
+		printf("can't open cmos.dat\n");
 		goto end;
 	}
 	fin.read((char *)buf, 0x800);
@@ -30,14 +31,29 @@ IO::IO(u32 size) {
 		iop[0x3000 + i * 2] = buf[i];
 	}
 end:
+	// I/O 0x404, 0x480の初期値でメモリのページマップを作り直す
+	if (mem) {
+		((Memory *)mem)->update_page_map();
+	}
 	return;
 }
+
+// メモリのバンク切り替え(I/O 0x404, 0x480)に書き込んだか
+static bool is_bank_port(u32 addr, u32 len) {
+	return (addr <= 0x404 && 0x404 < addr + len)
+		|| (addr <= 0x480 && 0x480 < addr + len);
+}
+
 u8 IO::read8(u32 addr) {
   //	if (addr != 0x480 && (addr < 0x3000 || addr >= 0x4000)) {
 	if (addr >= 0x4c0 && addr < 0x4d0) {
 		printf("io r 0x%x\n", addr);
 	}
 
+	// 割り込みコントローラ (マスタ 0x00, 0x02 スレーブ 0x10, 0x12)
+	if (pic && (addr & ~0x12) == 0) {
+		return pic->read8(addr);
+	}
 	if (addr >= 0xa0 && addr < 0xb0) {
 		return dmac->read8(addr);
 	}
@@ -69,7 +85,14 @@ void IO::write8(u32 addr, u8 data) {
 	if (addr >= 0x4c0 && addr < 0x4d0) {
 		printf("io w 0x%x(0x%x)\n", addr, data);
 	}
+	if (pic && (addr & ~0x12) == 0) {
+		pic->write8(addr, data);
+		return;
+	}
 	*(iop + addr) = data;
+	if (is_bank_port(addr, 1)) {
+		((Memory *)mem)->update_page_map();
+	}
 }
 
 u16 IO::read16(u32 addr) {
@@ -79,6 +102,9 @@ u16 IO::read16(u32 addr) {
 void IO::write16(u32 addr, u16 data) {
 	*(iop + addr) = data & 0xff;
 	*(iop + addr + 1) = data >> 8;
+	if (is_bank_port(addr, 2)) {
+		((Memory *)mem)->update_page_map();
+	}
 }
 
 u32 IO::read32(u32 addr)
@@ -92,6 +118,9 @@ void IO::write32(u32 addr, u32 data)
 	*(iop + addr + 1) = data >> 8;
 	*(iop + addr + 2) = data >> 16;
 	*(iop + addr + 3) = data >> 24;
+	if (is_bank_port(addr, 4)) {
+		((Memory *)mem)->update_page_map();
+	}
 }
 
 
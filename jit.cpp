@@ -0,0 +1,1067 @@
+#ifdef USE_JIT
+#include <cstdio> // for printf()
+#include <cstdlib> // for exit()
+#include <cstring> // for memcpy()
+#include <cstddef> // for offsetof()
+#include <sys/mman.h> // for mmap()
+#include "cpu.h"
+#include "cpu_clocks.h"
+#include "jit.h"
+
+/*
+  生成コードのレジスタの使い方
+  - rbx: context
+  - r12: メモリオペランドのリニアアドレス (ヘルパー呼び出しをまたいで保持)
+  - rax, rcx, rdx: 作業用 (8bit演算はal, cl, dlのみ使う)
+  - r13はスタックを16バイト境界に合わせるために退避するだけ
+ */
+enum {RAX = 0, RCX = 1, RDX = 2, R12 = 12};
+
+#define CTX_REG(r, size) (offsetof(JIT::context, reg) + \
+			  ((size) == 1? ((r) & 3) * 4 + ((r) >> 2) : (r) * 4))
+#define CTX_PC offsetof(JIT::context, pc)
+#define CTX_CLKS offsetof(JIT::context, clks)
+#define CTX_EFLAGS offsetof(JIT::context, eflags)
+#define CTX_SEG(s) (offsetof(JIT::context, seg_base) + (s) * 4)
+#define CTX_RPAGE offsetof(JIT::context, rpage)
+#define CTX_WPAGE offsetof(JIT::context, wpage)
+
+// ホストのRFLAGSのうちゲストのflag8に対応するビット
+#define EFLAGS_ARITH8 0xd5 // SF, ZF, AF, PF, CF
+#define EFLAGS_OF 0x800
+
+/******************** 生成コードから呼ぶヘルパー ********************/
+
+// ホスト側のメモリにないアドレスはMemory(BUS)経由で読み書きする
+static u32 jit_read8(JIT::context *c, u32 a) { return c->mem->read8(a); }
+static u32 jit_read16(JIT::context *c, u32 a) { return c->mem->read16(a); }
+static u32 jit_read32(JIT::context *c, u32 a) { return c->mem->read32(a); }
+
+// 実行中のブロックのページが書き換えられたら1を返す
+static u32 jit_write8(JIT::context *c, u32 a, u32 d)
+{
+	c->mem->write8(a, (u8)d);
+	return c->mem->get_page_gen(c->code_lin) != c->code_gen;
+}
+static u32 jit_write16(JIT::context *c, u32 a, u32 d)
+{
+	c->mem->write16(a, (u16)d);
+	return c->mem->get_page_gen(c->code_lin) != c->code_gen;
+}
+static u32 jit_write32(JIT::context *c, u32 a, u32 d)
+{
+	c->mem->write32(a, d);
+	return c->mem->get_page_gen(c->code_lin) != c->code_gen;
+}
+
+JIT::JIT(CPU *cpu, Memory *mem) {
+	this->cpu = cpu;
+	this->mem = mem;
+	ctx.rpage = mem->get_rpage();
+	ctx.wpage = mem->get_wpage();
+	ctx.mem = mem;
+
+	code_buf = (u8 *)mmap(NULL, JIT_CODE_SIZE,
+			      PROT_READ | PROT_WRITE | PROT_EXEC,
+			      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (code_buf == MAP_FAILED) {
+		printf("JIT: mmap failed\n");
+		exit(1);
+	}
+	code_ptr = code_buf;
+	for (int i = 0; i < JIT_BLOCKS; i++) {
+		block[i].code = NULL;
+		block[i].hits = 0;
+		block[i].fail = false;
+		block[i].mode = 0xff; // どのモードにも一致しない
+	}
+}
+
+// コードバッファが一杯になったら全部捨てて作り直す
+void JIT::flush_all(void)
+{
+	for (int i = 0; i < JIT_BLOCKS; i++) {
+		block[i].code = NULL;
+		block[i].hits = 0;
+		block[i].fail = false;
+	}
+	code_ptr = code_buf;
+}
+
+/*
+  現在のeipから変換済みのブロックを実行する
+  - まだ変換していなければ実行回数を数え、JIT_HOT回に達したら変換する
+  - ブロックの出口で次のブロックが変換済みなら続けて実行する
+  - ブロックの途中でexit_clksに達する場合はインタプリタに任せる
+    (インタプリタと同じ命令の境界で止まるようにするため)
+  - 1ブロックも実行しなかったらfalseを返す(インタプリタで1命令実行する)
+ */
+bool JIT::exec(void)
+{
+	u32 lin, pc, gen;
+	u8 mode;
+	struct _block *b;
+
+	pc = cpu->isRealMode? cpu->ip : cpu->eip;
+	lin = cpu->sdcr[CPU::CS].base + pc;
+	mode = cpu->opsize | cpu->addrsize << 1 | cpu->isRealMode << 2;
+	gen = mem->get_page_gen(lin);
+	b = &block[lin & (JIT_BLOCKS - 1)];
+	if (b->lin != lin || b->pc != cpu->eip || b->mode != mode ||
+	    b->gen != gen) {
+		// 別のアドレスか、書き換えられたページなら数え直す
+		b->lin = lin;
+		b->pc = cpu->eip;
+		b->mode = mode;
+		b->gen = gen;
+		b->hits = 0;
+		b->fail = false;
+		b->code = NULL;
+	}
+	if (b->code == NULL) {
+		if (b->fail || ++b->hits < JIT_HOT) {
+			return false;
+		}
+		if (!translate(b)) {
+			b->fail = true;
+			return false;
+		}
+	}
+	if (cpu->clks - (s32)b->clks <= cpu->exit_clks) {
+		return false;
+	}
+
+#ifdef LAZY_FLAGS
+	if (cpu->lf_op != CPU::LF_NONE) {
+		cpu->lazy_flags();
+	}
+#endif
+	for (int i = 0; i < NR_GENREG; i++) {
+		ctx.reg[i] = cpu->reg[i].reg32;
+	}
+	ctx.pc = cpu->eip;
+	ctx.clks = cpu->clks;
+	ctx.eflags = (cpu->flag8 & EFLAGS_ARITH8) | 0x2 |
+		((cpu->flagu8 & OFSET8)? EFLAGS_OF : 0);
+	for (int i = 0; i < NR_SEGREG; i++) {
+		ctx.seg_base[i] = cpu->sdcr[i].base;
+	}
+
+	do {
+		ctx.code_lin = b->lin;
+		ctx.code_gen = b->gen;
+		((void (*)(context *))b->code)(&ctx);
+		// 途中で抜けたブロックも最後まで実行したものとして数える
+		cpu->insns += b->insns;
+		pc = (mode & 4)? (ctx.pc & 0xffff) : ctx.pc;
+		lin = ctx.seg_base[CPU::CS] + pc;
+		b = &block[lin & (JIT_BLOCKS - 1)];
+	} while (b->code && b->lin == lin && b->pc == ctx.pc &&
+		 b->mode == mode && b->gen == mem->get_page_gen(lin) &&
+		 ctx.clks - (s32)b->clks > cpu->exit_clks);
+
+	for (int i = 0; i < NR_GENREG; i++) {
+		cpu->reg[i].reg32 = ctx.reg[i];
+	}
+	cpu->eip = ctx.pc;
+	cpu->clks = ctx.clks;
+	cpu->flag8 = (cpu->flag8 & ~EFLAGS_ARITH8) |
+		(ctx.eflags & EFLAGS_ARITH8);
+	if (ctx.eflags & EFLAGS_OF) {
+		cpu->flagu8 |= OFSET8;
+	} else {
+		cpu->flagu8 &= ~OFSET8;
+	}
+
+	return true;
+}
+
+/******************** コード生成 ********************/
+
+// rel8の分岐を出力し、あとでpatch8()する位置を返す
+u8 *JIT::jmp8(u8 op)
+{
+	e8(op);
+	e8(0);
+	return cp - 1;
+}
+
+void JIT::patch8(u8 *at)
+{
+	*at = (u8)(cp - (at + 1));
+}
+
+// [rbx + disp]を指すModR/M (hrはregフィールド)
+void JIT::modrm_rbx(int hr, s32 disp)
+{
+	if (disp >= -128 && disp < 128) {
+		e8(0x40 | (hr & 7) << 3 | 3);
+		e8((u8)disp);
+	} else {
+		e8(0x80 | (hr & 7) << 3 | 3);
+		e32(disp);
+	}
+}
+
+// hr = [rbx + off] (ゼロ拡張)
+void JIT::ld(int size, int hr, u32 off)
+{
+	if (hr >= 8) {
+		e8(0x44);
+	}
+	switch (size) {
+	case 1: // movzx r32, m8
+		e8(0x0f);
+		e8(0xb6);
+		break;
+	case 2: // movzx r32, m16
+		e8(0x0f);
+		e8(0xb7);
+		break;
+	default: // mov r32, m32
+		e8(0x8b);
+	}
+	modrm_rbx(hr, off);
+}
+
+// [rbx + off] = hr (1バイトの場合はal, cl, dlのみ)
+void JIT::st(int size, int hr, u32 off)
+{
+	if (size == 2) {
+		e8(0x66);
+	}
+	if (hr >= 8) {
+		e8(0x44);
+	}
+	e8((size == 1)? 0x88 : 0x89);
+	modrm_rbx(hr, off);
+}
+
+void JIT::mov_ri(int hr, u32 imm)
+{
+	if (hr >= 8) {
+		e8(0x41);
+	}
+	e8(0xb8 + (hr & 7));
+	e32(imm);
+}
+
+// op eax, ecx (opはADD, OR, ADC, SBB, AND, SUB, XOR, CMPの順、8はTEST)
+void JIT::alu_rr(int op, int size)
+{
+	u8 opc = (op == 8)? 0x84 : op << 3;
+
+	if (size == 2) {
+		e8(0x66);
+	}
+	e8((size == 1)? opc : opc | 1);
+	e8(0xc8);
+}
+
+void JIT::call(void *fn)
+{
+	e8(0x48); // mov rdi, rbx
+	e8(0x89);
+	e8(0xdf);
+	e8(0x44); // mov esi, r12d
+	e8(0x89);
+	e8(0xe6);
+	e8(0x48); // mov rax, fn
+	e8(0xb8);
+	e64((u64)fn);
+	e8(0xff); // call rax
+	e8(0xd0);
+}
+
+/*
+  フラグの扱い
+  - 演算の結果はホストのフラグにそのまま残し(FL_HOST)、フラグを壊す
+    コードを出力する前や、ブロックの出口でctx.eflagsに書き出す(FL_SYNC)
+  - AND/OR/XOR/TESTのAFはホストでは不定なので、書き出す時に0にする
+    (FL_HOST_LOGIC。書き出した後のホストのフラグは使えない)
+  - FL_MEMはctx.eflagsだけが有効
+ */
+void JIT::flush_flags(void)
+{
+	if (fl == FL_HOST || fl == FL_HOST_LOGIC) {
+		e8(0x9c); // pushfq
+		e8(0x8f); // pop qword [rbx + eflags]
+		modrm_rbx(0, CTX_EFLAGS);
+		fl = FL_SYNC;
+	}
+}
+
+// この後のコードがホストのフラグを壊す
+void JIT::clobber_flags(void)
+{
+	u8 logic = (fl == FL_HOST_LOGIC);
+
+	flush_flags();
+	if (logic) {
+		e8(0x80); // and byte [rbx + eflags], ~AF
+		modrm_rbx(4, CTX_EFLAGS);
+		e8(~0x10);
+	}
+	fl = FL_MEM;
+}
+
+// ホストのフラグをctx.eflagsに合わせる
+void JIT::load_flags(void)
+{
+	if (fl == FL_MEM) {
+		e8(0xff); // push qword [rbx + eflags]
+		modrm_rbx(6, CTX_EFLAGS);
+		e8(0x9d); // popfq
+		fl = FL_SYNC;
+	}
+}
+
+// ホストのCFだけをctx.eflagsに合わせる (ADC/SBB/INC/DECの前)
+void JIT::load_cf(void)
+{
+	if (fl == FL_MEM) {
+		e8(0x0f); // bt dword [rbx + eflags], 0
+		e8(0xba);
+		modrm_rbx(4, CTX_EFLAGS);
+		e8(0);
+	}
+}
+
+// r12d = セグメント + 実効アドレス (segがfalseならLEA用にセグメントを足さない)
+void JIT::emit_ea(const struct _ea *ea, bool seg)
+{
+	clobber_flags();
+	if (ea->base >= 0) {
+		ld(ea->a16? 2 : 4, R12, CTX_REG(ea->base, 4));
+	} else {
+		mov_ri(R12, ea->disp);
+	}
+	if (ea->index >= 0) {
+		ld(ea->a16? 2 : 4, RAX, CTX_REG(ea->index, 4));
+		if (ea->scale) {
+			e8(0xc1); // shl eax, scale
+			e8(0xe0);
+			e8(ea->scale);
+		}
+		e8(0x41); // add r12d, eax
+		e8(0x01);
+		e8(0xc4);
+	}
+	if (ea->base >= 0 && ea->disp) {
+		e8(0x41); // add r12d, disp
+		e8(0x81);
+		e8(0xc4);
+		e32(ea->disp);
+	}
+	if (ea->a16) {
+		e8(0x45); // movzx r12d, r12w
+		e8(0x0f);
+		e8(0xb7);
+		e8(0xe4);
+	}
+	if (seg) {
+		e8(0x44); // add r12d, [rbx + seg_base]
+		e8(0x03);
+		modrm_rbx(R12, CTX_SEG(ea->seg));
+	}
+}
+
+// eax = [r12d]
+// ページマップを引き、ホスト側のメモリにあってページをまたがなければ
+// その場で読み込む。それ以外はヘルパー経由でMemoryに任せる
+void JIT::emit_load(int size)
+{
+	u8 *slow1, *slow2 = NULL, *done;
+
+	clobber_flags();
+	e8(0x44); e8(0x89); e8(0xe0); // mov eax, r12d
+	e8(0xc1); e8(0xe8); e8(PAGE_SHIFT); // shr eax, PAGE_SHIFT
+	e8(0x48); e8(0x8b); modrm_rbx(RCX, CTX_RPAGE); // mov rcx, [rbx + rpage]
+	e8(0x48); e8(0x8b); e8(0x0c); e8(0xc1); // mov rcx, [rcx + rax * 8]
+	e8(0x48); e8(0x85); e8(0xc9); // test rcx, rcx
+	slow1 = jmp8(0x74); // jz slow
+	e8(0x44); e8(0x89); e8(0xe0); // mov eax, r12d
+	e8(0x25); e32(PAGE_MASK); // and eax, PAGE_MASK
+	if (size > 1) {
+		e8(0x3d); e32(PAGE_SIZE - size); // cmp eax, PAGE_SIZE - size
+		slow2 = jmp8(0x77); // ja slow
+	}
+	switch (size) {
+	case 1: e8(0x0f); e8(0xb6); break; // movzx eax, byte [rcx + rax]
+	case 2: e8(0x0f); e8(0xb7); break; // movzx eax, word [rcx + rax]
+	default: e8(0x8b); // mov eax, [rcx + rax]
+	}
+	e8(0x04); e8(0x01);
+	done = jmp8(0xeb);
+	patch8(slow1);
+	if (slow2) {
+		patch8(slow2);
+	}
+	call((size == 1)? (void *)jit_read8 :
+	     (size == 2)? (void *)jit_read16 : (void *)jit_read32);
+	patch8(done);
+}
+
+// [r12d] = edx
+// ヘルパー経由で実行中のブロックのページに書き込んだ場合はここで抜ける
+void JIT::emit_store(int size)
+{
+	u8 *slow1, *slow2 = NULL, *done, *done2;
+
+	clobber_flags();
+	e8(0x44); e8(0x89); e8(0xe0); // mov eax, r12d
+	e8(0xc1); e8(0xe8); e8(PAGE_SHIFT); // shr eax, PAGE_SHIFT
+	e8(0x48); e8(0x8b); modrm_rbx(RCX, CTX_WPAGE); // mov rcx, [rbx + wpage]
+	e8(0x48); e8(0x8b); e8(0x0c); e8(0xc1); // mov rcx, [rcx + rax * 8]
+	e8(0x48); e8(0x85); e8(0xc9); // test rcx, rcx
+	slow1 = jmp8(0x74); // jz slow
+	e8(0x44); e8(0x89); e8(0xe0); // mov eax, r12d
+	e8(0x25); e32(PAGE_MASK); // and eax, PAGE_MASK
+	if (size > 1) {
+		e8(0x3d); e32(PAGE_SIZE - size); // cmp eax, PAGE_SIZE - size
+		slow2 = jmp8(0x77); // ja slow
+	}
+	switch (size) {
+	case 1: e8(0x88); break; // mov [rcx + rax], dl
+	case 2: e8(0x66); e8(0x89); break; // mov [rcx + rax], dx
+	default: e8(0x89); // mov [rcx + rax], edx
+	}
+	e8(0x14); e8(0x01);
+	done = jmp8(0xeb);
+	patch8(slow1);
+	if (slow2) {
+		patch8(slow2);
+	}
+	call((size == 1)? (void *)jit_write8 :
+	     (size == 2)? (void *)jit_write16 : (void *)jit_write32);
+	e8(0x85); e8(0xc0); // test eax, eax
+	done2 = jmp8(0x74); // jz done
+	emit_exit(next_eip);
+	patch8(done);
+	patch8(done2);
+}
+
+// ブロックの出口 (フラグは書き出しておくこと)
+void JIT::emit_exit(u32 pc)
+{
+	e8(0xc7); // mov dword [rbx + pc], pc
+	modrm_rbx(0, CTX_PC);
+	e32(pc);
+	if (blk_clks) {
+		e8(0x81); // sub dword [rbx + clks], blk_clks
+		modrm_rbx(5, CTX_CLKS);
+		e32(blk_clks);
+	}
+	e8(0x41); e8(0x5d); // pop r13
+	e8(0x41); e8(0x5c); // pop r12
+	e8(0x5b); // pop rbx
+	e8(0xc3); // ret
+}
+
+/******************** 命令の変換 ********************/
+
+// ModR/M(とSIB、ディスプレースメント)を解釈してバイト数を返す
+// セグメントはインタプリタ(modrm_seg_ea())と同じ規則で選ぶ
+int JIT::decode_modrm(const u8 *p, u32 n, bool a16, int seg, struct _ea *ea)
+{
+	// [bx+si], [bx+di], [bp+si], [bp+di], [si], [di], [bp], [bx]
+	static const s8 base16[8] = {3, 3, 5, 5, 6, 7, 5, 3};
+	static const s8 index16[8] = {6, 7, 6, 7, -1, -1, -1, -1};
+	u8 mod = p[0] >> 6, rm = p[0] & 7, sib, def;
+	int len = 1;
+
+	ea->a16 = a16;
+	ea->base = -1;
+	ea->index = -1;
+	ea->scale = 0;
+	ea->disp = 0;
+
+	if (a16) {
+		def = cpu->modrm_add_seg[0][mod][rm];
+		if (mod == 0 && rm == 6) {
+			ea->disp = load16le(p + 1);
+			len += 2;
+		} else {
+			ea->base = base16[rm];
+			ea->index = index16[rm];
+		}
+		if (mod == 1) {
+			ea->disp = (s8)p[1];
+			len++;
+		} else if (mod == 2) {
+			ea->disp = load16le(p + 1);
+			len += 2;
+		}
+	} else {
+		def = cpu->modrm_add_seg[1][mod][rm];
+		if (rm == 4) {
+			sib = p[1];
+			len++;
+			ea->scale = sib >> 6;
+			if ((sib >> 3 & 7) != 4) {
+				ea->index = sib >> 3 & 7;
+			}
+			if ((sib & 7) == 5 && mod == 0) {
+				ea->disp = load32le(p + len);
+				len += 4;
+				def = CPU::DS;
+			} else {
+				ea->base = sib & 7;
+				def = cpu->modrm_add_sib[sib & 7];
+			}
+		} else if (rm == 5 && mod == 0) {
+			ea->disp = load32le(p + 1);
+			len += 4;
+		} else {
+			ea->base = rm;
+		}
+		if (mod == 1) {
+			ea->disp = (s8)p[len];
+			len++;
+		} else if (mod == 2) {
+			ea->disp = load32le(p + len);
+			len += 4;
+		}
+	}
+	// セグメントオーバーライドはDSとSSの両方を置き換える
+	ea->seg = (seg >= 0)? seg : def;
+
+	return len;
+}
+
+/*
+  1命令を変換して命令長を返す
+  - 変換できない命令なら0を返す (出力したコードは呼び出し側で捨てる)
+  - 分岐でブロックが終わる場合は命令長を負にして返す
+  - クロック数はインタプリタが引く値に合わせる
+ */
+int JIT::translate_insn(const u8 *p, u32 n, u32 pc, u8 mode)
+{
+	u8 buf[32];
+	u8 op, modrm = 0, aop, cc;
+	int i = 0, len, size, osize, reg, seg = -1;
+	bool a16, mem_op = false;
+	u32 imm = 0, target, clk = 0;
+	struct _ea ea;
+
+	memset(buf, 0, sizeof(buf));
+	if (n > ICACHE_MAX_LEN) {
+		n = ICACHE_MAX_LEN;
+	}
+	memcpy(buf, p, n);
+
+	osize = (mode & 1)? 4 : 2;
+	a16 = !(mode & 2);
+	// プリフィックス (インタプリタと同様、デフォルトの逆にする)
+	for (;;) {
+		switch (buf[i]) {
+		case 0x66: osize = (mode & 1)? 2 : 4; i++; continue;
+		case 0x67: a16 = (mode & 2); i++; continue;
+		case 0x26: seg = CPU::ES; i++; continue;
+		case 0x2e: seg = CPU::CS; i++; continue;
+		case 0x36: seg = CPU::SS; i++; continue;
+		case 0x3e: seg = CPU::DS; i++; continue;
+		}
+		break;
+	}
+	if (i >= ICACHE_MAX_LEN) {
+		return 0;
+	}
+	op = buf[i++];
+
+/* ModR/Mを解釈する (ModR/Mの後のiは即値を指す) */
+#define DECODE_MODRM()							\
+	modrm = buf[i];							\
+	reg = modrm >> 3 & 7;						\
+	mem_op = (modrm >> 6 != 3);					\
+	if (mem_op) {							\
+		i += decode_modrm(buf + i, n - i, a16, seg, &ea);	\
+	} else {							\
+		i++;							\
+	}
+
+/* 命令長を確定させてクロック数を加算する (ここより前は何も出力しない) */
+#define COMMIT()						\
+	len = i;						\
+	if ((u32)len > n) {					\
+		return 0;					\
+	}							\
+	next_eip = pc + len;					\
+	blk_clks += clk
+
+/* r/mのオペランドを読む */
+#define LOAD_RM(size)							\
+	if (mem_op) {							\
+		emit_ea(&ea, true);					\
+		emit_load(size);					\
+	} else {							\
+		ld(size, RAX, CTX_REG(modrm & 7, size));		\
+	}
+
+/* eaxをr/mに書き込む */
+#define STORE_RM(size)							\
+	if (mem_op) {							\
+		e8(0x89); e8(0xc2); /* mov edx, eax */			\
+		emit_store(size);					\
+	} else {							\
+		st(size, RAX, CTX_REG(modrm & 7, size));		\
+	}
+
+	switch (op) {
+	/* ADD/OR/ADC/SBB/AND/SUB/XOR/CMP r/m, r と r, r/m */
+	case 0x00: case 0x01: case 0x02: case 0x03:
+	case 0x08: case 0x09: case 0x0a: case 0x0b:
+	case 0x10: case 0x11: case 0x12: case 0x13:
+	case 0x18: case 0x19: case 0x1a: case 0x1b:
+	case 0x20: case 0x21: case 0x22: case 0x23:
+	case 0x28: case 0x29: case 0x2a: case 0x2b:
+	case 0x30: case 0x31: case 0x32: case 0x33:
+	case 0x38: case 0x39: case 0x3a: case 0x3b:
+		aop = op >> 3;
+		size = (op & 1)? osize : 1;
+		DECODE_MODRM();
+		if (!mem_op) {
+			clk = (aop == 7)? CLK_CMP_R_R : CLK_CAL_R_R;
+		} else if (op & 2) {
+			clk = (aop == 7)? CLK_CMP_R_MEM : CLK_CAL_R_MEM;
+		} else {
+			clk = (aop == 7)? CLK_CMP_MEM_R : CLK_CAL_MEM_R;
+		}
+		COMMIT();
+		LOAD_RM(size);
+		if (op & 2) { // r, r/m
+			e8(0x89); e8(0xc1); // mov ecx, eax
+			ld(size, RAX, CTX_REG(reg, size));
+		} else {
+			ld(size, RCX, CTX_REG(reg, size));
+		}
+		if (aop == 2 || aop == 3) {
+			load_cf();
+		}
+		alu_rr(aop, size);
+		fl = (aop == 1 || aop == 4 || aop == 6)? FL_HOST_LOGIC : FL_HOST;
+		if (aop == 7) {
+			break;
+		}
+		if (op & 2) {
+			st(size, RAX, CTX_REG(reg, size));
+		} else {
+			STORE_RM(size);
+		}
+		break;
+
+	/* ADD/OR/ADC/SBB/AND/SUB/XOR/CMP AL, imm8 (eAX, imm) */
+	case 0x04: case 0x05: case 0x0c: case 0x0d:
+	case 0x14: case 0x15: case 0x1c: case 0x1d:
+	case 0x24: case 0x25: case 0x2c: case 0x2d:
+	case 0x34: case 0x35: case 0x3c: case 0x3d:
+		aop = op >> 3;
+		size = (op & 1)? osize : 1;
+		imm = (size == 1)? buf[i] : (size == 2)? load16le(buf + i) : load32le(buf + i);
+		i += size;
+		clk = (aop == 7)? CLK_CMP_R_IMM : CLK_CAL_R_IMM;
+		COMMIT();
+		ld(size, RAX, CTX_REG(0, size));
+		mov_ri(RCX, imm);
+		if (aop == 2 || aop == 3) {
+			load_cf();
+		}
+		alu_rr(aop, size);
+		fl = (aop == 1 || aop == 4 || aop == 6)? FL_HOST_LOGIC : FL_HOST;
+		if (aop != 7) {
+			st(size, RAX, CTX_REG(0, size));
+		}
+		break;
+
+	/* INC/DEC r16 (r32) */
+	case 0x40: case 0x41: case 0x42: case 0x43:
+	case 0x44: case 0x45: case 0x46: case 0x47:
+	case 0x48: case 0x49: case 0x4a: case 0x4b:
+	case 0x4c: case 0x4d: case 0x4e: case 0x4f:
+		clk = CLK_INCDEC_R;
+		COMMIT();
+		ld(osize, RAX, CTX_REG(op & 7, osize));
+		load_cf();
+		if (osize == 2) {
+			e8(0x66);
+		}
+		e8(0xff); // inc/dec eax
+		e8((op & 8)? 0xc8 : 0xc0);
+		fl = FL_HOST;
+		st(osize, RAX, CTX_REG(op & 7, osize));
+		break;
+
+	/* PUSH r16 (r32) (PUSH SPはインタプリタに任せる) */
+	/* スタック操作はセグメントオーバーライドの影響を受けない */
+	case 0x50: case 0x51: case 0x52: case 0x53:
+	case 0x55: case 0x56: case 0x57:
+		clk = CLK_PUSH_R;
+		COMMIT();
+		clobber_flags();
+		// インタプリタと同様、16bitならsp、32bitならespを使う
+		ld(4, RAX, CTX_REG(4, 4));
+		e8(0x83); e8(0xe8); e8(osize); // sub eax, osize
+		st(osize, RAX, CTX_REG(4, osize));
+		if (osize == 2) {
+			e8(0x44); e8(0x0f); e8(0xb7); e8(0xe0); // movzx r12d, ax
+		} else {
+			e8(0x41); e8(0x89); e8(0xc4); // mov r12d, eax
+		}
+		e8(0x44); e8(0x03); modrm_rbx(R12, CTX_SEG(CPU::SS)); // add r12d, [ss]
+		ld(osize, RDX, CTX_REG(op & 7, osize));
+		emit_store(osize);
+		break;
+
+	/* POP r16 (r32) (POP SPはインタプリタに任せる) */
+	case 0x58: case 0x59: case 0x5a: case 0x5b:
+	case 0x5d: case 0x5e: case 0x5f:
+		clk = CLK_POP_R;
+		COMMIT();
+		ld(osize, R12, CTX_REG(4, osize));
+		e8(0x44); e8(0x03); modrm_rbx(R12, CTX_SEG(CPU::SS)); // add r12d, [ss]
+		emit_load(osize);
+		st(osize, RAX, CTX_REG(op & 7, osize));
+		if (osize == 2) {
+			e8(0x66);
+		}
+		e8(0x83); modrm_rbx(0, CTX_REG(4, 4)); e8(osize); // add [esp], osize
+		break;
+
+	/* Jcc rel8 */
+	case 0x70: case 0x71: case 0x72: case 0x73:
+	case 0x74: case 0x75: case 0x76: case 0x77:
+	case 0x78: case 0x79: case 0x7a: case 0x7b:
+	case 0x7c: case 0x7d: case 0x7e: case 0x7f:
+		cc = op & 0xf;
+		imm = buf[i++];
+		COMMIT();
+		target = next_eip + (s8)imm;
+		goto jcc;
+
+	/* ADD/OR/ADC/SBB/AND/SUB/XOR/CMP r/m, imm */
+	case 0x80: case 0x81: case 0x82: case 0x83:
+		size = (op == 0x81 || op == 0x83)? osize : 1;
+		DECODE_MODRM();
+		aop = reg;
+		if (op == 0x81) {
+			imm = (size == 2)? load16le(buf + i) : load32le(buf + i);
+			i += size;
+		} else if (op == 0x83) {
+			imm = (size == 2)? (u16)(s8)buf[i] : (u32)(s8)buf[i];
+			i++;
+		} else {
+			imm = buf[i++];
+		}
+		// インタプリタではAND/OR/XOR/CMPはクロックを引いていない
+		if (aop == 0 || aop == 2 || aop == 3 || aop == 5) {
+			clk = mem_op? CLK_CAL_MEM_IMM : CLK_CAL_R_IMM;
+		}
+		COMMIT();
+		LOAD_RM(size);
+		mov_ri(RCX, imm);
+		if (aop == 2 || aop == 3) {
+			load_cf();
+		}
+		alu_rr(aop, size);
+		fl = (aop == 1 || aop == 4 || aop == 6)? FL_HOST_LOGIC : FL_HOST;
+		if (aop != 7) {
+			STORE_RM(size);
+		}
+		break;
+
+	/* TEST r/m, r */
+	case 0x84: case 0x85:
+		size = (op & 1)? osize : 1;
+		DECODE_MODRM();
+		clk = mem_op? CLK_TEST_MEM_R : CLK_TEST_R_R;
+		COMMIT();
+		LOAD_RM(size);
+		ld(size, RCX, CTX_REG(reg, size));
+		alu_rr(8, size);
+		fl = FL_HOST_LOGIC;
+		break;
+
+	/* MOV r/m, r */
+	case 0x88: case 0x89:
+		size = (op & 1)? osize : 1;
+		DECODE_MODRM();
+		clk = CLK_MOV_RM_R;
+		COMMIT();
+		if (mem_op) {
+			emit_ea(&ea, true);
+			ld(size, RDX, CTX_REG(reg, size));
+			emit_store(size);
+		} else {
+			ld(size, RAX, CTX_REG(reg, size));
+			st(size, RAX, CTX_REG(modrm & 7, size));
+		}
+		break;
+
+	/* MOV r, r/m */
+	case 0x8a: case 0x8b:
+		size = (op & 1)? osize : 1;
+		DECODE_MODRM();
+		clk = mem_op? CLK_MOV_R_MEM : CLK_MOV_R_R;
+		COMMIT();
+		LOAD_RM(size);
+		st(size, RAX, CTX_REG(reg, size));
+		break;
+
+	/* LEA r, m */
+	case 0x8d:
+		DECODE_MODRM();
+		if (!mem_op) {
+			return 0;
+		}
+		clk = CLK_LEA;
+		COMMIT();
+		emit_ea(&ea, false);
+		st(osize, R12, CTX_REG(reg, osize));
+		break;
+
+	/* NOP */
+	case 0x90:
+		clk = CLK_NOP;
+		COMMIT();
+		break;
+
+	/* TEST AL, imm8 (TEST eAX, imm) */
+	case 0xa8: case 0xa9:
+		size = (op & 1)? osize : 1;
+		imm = (size == 1)? buf[i] : (size == 2)? load16le(buf + i) : load32le(buf + i);
+		i += size;
+		clk = CLK_TEST_R_IMM;
+		COMMIT();
+		ld(size, RAX, CTX_REG(0, size));
+		mov_ri(RCX, imm);
+		alu_rr(8, size);
+		fl = FL_HOST_LOGIC;
+		break;
+
+	/* MOV r8, imm8 */
+	case 0xb0: case 0xb1: case 0xb2: case 0xb3:
+	case 0xb4: case 0xb5: case 0xb6: case 0xb7:
+		imm = buf[i++];
+		clk = CLK_MOV_R_IMM;
+		COMMIT();
+		mov_ri(RAX, imm);
+		st(1, RAX, CTX_REG(op & 7, 1));
+		break;
+
+	/* MOV r16, imm16 (r32, imm32) */
+	case 0xb8: case 0xb9: case 0xba: case 0xbb:
+	case 0xbc: case 0xbd: case 0xbe: case 0xbf:
+		imm = (osize == 2)? load16le(buf + i) : load32le(buf + i);
+		i += osize;
+		clk = CLK_MOV_R_IMM;
+		COMMIT();
+		mov_ri(RAX, imm);
+		st(osize, RAX, CTX_REG(op & 7, osize));
+		break;
+
+	/* MOV r/m, imm */
+	case 0xc6: case 0xc7:
+		size = (op & 1)? osize : 1;
+		DECODE_MODRM();
+		if (reg != 0) {
+			return 0;
+		}
+		imm = (size == 1)? buf[i] : (size == 2)? load16le(buf + i) : load32le(buf + i);
+		i += size;
+		clk = CLK_MOV_R_IMM;
+		COMMIT();
+		if (mem_op) {
+			emit_ea(&ea, true);
+			mov_ri(RDX, imm);
+			emit_store(size);
+		} else {
+			mov_ri(RAX, imm);
+			st(size, RAX, CTX_REG(modrm & 7, size));
+		}
+		break;
+
+	/* JMP rel16 (rel32) */
+	case 0xe9:
+		imm = (osize == 2)? (u32)(s16)load16le(buf + i) : load32le(buf + i);
+		i += osize;
+		COMMIT();
+		clobber_flags();
+		emit_exit(next_eip + imm);
+		return -len;
+
+	/* JMP rel8 */
+	case 0xeb:
+		imm = (s8)buf[i++];
+		COMMIT();
+		clobber_flags();
+		emit_exit(next_eip + imm);
+		return -len;
+
+	/* INC/DEC r/m */
+	case 0xfe: case 0xff:
+		size = (op & 1)? osize : 1;
+		DECODE_MODRM();
+		if (reg > 1) {
+			return 0;
+		}
+		clk = mem_op? CLK_INCDEC_MEM : CLK_INCDEC_R;
+		COMMIT();
+		LOAD_RM(size);
+		load_cf();
+		if (size == 2) {
+			e8(0x66);
+		}
+		e8((size == 1)? 0xfe : 0xff); // inc/dec eax
+		e8(reg? 0xc8 : 0xc0);
+		fl = FL_HOST;
+		STORE_RM(size);
+		break;
+
+	case 0x0f:
+		op = buf[i++];
+		switch (op) {
+		/* Jcc rel16 (rel32) */
+		case 0x80: case 0x81: case 0x82: case 0x83:
+		case 0x84: case 0x85: case 0x86: case 0x87:
+		case 0x88: case 0x89: case 0x8a: case 0x8b:
+		case 0x8c: case 0x8d: case 0x8e: case 0x8f:
+			cc = op & 0xf;
+			if (osize == 2) {
+				imm = load16le(buf + i);
+				i += 2;
+				COMMIT();
+				// インタプリタに合わせて(s16)(rel + 2)で求める
+				target = next_eip - 2 + (s16)(imm + 2);
+			} else {
+				imm = load32le(buf + i);
+				i += 4;
+				COMMIT();
+				target = next_eip + imm;
+			}
+			goto jcc;
+
+		/* MOVZX/MOVSX r, r/m8 */
+		/* MOVZX/MOVSX r32, r/m16 (インタプリタはr16の形式に未対応) */
+		case 0xb6: case 0xb7: case 0xbe: case 0xbf:
+			size = (op & 1)? 2 : 1;
+			if (size == 2 && osize == 2) {
+				return 0;
+			}
+			DECODE_MODRM();
+			if (op & 8) {
+				clk = mem_op? CLK_MOVSX_R_MEM : CLK_MOVSX_R_R;
+			} else {
+				clk = mem_op? CLK_MOVZX_R_MEM : CLK_MOVZX_R_R;
+			}
+			COMMIT();
+			LOAD_RM(size);
+			if (op & 8) {
+				e8(0x0f); // movsx eax, al (ax)
+				e8((size == 1)? 0xbe : 0xbf);
+				e8(0xc0);
+			}
+			st(osize, RAX, CTX_REG(reg, osize));
+			break;
+
+		default:
+			return 0;
+		}
+		break;
+
+	default:
+		return 0;
+	}
+
+	return len;
+
+jcc:
+	// 両方の出口でフラグを書き出す
+	load_flags();
+	{
+		u8 *at, saved = fl;
+
+		e8(0x0f); // jcc rel32
+		e8(0x80 | cc);
+		at = cp;
+		e32(0);
+		clobber_flags();
+		emit_exit(next_eip);
+		store32le(at, cp - (at + 4));
+		fl = saved;
+		clobber_flags();
+		emit_exit(target);
+	}
+	return -len;
+}
+
+// ブロックを変換する
+bool JIT::translate(struct _block *b)
+{
+	u8 *page, *save_cp;
+	u8 save_fl;
+	u32 off, pc, n, save_clks;
+	int len = 0, nr;
+
+	if (code_ptr + JIT_MAX_CODE > code_buf + JIT_CODE_SIZE) {
+		flush_all();
+	}
+	// ホスト側のメモリにないページ(MMIO等)は変換しない
+	if (!mem->watch_page(b->lin)) {
+		return false;
+	}
+	page = ctx.rpage[b->lin >> PAGE_SHIFT];
+
+	cp = code_ptr;
+	fl = FL_MEM;
+	blk_clks = 0;
+	e8(0x53); // push rbx
+	e8(0x41); e8(0x54); // push r12
+	e8(0x41); e8(0x55); // push r13
+	e8(0x48); e8(0x89); e8(0xfb); // mov rbx, rdi
+
+	off = b->lin & PAGE_MASK;
+	pc = b->pc;
+	for (nr = 0; nr < JIT_MAX_INSNS; nr++) {
+		// ページをまたがない (リアルモードではipが一周しない)範囲
+		n = PAGE_SIZE - off;
+		if (b->mode & 4) {
+			if (pc > 0xffff) {
+				break;
+			}
+			if (n > 0x10000 - pc) {
+				n = 0x10000 - pc;
+			}
+		}
+		save_cp = cp;
+		save_fl = fl;
+		save_clks = blk_clks;
+		len = translate_insn(page + off, n, pc, b->mode);
+		if (len == 0) {
+			// 変換できない命令の手前で終わる
+			cp = save_cp;
+			fl = save_fl;
+			blk_clks = save_clks;
+			break;
+		}
+		if (len < 0) {
+			nr++;
+			break;
+		}
+		off += len;
+		pc += len;
+	}
+	if (nr == 0) {
+		return false;
+	}
+	if (len >= 0) {
+		clobber_flags();
+		emit_exit(pc);
+	}
+
+	b->clks = blk_clks;
+	b->insns = nr;
+	b->code = code_ptr;
+	code_ptr = cp;
+	return true;
+}
+#endif // USE_JIT
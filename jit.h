@@ -0,0 +1,111 @@
+#pragma once
+#include "types.h"
+
+#if defined(USE_JIT) && !defined(__x86_64__)
+#error "USE_JIT requires an x86-64 host"
+#endif
+
+class CPU;
+class Memory;
+
+/*
+  動的バイナリ変換 (JIT)
+  - 何度も実行されるゲストの命令列(基本ブロック)をホスト(x86-64)の
+    コードに変換して実行する
+  - ゲストのレジスタ、eip、フラグは実行中はcontextに置き、生成コードは
+    rbxにcontextのアドレスを持って読み書きする
+  - メモリアクセスはページマップ(rpage/wpage)を引いて、ホスト側の
+    メモリに割り当たっていればその場で読み書きし、それ以外(MMIO、
+    ページ境界、監視中のページ)はMemory(BUS)経由で処理する
+  - 変換できない命令、モードが変わる命令(MOV CR0やセグメントレジスタ
+    のロード)、ブロックをまたぐ分岐はインタプリタに戻す
+  - ブロックのあるページに書き込みがあった場合は、ページの書き込み世代で
+    検出して変換し直す。実行中のブロック自身が書き換えられた場合は、
+    書き込んだ命令の直後でインタプリタに戻る
+ */
+class JIT {
+public:
+	// 生成コードから参照するゲストの状態
+	struct context {
+		u32 reg[8]; // eax, ecx, edx, ebx, esp, ebp, esi, edi
+		u32 pc; // eip
+		s32 clks;
+		u64 eflags; // ホストのRFLAGSの形式 (CF/PF/AF/ZF/SF/OFのみ有効)
+		u32 seg_base[6]; // ES, CS, SS, DS, FS, GS
+		u32 code_lin; // 実行中のブロックのリニアアドレス
+		u32 code_gen; // 実行中のブロックのページの書き込み世代
+		u8 **rpage;
+		u8 **wpage;
+		Memory *mem;
+	};
+
+private:
+#define JIT_BLOCKS 4096 // ブロックキャッシュのエントリ数
+#define JIT_HOT 16 // この回数実行されたら変換する
+#define JIT_MAX_INSNS 32 // 1ブロックの命令数の上限
+#define JIT_CODE_SIZE (4 * 1024 * 1024)
+#define JIT_MAX_CODE (32 * 1024) // 1ブロックの生成コードの上限
+
+	struct _block {
+		u32 lin; // 先頭のリニアアドレス
+		u32 pc; // eip
+		u32 gen; // ページの書き込み世代
+		u8 mode; // CPU::icacheと同じ
+		bool fail; // 変換できなかった
+		u16 hits;
+		u8 insns; // 命令数
+		u32 clks; // 最後まで実行した場合のクロック数
+		u8 *code;
+	} block[JIT_BLOCKS];
+
+	CPU *cpu;
+	Memory *mem;
+	context ctx;
+	u8 *code_buf;
+	u8 *code_ptr;
+
+	// 変換中の状態
+	u8 *cp; // コードの出力先
+	enum {FL_MEM, FL_SYNC, FL_HOST, FL_HOST_LOGIC};
+	u8 fl; // ホストのフラグとctx.eflagsのどちらが有効か
+	u32 next_eip; // 変換中の命令の次のeip
+	u32 blk_clks; // 変換中の命令までに消費するクロック数
+
+	struct _ea {
+		s8 base; // -1ならなし
+		s8 index; // -1ならなし
+		u8 scale;
+		u8 seg;
+		bool a16; // 16bitアドレッシング
+		u32 disp;
+	};
+
+	void flush_all(void);
+	bool translate(struct _block *b);
+	int translate_insn(const u8 *p, u32 n, u32 pc, u8 mode);
+	int decode_modrm(const u8 *p, u32 n, bool a16, int seg, struct _ea *ea);
+
+	void e8(u8 d) { *cp++ = d; }
+	void e32(u32 d) { store32le(cp, d); cp += 4; }
+	void e64(u64 d) { store32le(cp, (u32)d); store32le(cp + 4, d >> 32); cp += 8; }
+	u8 *jmp8(u8 op);
+	void patch8(u8 *at);
+	void modrm_rbx(int hr, s32 disp);
+	void ld(int size, int hr, u32 off);
+	void st(int size, int hr, u32 off);
+	void mov_ri(int hr, u32 imm);
+	void alu_rr(int op, int size);
+	void call(void *fn);
+	void flush_flags(void);
+	void clobber_flags(void);
+	void load_flags(void);
+	void load_cf(void);
+	void emit_ea(const struct _ea *ea, bool seg);
+	void emit_load(int size);
+	void emit_store(int size);
+	void emit_exit(u32 pc);
+
+public:
+	JIT(CPU *cpu, Memory *mem);
+	bool exec(void);
+};
@@ -1,31 +1,150 @@
 #include <iostream>
 #include <cstring> // for strcmp
+#include <cstdlib> // for strtoul()
+#include <csignal> // for signal()
 #include <string>
+#include <vector>
+#include <algorithm> // for sort()
+#include <chrono> // for steady_clock
+#include <thread> // for sleep_until()
 #include <SDL.h>
 #include "memory.h"
 #include "io.h"
 #include "cpu.h"
+#include "pic.h"
 #include "event.h"
+#include "sampler.h"
+
+// 1スライスのクロック数と、それを実時間に換算するためのCPUのクロック
+#define SLICE_CLKS 280000
+#define CPU_HZ 16000000
+
+// トレース中とプロファイル中はCtrl-Cで抜けて結果を書き出す
+static volatile sig_atomic_t quit = 0;
+static void sigint_handler(int sig)
+{
+	quit = 1;
+}
+
+#ifdef OP_PROFILE
+// プロファイルはSIGUSR1でスライスの終わりに、Ctrl-Cで終了時に書き出す
+static volatile sig_atomic_t dump_profile = 0;
+static void sigusr1_handler(int sig)
+{
+	dump_profile = 1;
+}
+#endif
+
+/*
+  ベンチマークの結果
+  - MIPSは実行した命令数(HLTやビジーウェイトで飛ばした分は含まない)を
+    実時間で割ったもの
+  - 実機比はゲストのクロックをCPU_HZで実時間に換算して比べたもの
+  - フレームは1スライス(画面を1回更新する間隔)
+ */
+static void bench_report(u64 frames, u64 clks, u64 insns, u64 idle_clks,
+			 std::vector<double> &slice_ms)
+{
+	double sec = 0;
+
+	for (double ms : slice_ms) {
+		sec += ms / 1000;
+	}
+	if (frames == 0 || sec <= 0) {
+		return;
+	}
+	std::sort(slice_ms.begin(), slice_ms.end());
+	printf("bench: %llu frames, %llu clocks (%.1f%% idle), %llu instructions in %.3f s\n",
+	       (unsigned long long)frames, (unsigned long long)clks,
+	       idle_clks * 100.0 / clks, (unsigned long long)insns, sec);
+	printf("  %.2f MIPS, %.2fx real time, %.1f fps\n",
+	       insns / sec / 1e6, (double)clks / CPU_HZ / sec, frames / sec);
+	printf("  slice ms: p50 %.3f, p90 %.3f, p99 %.3f, max %.3f\n",
+	       slice_ms[slice_ms.size() * 50 / 100],
+	       slice_ms[slice_ms.size() * 90 / 100],
+	       slice_ms[slice_ms.size() * 99 / 100],
+	       slice_ms.back());
+}
 
 int main(int argc, char *argv[])
 {
-	SDL_Window *sdl_window;
-	SDL_Surface *sdl_surface;
+	SDL_Window *sdl_window = NULL;
+	SDL_Surface *sdl_surface = NULL;
 	int *pt;
 	u8 r,g,b,a;
 	bool use_video = true;
+	bool use_jit = false;
+	const char *trace_path = NULL;
+	u32 trace_lo = 0, trace_hi = 0xffffffff;
+	u64 trace_from = 0, trace_count = ~(u64)0;
+	u64 trace_flight = 0;
+	s32 sample_clks = 0;
+	const char *sym_path = NULL;
+	const char *folded_path = NULL;
+	bool bench = false;
+	u64 bench_clks = ~(u64)0, bench_insns = ~(u64)0, bench_frames = ~(u64)0;
+	char *endp;
 
 	for (int i = 1; i < argc; i++) {
 		if (strcmp(argv[i], "-c") == 0) {
 			use_video = false;
+		} else if (strcmp(argv[i], "-j") == 0) {
+			use_jit = true;
+		} else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+			trace_path = argv[++i];
+		} else if (strcmp(argv[i], "-tr") == 0 && i + 1 < argc) {
+			// -tr lo:hi (16進数のリニアアドレス、hiを含む)
+			trace_lo = strtoul(argv[++i], &endp, 16);
+			trace_hi = (*endp == ':')?
+				strtoul(endp + 1, NULL, 16) : trace_lo;
+		} else if (strcmp(argv[i], "-tn") == 0 && i + 1 < argc) {
+			// -tn from:count (命令数)
+			trace_from = strtoull(argv[++i], &endp, 0);
+			if (*endp == ':') {
+				trace_count = strtoull(endp + 1, NULL, 0);
+			}
+		} else if (strcmp(argv[i], "-tf") == 0 && i + 1 < argc) {
+			trace_flight = strtoull(argv[++i], NULL, 0);
+		} else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+			sample_clks = strtol(argv[++i], NULL, 0);
+		} else if (strcmp(argv[i], "-ps") == 0 && i + 1 < argc) {
+			sym_path = argv[++i];
+		} else if (strcmp(argv[i], "-pf") == 0 && i + 1 < argc) {
+			folded_path = argv[++i];
+		} else if (strcmp(argv[i], "-bc") == 0 && i + 1 < argc) {
+			bench = true;
+			bench_clks = strtoull(argv[++i], NULL, 0);
+		} else if (strcmp(argv[i], "-bi") == 0 && i + 1 < argc) {
+			bench = true;
+			bench_insns = strtoull(argv[++i], NULL, 0);
+		} else if (strcmp(argv[i], "-bf") == 0 && i + 1 < argc) {
+			bench = true;
+			bench_frames = strtoull(argv[++i], NULL, 0);
 		} else {
-			printf("usage:\n");
+			printf("usage: psumot [-c] [-j]\n");
+			printf("              [-t file [-tr lo:hi] [-tn from:count] [-tf count]]\n");
+			printf("              [-p clks [-ps file] [-pf file]]\n");
+			printf("              [-bc clks] [-bi insns] [-bf frames]\n");
+			printf("  -c  no video\n");
+			printf("  -j  enable JIT\n");
+			printf("  -t  write a binary execution trace to file (compare with tracecmp)\n");
+			printf("  -tr trace only linear addresses lo..hi (hex)\n");
+			printf("  -tn trace only count instructions from the from-th\n");
+			printf("  -tf keep only the last count instructions and write them\n");
+			printf("      when an unimplemented instruction is executed\n");
+			printf("  -p  sample the guest CS:EIP every clks clocks\n");
+			printf("  -ps read \"address name\" symbols for the profile\n");
+			printf("  -pf track calls and write folded stacks to file\n");
+			printf("  -bc/-bi/-bf run headless at full speed for clks clocks,\n");
+			printf("      insns instructions or frames, then print the speed\n");
+			return 1;
 		}
 	}
 
 	// RAM 6MB
 	Memory mem((u32)0x600000);
 	pSUMOT::IO io(0x10000);
+	PIC pic;
 
 	CPU cpu(&mem);
 
@@ -34,12 +153,49 @@ int main(int argc, char *argv[])
 	io.set_ev(&ev);
 
 	cpu.reset();
+	Trace *trace = NULL;
+	if (trace_path) {
+		trace = new Trace(trace_path, trace_flight);
+		trace->set_range(trace_lo, trace_hi);
+		trace->set_window(trace_from, trace_count);
+		cpu.set_trace(trace);
+		signal(SIGINT, sigint_handler);
+	}
+#ifdef OP_PROFILE
+	signal(SIGINT, sigint_handler);
+	signal(SIGUSR1, sigusr1_handler);
+#endif
+	Sampler *sampler = NULL;
+	if (sample_clks > 0) {
+		sampler = new Sampler(&cpu, &ev, sample_clks);
+		if (sym_path) {
+			sampler->load_symbols(sym_path);
+		}
+		if (folded_path) {
+			sampler->set_folded(folded_path);
+			cpu.set_sampler(sampler);
+		}
+		sampler->start();
+		signal(SIGINT, sigint_handler);
+	}
+	if (use_jit) {
+#ifdef USE_JIT
+		cpu.set_jit(true);
+#else
+		printf("JIT is not compiled in (build with -DUSE_JIT)\n");
+#endif
+	}
 
+	// ベンチマークはSDLを使わず、実時間に合わせずに全速で動かす
+	// (1スライスごとに止めるので、同じ引数なら同じところで止まる)
+	if (bench) {
+		use_video = false;
+	}
 	if (use_video && SDL_Init(SDL_INIT_VIDEO) < 0) {
 		printf("SDL_Init(SDL_INIT_VIDEO) error\n");
 		return 1;
 	}
-	if (SDL_Init(SDL_INIT_AUDIO) < 0) {
+	if (!bench && SDL_Init(SDL_INIT_AUDIO) < 0) {
 		printf("SDL_Init(SDL_INIT_AUDIO) error\n");
 		return 1;
 	}
@@ -59,14 +215,49 @@ int main(int argc, char *argv[])
 		printf("Bpp=%d\n", sdl_surface->format->BytesPerPixel);
 	}
 
-	while (1) {
-		cpu.remains_clks += 280000;
+	std::chrono::steady_clock::time_point wall = std::chrono::steady_clock::now();
+	u64 idle_clks = 0;
+	u64 frames = 0, guest_clks = 0;
+	std::vector<double> slice_ms;
+	while (!quit) {
+		std::chrono::steady_clock::time_point t0 =
+			std::chrono::steady_clock::now();
+		cpu.remains_clks += SLICE_CLKS;
 		cpu.exit_clks = 0;
 		do {
 			ev.check0();
 			cpu.remains_clks = cpu.exec();
 			ev.check();
 		} while (cpu.remains_clks > 0);
+#ifdef OP_PROFILE
+		if (dump_profile) {
+			dump_profile = 0;
+			cpu.report_profile();
+		}
+#endif
+		if (bench) {
+			slice_ms.push_back(std::chrono::duration<double, std::milli>(
+				std::chrono::steady_clock::now() - t0).count());
+			frames++;
+			guest_clks += SLICE_CLKS;
+			if (frames >= bench_frames || guest_clks >= bench_clks ||
+			    cpu.get_insns() >= bench_insns) {
+				break;
+			}
+			continue;
+		}
+
+		// スライスの中でHLTしていたら(ゲストが暇なら)、スライスの終わりの
+		// 実時間まで寝る。HLTしないゲストは全速で動かす
+		wall += std::chrono::microseconds((u64)SLICE_CLKS * 1000000 / CPU_HZ);
+		if (cpu.get_idle_clks() != idle_clks) {
+			idle_clks = cpu.get_idle_clks();
+			std::this_thread::sleep_until(wall);
+		}
+		// 遅れは取り戻さない
+		if (wall < std::chrono::steady_clock::now()) {
+			wall = std::chrono::steady_clock::now();
+		}
 
 		if (use_video) {
 
@@ -84,10 +275,10 @@ int main(int argc, char *argv[])
 				mem.write8(0xcff81, 0xc0);
 				a = mem.read8(0xc0000 + i);
 #else
-				b = mem.read8(0x80000000 + i);
-				r = mem.read8(0x80008000 + i);
-				g = mem.read8(0x80010000 + i);
-				a = mem.read8(0x80018000 + i);
+				b = mem.phys_read8(0x80000000 + i);
+				r = mem.phys_read8(0x80008000 + i);
+				g = mem.phys_read8(0x80010000 + i);
+				a = mem.phys_read8(0x80018000 + i);
 #endif
 				for (int j = 0; j < 8; j++) {
 					// 各プレーンから1bitずつデータを取ってくる
@@ -104,6 +295,23 @@ int main(int argc, char *argv[])
 		}
 	}
 	SDL_Quit();
+	if (bench) {
+		bench_report(frames, guest_clks, cpu.get_insns(),
+			     cpu.get_idle_clks(), slice_ms);
+	}
+	delete trace;
+	if (sampler) {
+		sampler->report();
+		delete sampler;
+	}
+#ifdef OP_PROFILE
+	cpu.report_profile();
+#endif
+	if (mem.get_page_walks() > 0) {
+		printf("page walks %llu, TLB flushes %llu\n",
+		       (unsigned long long)mem.get_page_walks(),
+		       (unsigned long long)mem.get_tlb_flushes());
+	}
 
 	return 0;
 }
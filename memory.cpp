@@ -1,34 +1,103 @@
+#include <cstdio> // for printf()
 #include <cstdlib> // for malloc(), size_t, exit()
 #include <cstring> // for memset()
-#include <fstream>
+#include <fcntl.h> // for open()
+#include <sys/mman.h> // for mmap()
+#include <sys/stat.h> // for fstat()
+#include <unistd.h> // for read(), close()
 #include "memory.h"
 
-Memory::Memory(u32 size) {
+/*
+  ROMファイルを読み込み専用でmmapする
+  - 同じファイルを開いた他のプロセスとも物理メモリを共有でき、
+    起動時のコピーもない。ROMのページはそのままページマップに入れる
+  - 書き込むとSIGSEGVになるので、ページマップではROMのwpageをNULLにして
+    書き込みをハンドラで処理すること
+  - ファイルがsizeより短ければmmapできない(ファイルの末尾をこえると
+    SIGBUSになる)ので、mallocして読み込み、残りを0xffで埋める
+ */
+static u8 *map_rom(const char *path, u32 size)
+{
+	struct stat st;
+	void *p;
+	u8 *buf;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		printf("can't open %s\n", path);
+		exit(1);
+	}
+	if (fstat(fd, &st) == 0 && st.st_size >= (off_t)size) {
+		p = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+		if (p != MAP_FAILED) {
+			close(fd);
+			return (u8 *)p;
+		}
+	}
+	buf = (u8 *)malloc((size_t)size);
+	memset(buf, 0xff, size);
+	if (read(fd, buf, size) < 0) {
+		printf("can't read %s\n", path);
+		exit(1);
+	}
+	close(fd);
+	return buf;
+}
+
+Memory::Memory(u32 size, const u8 *rom, u32 rom_size) {
 	ram = (u8 *)malloc((size_t)size);
 	memset(ram, 0, size);
 	ram_size = size;
-	sysrom = (u8 *)malloc((size_t)SYSROM_SIZE);
-	osrom = (u8 *)malloc((size_t)OSROM_SIZE);
 	vram = (u8 *)malloc((size_t)VRAM_SIZE);
 	memset(vram, 0, VRAM_SIZE);
 	mem = this;
-	
-	// システムROMの読み込み
-	std::ifstream fin("roms/FMT_SYS.ROM", std::ios::in | std::ios::binary);
-	if (!fin) {
-		exit(1);
+
+	if (rom) {
+		// 渡されたイメージをシステムROMの末尾に置く(リセットベクタが
+		// 末尾に来る)。OS-ROMは空
+		sysrom = (u8 *)malloc((size_t)SYSROM_SIZE);
+		osrom = (u8 *)malloc((size_t)OSROM_SIZE);
+		memset(sysrom, 0xff, SYSROM_SIZE);
+		memcpy(sysrom + SYSROM_SIZE - rom_size, rom, rom_size);
+		memset(osrom, 0xff, OSROM_SIZE);
+	} else {
+		// システムROM, OS-ROM
+		sysrom = map_rom("roms/FMT_SYS.ROM", SYSROM_SIZE);
+		osrom = map_rom("roms/FMT_DOS.ROM", OSROM_SIZE);
 	}
-	fin.read((char *)sysrom, SYSROM_SIZE);
-	fin.close();
 
-	// OS-ROMの読み込み
-	std::ifstream fin2("roms/FMT_DOS.ROM", std::ios::in | std::ios::binary);
-	if (!fin2) {
-		exit(1);
+	rpage = (u8 **)calloc(NR_PAGES, sizeof(u8 *));
+	wpage = (u8 **)calloc(NR_PAGES, sizeof(u8 *));
+	wpage_host = (u8 **)calloc(NR_PAGES, sizeof(u8 *));
+	page_gen = (u32 *)calloc(NR_PAGES, sizeof(u32));
+	phys_rpage = (u8 **)calloc(NR_PAGES, sizeof(u8 *));
+	phys_wpage = (u8 **)calloc(NR_PAGES, sizeof(u8 *));
+	nr_gen_hooks = 0;
+	wlog = NULL;
+	wlog_arg = NULL;
+
+	for (int i = 0; i < TLB_SIZE; i++) {
+		tlb[i].lin = TLB_INVALID;
 	}
-	fin2.read((char *)osrom, OSROM_SIZE);
-	fin2.close();
+	paging = false;
+	cr3 = 0;
+	page_walks = 0;
+	tlb_flushes = 0;
+
+	// バンク切り替えのない領域はここで一度だけ割り当てる
+	// RAM
+	map_pages(0, ram_size, ram, ram);
+
+	// VRAM
+	map_pages(0x80000000, VRAM_SIZE, vram, vram);
+	map_pages(0x80100000, VRAM_SIZE, vram, vram);
+
+	// SYSTEM ROM(BOOT ROM), OS-ROM (書き込みはハンドラで処理)
+	map_pages(0xfffc0000, SYSROM_SIZE, sysrom, NULL);
+	map_pages(0xc2000000, OSROM_SIZE, osrom, NULL);
 
+	update_page_map();
 }
 
 /* memory mapped I/O */
@@ -37,7 +106,237 @@ Memory::Memory(u32 size) {
 // グラフィックVRAMページセレクトレジスタ
 #define GVRAM_PGSEL_REG 0xcff83
 
+// 物理アドレスaddrからsizeバイト分のページにホスト側のポインタを割り当てる
+// rp, wpがNULLのページはハンドラ経由でアクセスする
+// 割り当てが変わると中身も変わるので、ページの世代を進めて監視を解除する
+// (ページングが有効なら、そのページを指しているTLBのエントリを捨てる)
+void Memory::map_pages(u32 addr, u32 size, u8 *rp, u8 *wp) {
+	u32 page;
+
+	for (u32 i = 0; i < size >> PAGE_SHIFT; i++) {
+		page = (addr >> PAGE_SHIFT) + i;
+		phys_rpage[page] = rp? rp + (i << PAGE_SHIFT) : NULL;
+		phys_wpage[page] = wp? wp + (i << PAGE_SHIFT) : NULL;
+		if (!paging) {
+			rpage[page] = phys_rpage[page];
+			set_wpage(page, phys_wpage[page]);
+			bump_gen(page);
+		}
+	}
+	if (paging) {
+		for (int i = 0; i < TLB_SIZE; i++) {
+			if (tlb[i].lin != TLB_INVALID &&
+			    tlb[i].phys - addr < size) {
+				tlb_evict(&tlb[i]);
+			}
+		}
+	}
+}
+
+// CR0.PGが変わったら、rpage, wpage(_host)をリニアアドレス用(空のTLB)と
+// 物理アドレス用で入れ替える。全ページの世代を進める
+void Memory::set_paging(bool pg) {
+	if (pg == paging) {
+		return;
+	}
+	flush_tlb();
+	paging = pg;
+	for (u32 page = 0; page < NR_PAGES; page++) {
+		rpage[page] = pg? NULL : phys_rpage[page];
+		set_wpage(page, pg? NULL : phys_wpage[page]);
+		page_gen[page]++;
+	}
+	if (nr_gen_hooks) {
+		notify_gen(PAGE_ALL);
+	}
+}
+
+// CR3が書き込まれたらTLBを全て捨てる
+void Memory::set_cr3(u32 n) {
+	cr3 = n;
+	if (paging) {
+		flush_tlb();
+	}
+}
+
+void Memory::flush_tlb(void) {
+	for (int i = 0; i < TLB_SIZE; i++) {
+		tlb_evict(&tlb[i]);
+	}
+	tlb_flushes++;
+}
+
+// TLBのエントリを捨てて、そのページをrpage, wpage(_host)から外す
+void Memory::tlb_evict(struct _tlb *t) {
+	if (t->lin == TLB_INVALID) {
+		return;
+	}
+	rpage[t->lin] = NULL;
+	set_wpage(t->lin, NULL);
+	bump_gen(t->lin);
+	t->lin = TLB_INVALID;
+}
+
+/*
+  リニアアドレスaddrを物理アドレスに変換して*paに入れる
+  - TLBになければページテーブルを引いてTLBに載せ、物理ページがホスト側の
+    メモリならrpage(書き込みならwpage, wpage_hostも)にポインタを入れる
+  - ページテーブルのA(書き込みならDも)ビットを立てる
+  - PDEかPTEのPビットが立っていなければfalseを返す
+ */
+bool Memory::translate(u32 addr, bool write, u32 *pa) {
+	u32 page = addr >> PAGE_SHIFT;
+	struct _tlb *t = &tlb[page & (TLB_SIZE - 1)];
+	u32 pde_adr, pde, pte_adr, pte;
+
+	if (t->lin == page && (!write || t->dirty)) {
+		*pa = t->phys | (addr & PAGE_MASK);
+		return true;
+	}
+
+	page_walks++;
+	pde_adr = (cr3 & ~PAGE_MASK) + (addr >> 22 << 2);
+	pde = phys_read32(pde_adr);
+	if (!(pde & PTE_P)) {
+		return false;
+	}
+	pte_adr = (pde & ~PAGE_MASK) + ((page & 0x3ff) << 2);
+	pte = phys_read32(pte_adr);
+	if (!(pte & PTE_P)) {
+		return false;
+	}
+	if (!(pde & PTE_A)) {
+		phys_write32(pde_adr, pde | PTE_A);
+	}
+	if (!(pte & PTE_A) || (write && !(pte & PTE_D))) {
+		pte |= PTE_A | (write? PTE_D : 0);
+		phys_write32(pte_adr, pte);
+	}
+
+	if (t->lin != page) {
+		tlb_evict(t);
+	}
+	t->lin = page;
+	t->phys = pte & ~PAGE_MASK;
+	t->perm = pde & pte & (PTE_RW | PTE_US);
+	t->dirty = pte & PTE_D;
+	rpage[page] = phys_rpage[t->phys >> PAGE_SHIFT];
+	set_wpage(page, t->dirty? phys_wpage[t->phys >> PAGE_SHIFT] : NULL);
+
+	*pa = t->phys | (addr & PAGE_MASK);
+	return true;
+}
+
+// xxx ページフォルト(例外14)は未実装
+void Memory::page_fault(u32 addr, bool write) {
+	printf("page fault. %s addr=0x%x\n\n", write? "write" : "read", addr);
+	exit(1);
+}
+
+// バンク切り替えのある領域のページマップを作り直す
+// I/O 0x404, 0x480とGVRAMのレジスタが変更された時に呼ぶこと
+void Memory::update_page_map(void) {
+	u8 tmp, tmp2;
+	u8 io404, io480;
+
+	// IOより先にMemoryが生成されるので、その間は0とみなす
+	io404 = io? io->read8(0x404) : 0;
+	io480 = io? io->read8(0x480) : 0;
+
+	// メインメモリ/VRAM (I/O 0x404の7bit目で決まる)
+	// 書き込みは各プレーンへの書き込みがあるのでハンドラで処理する
+	if (!(io404 & 0x80)) {
+		tmp = ram[GVRAM_UPD_REG];
+		tmp2 = ram[GVRAM_PGSEL_REG];
+		map_pages(0xc0000, 0x8000, vram + (tmp >> 6) * 0x8000 + ((tmp2 >> 4) & 1) * 0x20000, NULL);
+	} else {
+		map_pages(0xc0000, 0x8000, ram + 0xc0000, ram + 0xc0000);
+	}
+
+	// GVRAMのレジスタが変更されたらページマップを作り直すので
+	// 書き込みはハンドラで処理する
+	map_pages(GVRAM_UPD_REG & ~PAGE_MASK, PAGE_SIZE, ram + (GVRAM_UPD_REG & ~PAGE_MASK), NULL);
+
+	// BOOT ROM (I/O 0x480の1bit目で決まる。書き込みはRAMに対して行う)
+	if (!(io480 & 2)) {
+		map_pages(0xf8000, 0x8000, sysrom + 0x38000, ram + 0xf8000);
+	} else {
+		map_pages(0xf8000, 0x8000, ram + 0xf8000, ram + 0xf8000);
+	}
+}
+
+// 命令キャッシュに登録するページの書き込みを監視する
+// ホスト側のメモリに割り当たっていないページはキャッシュできないのでfalseを返す
+bool Memory::watch_page(u32 addr) {
+	u32 page = addr >> PAGE_SHIFT;
+
+	if (!rpage[page]) {
+		return false;
+	}
+	wpage[page] = NULL;
+	return true;
+}
+
+// 記録をやめたら、wpageはwrite8_slow()で1ページずつ元に戻る
+void Memory::set_write_log(void (*fn)(void *arg, u32 addr, u8 data), void *arg) {
+	wlog = fn;
+	wlog_arg = arg;
+	if (fn) {
+		for (u32 page = 0; page < NR_PAGES; page++) {
+			wpage[page] = NULL;
+		}
+	}
+}
+
+void Memory::subscribe_gen(void (*fn)(void *arg, u32 page), void *arg) {
+	if (nr_gen_hooks == MAX_GEN_HOOKS) {
+		printf("too many page generation hooks\n");
+		exit(1);
+	}
+	gen_hook[nr_gen_hooks].fn = fn;
+	gen_hook[nr_gen_hooks].arg = arg;
+	nr_gen_hooks++;
+}
+
+void Memory::notify_gen(u32 page) {
+	for (int i = 0; i < nr_gen_hooks; i++) {
+		gen_hook[i].fn(gen_hook[i].arg, page);
+	}
+}
+
 u8 Memory::read8(u32 addr) {
+	u8 *p = rpage[addr >> PAGE_SHIFT];
+
+	if (p) {
+		return p[addr & PAGE_MASK];
+	}
+	return read8_slow(addr);
+}
+
+// TLBミスとホスト側のメモリにないページ
+u8 Memory::read8_slow(u32 addr) {
+	u32 pa;
+
+	if (!paging) {
+		return phys_read8_slow(addr);
+	}
+	if (!translate(addr, false, &pa)) {
+		page_fault(addr, false);
+		return 0xff;
+	}
+	return phys_read8(pa);
+}
+
+u8 Memory::phys_read8(u32 addr) {
+	u8 *p = phys_rpage[addr >> PAGE_SHIFT];
+
+	if (p) {
+		return p[addr & PAGE_MASK];
+	}
+	return phys_read8_slow(addr);
+}
+
+u8 Memory::phys_read8_slow(u32 addr) {
 	u8 tmp, tmp2;
 
 	/*
@@ -95,8 +394,8 @@ u8 Memory::read8(u32 addr) {
 			return *(ram + addr);
 		}
 		if (addr >= 0xc0000 && addr < 0xc8000) {
-			tmp = this->read8(GVRAM_UPD_REG);
-			tmp2 = this->read8(GVRAM_PGSEL_REG);
+			tmp = ram[GVRAM_UPD_REG];
+			tmp2 = ram[GVRAM_PGSEL_REG];
 			return *(vram + (tmp >> 6) * 0x8000 + ((tmp2 >> 4) & 1) * 0x20000 + addr - 0xc0000);
 		}
 	}
@@ -129,6 +428,52 @@ u8 Memory::read8(u32 addr) {
 }
 
 void Memory::write8(u32 addr, u8 data) {
+	u8 *p = wpage[addr >> PAGE_SHIFT];
+
+	if (p) {
+		p[addr & PAGE_MASK] = data;
+		return;
+	}
+	write8_slow(addr, data);
+}
+
+void Memory::write8_slow(u32 addr, u8 data) {
+	u32 page = addr >> PAGE_SHIFT;
+	u32 pa;
+
+	if (wlog) {
+		wlog(wlog_arg, addr, data);
+	}
+	// 監視中のページなら世代を進めて監視を解除する
+	// (rpageのないページはキャッシュされていないので世代を進めない)
+	// xxx 書き込みを記録している間は、監視していないページでも進める
+	if (rpage[page]) {
+		bump_gen(page);
+	}
+	set_wpage(page, wpage_host[page]);
+	if (wpage_host[page]) {
+		wpage_host[page][addr & PAGE_MASK] = data;
+		return;
+	}
+	if (!paging) {
+		phys_write8_slow(addr, data);
+		return;
+	}
+
+	// TLBミス、またはDビットが立っていない
+	if (!translate(addr, true, &pa)) {
+		page_fault(addr, true);
+		return;
+	}
+	if (wpage_host[page]) {
+		wpage_host[page][addr & PAGE_MASK] = data;
+		return;
+	}
+	phys_write8_slow(pa, data);
+}
+
+// ホスト側のメモリに割り当たっていない物理アドレスへの書き込み
+void Memory::phys_write8_slow(u32 addr, u8 data) {
 	u8 tmp, tmp2;
 	u32 addr2;
 	u8 *p;
@@ -137,11 +482,14 @@ void Memory::write8(u32 addr, u8 data) {
 	if (addr >= 0xc0000 && addr < 0xf0000) {
 		if (io->read8(0x404) & 0x80) {
 			*(ram + addr) = data;
+			if (addr == GVRAM_UPD_REG || addr == GVRAM_PGSEL_REG) {
+				update_page_map();
+			}
 			return;
 		}
 		if (addr >= 0xc0000 && addr < 0xc8000) {
-			tmp = this->read8(GVRAM_UPD_REG);
-			tmp2 = this->read8(GVRAM_PGSEL_REG);
+			tmp = ram[GVRAM_UPD_REG];
+			tmp2 = ram[GVRAM_PGSEL_REG];
 			p = vram + ((tmp2 >> 4) & 1) * 0x20000;
 			addr2 = addr - 0xc0000;
 			// 各プレーンに書き込み
@@ -164,6 +512,9 @@ void Memory::write8(u32 addr, u8 data) {
 	// RAM
 	if (addr < ram_size) {
 		*(ram + addr) = data;
+		if (addr == GVRAM_UPD_REG || addr == GVRAM_PGSEL_REG) {
+			update_page_map();
+		}
 		return;
 	}
 
@@ -183,22 +534,73 @@ void Memory::write8(u32 addr, u8 data) {
 	exit(1);
 }
 
+// ページをまたがずホスト側のメモリに割り当たっている場合はまとめて読み書きする
+// それ以外(ページ境界、MMIO)はバイト単位に分割する
 u16 Memory::read16(u32 addr) {
+	u8 *p = rpage[addr >> PAGE_SHIFT];
+
+	if (p && (addr & PAGE_MASK) <= PAGE_SIZE - 2) {
+		return load16le(p + (addr & PAGE_MASK));
+	}
 	return (read8(addr + 1) << 8) + read8(addr);
 }
 
 void Memory::write16(u32 addr, u16 data) {
+	u8 *p = wpage[addr >> PAGE_SHIFT];
+
+	if (p && (addr & PAGE_MASK) <= PAGE_SIZE - 2) {
+		store16le(p + (addr & PAGE_MASK), data);
+		return;
+	}
 	write8(addr, (u8)data);
 	write8(addr + 1, data >> 8);
 }
 
 u32 Memory::read32(u32 addr) {
+	u8 *p = rpage[addr >> PAGE_SHIFT];
+
+	if (p && (addr & PAGE_MASK) <= PAGE_SIZE - 4) {
+		return load32le(p + (addr & PAGE_MASK));
+	}
 	return (read8(addr + 3) << 24) + (read8(addr + 2) << 16) + (read8(addr + 1) << 8) + read8(addr);
 }
 
 void Memory::write32(u32 addr, u32 data) {
+	u8 *p = wpage[addr >> PAGE_SHIFT];
+
+	if (p && (addr & PAGE_MASK) <= PAGE_SIZE - 4) {
+		store32le(p + (addr & PAGE_MASK), data);
+		return;
+	}
 	write8(addr, (u8)data);
 	write8(addr + 1, data >> 8);
 	write8(addr + 2, data >> 16);
 	write8(addr + 3, data >> 24);
 }
+
+// ページテーブルの読み書き (物理アドレス)
+u32 Memory::phys_read32(u32 addr) {
+	u8 *p = phys_rpage[addr >> PAGE_SHIFT];
+
+	if (p && (addr & PAGE_MASK) <= PAGE_SIZE - 4) {
+		return load32le(p + (addr & PAGE_MASK));
+	}
+	return (phys_read8(addr + 3) << 24) + (phys_read8(addr + 2) << 16) + (phys_read8(addr + 1) << 8) + phys_read8(addr);
+}
+
+void Memory::phys_write32(u32 addr, u32 data) {
+	u8 *p = phys_wpage[addr >> PAGE_SHIFT];
+
+	if (p && (addr & PAGE_MASK) <= PAGE_SIZE - 4) {
+		store32le(p + (addr & PAGE_MASK), data);
+		return;
+	}
+	for (int i = 0; i < 4; i++) {
+		p = phys_wpage[(addr + i) >> PAGE_SHIFT];
+		if (p) {
+			p[(addr + i) & PAGE_MASK] = data >> (i * 8);
+		} else {
+			phys_write8_slow(addr + i, data >> (i * 8));
+		}
+	}
+}
@@ -1,3 +1,4 @@
+#pragma once
 #include "types.h"
 #include "bus.h"
 
@@ -5,6 +6,12 @@
 #define OSROM_SIZE 512*1024
 #define VRAM_SIZE 512*1024
 
+// ページマップは4KB単位
+#define PAGE_SHIFT 12
+#define PAGE_SIZE (1 << PAGE_SHIFT)
+#define PAGE_MASK (PAGE_SIZE - 1)
+#define NR_PAGES (1 << (32 - PAGE_SHIFT))
+
 class Memory : public BUS {
 private:
 	u8 *ram;
@@ -13,15 +20,129 @@ private:
 	u8 *osrom;
 	u8 *vram;
 	Memory *memo;
+
+	/*
+	  ページマップ
+	  - 4KBページごとにホスト側のポインタを持つ
+	  - rpage, wpage, wpage_hostはリニアアドレスで引く。ページングが
+	    無効ならphys_rpage, phys_wpageと同じ内容になる
+	  - NULLのページはMMIOやバンク切り替え、TLBミスなどの処理が必要なので
+	    read8_slow()/write8_slow()で処理する
+	  - バンク切り替えレジスタが変更された時だけ作り直す
+	  - 命令キャッシュに登録されたページはwpageをNULLにして書き込みを
+	    監視し、書き込まれたらページの世代(page_gen)を進める
+	  - 世代を進めるのはbump_gen()だけで行い、subscribe_gen()で登録された
+	    関数に知らせる。世代を毎回比べたくないキャッシュはこれで無効にする
+	 */
+	u8 **rpage; // 読み込み用
+	u8 **wpage; // 書き込み用 (監視中のページはNULL)
+	u8 **wpage_host; // 書き込み用 (監視していない時の値)
+	u32 *page_gen; // ページの書き込み世代
+	u8 **phys_rpage; // 物理アドレスのページマップ (読み込み用)
+	u8 **phys_wpage; // 物理アドレスのページマップ (書き込み用)
+
+#define MAX_GEN_HOOKS 4
+	struct _gen_hook {
+		void (*fn)(void *arg, u32 page);
+		void *arg;
+	} gen_hook[MAX_GEN_HOOKS];
+	int nr_gen_hooks;
+	void bump_gen(u32 page) {
+		page_gen[page]++;
+		if (nr_gen_hooks) {
+			notify_gen(page);
+		}
+	}
+	void notify_gen(u32 page);
+
+	// 書き込みの記録 (トレース用)。有効な間はwpageを全てNULLにして、
+	// 全ての書き込みをwrite8_slow()に通す
+	void (*wlog)(void *arg, u32 addr, u8 data);
+	void *wlog_arg;
+	void set_wpage(u32 page, u8 *p) {
+		wpage_host[page] = p;
+		wpage[page] = wlog? NULL : p;
+	}
+
+	/*
+	  ページングユニット (CR0.PG, CR3)
+	  - ダイレクトマップのソフトウェアTLBで、リニアアドレスのページから
+	    物理アドレスのページと権限を引く
+	  - TLBに載っているページだけrpage, wpage(_host)にホスト側のポインタを
+	    入れる。TLBに当たればページングが無効な時と同じ速さで読み書きできる
+	  - 書き込み用のポインタはDビットを立ててから入れる
+	  - TLBから追い出したページは世代を進める(命令キャッシュ等を無効にする)
+	  - xxx CPLを管理していないので、常にスーパーバイザとしてアクセスする
+	    (386にはCR0.WPがないので、書き込み禁止のページにも書ける)
+	  - xxx 別名のリニアアドレスからの書き込みは監視できない
+	 */
+#define TLB_SIZE 1024
+#define PTE_P 0x001 // present
+#define PTE_RW 0x002 // read/write
+#define PTE_US 0x004 // user/supervisor
+#define PTE_A 0x020 // accessed
+#define PTE_D 0x040 // dirty
+	struct _tlb {
+		u32 lin; // リニアアドレスのページ番号 (TLB_INVALIDなら空き)
+		u32 phys; // 物理アドレス(ページの先頭)
+		u8 perm; // PDEとPTEのPTE_RW, PTE_USのAND
+		bool dirty; // PTEのDが立っている(書き込める)
+	} tlb[TLB_SIZE];
+#define TLB_INVALID 0xffffffff
+	bool paging;
+	u32 cr3;
+	u64 page_walks; // TLBミスでページテーブルを引いた回数
+	u64 tlb_flushes;
+
+	void map_pages(u32 addr, u32 size, u8 *rp, u8 *wp);
+	bool translate(u32 addr, bool write, u32 *pa);
+	void tlb_evict(struct _tlb *t);
+	void flush_tlb(void);
+	void page_fault(u32 addr, bool write);
+	u8 read8_slow(u32 addr);
+	void write8_slow(u32 addr, u8 data);
+	u8 phys_read8_slow(u32 addr);
+	void phys_write8_slow(u32 addr, u8 data);
+	u32 phys_read32(u32 addr);
+	void phys_write32(u32 addr, u32 data);
  public:
 	/*-----
 	  コンストラクタ・デストラクタは戻り値を取れない [2019-07-28]
 	  -----*/
-	Memory(u32 size);
+	// romを渡すとROMファイルを読まずに、そのイメージ(rom_sizeバイト、
+	// SYSROM_SIZE以下)をシステムROMにする (ベンチマーク用)
+	Memory(u32 size, const u8 *rom = NULL, u32 rom_size = 0);
+	void update_page_map(void);
+	bool watch_page(u32 addr);
+	/*
+	  ページの世代が進んだらfn(arg, ページ番号)を呼ぶ
+	  - 全ページの世代が進んだ時(CR0.PGの変更)はページ番号の代わりに
+	    PAGE_ALLを渡す
+	  - fnは書き込みの途中で呼ばれるので、メモリにアクセスしてはいけない
+	 */
+#define PAGE_ALL 0xffffffff
+	void subscribe_gen(void (*fn)(void *arg, u32 page), void *arg);
+	u32 get_page_gen(u32 addr) { return page_gen[addr >> PAGE_SHIFT]; }
+	/*
+	  書き込みごとにfn(arg, リニアアドレス, データ)を呼ぶ (NULLで解除)
+	  - 16bit, 32bitの書き込みも1バイトずつ、下位から渡す
+	  - 記録している間はホスト側のメモリへの書き込みも遅くなる
+	 */
+	void set_write_log(void (*fn)(void *arg, u32 addr, u8 data), void *arg);
+	u8 **get_rpage(void) { return rpage; }
+	u8 **get_wpage(void) { return wpage; }
 	u8 read8(u32 addr);
 	void write8(u32 addr, u8 data);
 	u16 read16(u32 addr);
 	void write16(u32 addr, u16 data);
 	u32 read32(u32 addr);
 	void write32(u32 addr, u32 data);
+
+	// ページング (CR0.PG, CR3の書き込みで呼ぶ)
+	void set_paging(bool pg);
+	void set_cr3(u32 cr3);
+	u64 get_page_walks(void) { return page_walks; }
+	u64 get_tlb_flushes(void) { return tlb_flushes; }
+	// ページングを通さずに物理アドレスで読む (画面表示など)
+	u8 phys_read8(u32 addr);
 };
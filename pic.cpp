@@ -0,0 +1,188 @@
+#include <cstring> // for memset()
+#include "pic.h"
+
+PIC::PIC(void) {
+	pic = this;
+	memset(chip, 0, sizeof(chip));
+	for (int i = 0; i < 2; i++) {
+		chip[i].imr = 0xff;
+	}
+	intr = NULL;
+}
+
+// CPUのINT入力をつなぐ
+void PIC::connect(u8 *intr) {
+	this->intr = intr;
+	update();
+}
+
+// 受け付けられる最も優先順位の高い要求のIR (なければ-1)
+// 処理中(ISR)の割り込みより優先順位が低い要求は受け付けない
+int PIC::highest(struct _i8259 *c) {
+	u8 req = c->irr & ~c->imr;
+
+	for (int ir = 0; ir < 8; ir++) {
+		if (c->isr & 1 << ir) {
+			return -1;
+		}
+		if (req & 1 << ir) {
+			return ir;
+		}
+	}
+	return -1;
+}
+
+bool PIC::int_out(struct _i8259 *c) {
+	return highest(c) >= 0;
+}
+
+// IR線の状態を変える
+// エッジトリガ(ICW1のLTIM=0)なら立ち上がりでIRRを立て、レベルトリガなら
+// 線の状態がそのままIRRになる。どちらも線が下がったら要求は取り下げる
+void PIC::set_line(struct _i8259 *c, u8 ir, bool level) {
+	u8 bit = 1 << ir;
+
+	if (level) {
+		if (!(c->lines & bit) || (c->icw[1] & 0x08)) {
+			c->irr |= bit;
+		}
+		c->lines |= bit;
+	} else {
+		c->irr &= ~bit;
+		c->lines &= ~bit;
+	}
+}
+
+// スレーブのINTをマスタのIR7に伝え、マスタのINTをCPUに伝える
+void PIC::update(void) {
+	set_line(&chip[0], PIC_CASCADE, int_out(&chip[1]));
+	if (intr) {
+		*intr = int_out(&chip[0]);
+	}
+}
+
+void PIC::set_irq(u8 irq, bool level) {
+	set_line(&chip[irq >> 3], irq & 7, level);
+	update();
+}
+
+/*
+  INTA (CPUが割り込みを受け付けた)
+  - 最も優先順位の高い要求をISRに移し、ベクタ番号を返す
+  - スレーブの要求ならスレーブのベクタ番号を返す
+  - 要求がなければ(スプリアス)IR7のベクタ番号を返す
+ */
+u8 PIC::ack(void) {
+	struct _i8259 *c = &chip[0];
+	int ir = highest(c);
+
+	if (ir == PIC_CASCADE && int_out(&chip[1])) {
+		c->isr |= 1 << ir;
+		c->irr &= ~(1 << ir);
+		if (c->icw[4] & 0x02) { // AEOI
+			c->isr &= ~(1 << ir);
+		}
+		c = &chip[1];
+		ir = highest(c);
+	}
+	if (ir < 0) {
+		return c->icw[2] + 7;
+	}
+	c->isr |= 1 << ir;
+	c->irr &= ~(1 << ir);
+	if (c->icw[4] & 0x02) { // AEOI
+		c->isr &= ~(1 << ir);
+	}
+	update();
+	return c->icw[2] + ir;
+}
+
+u8 PIC::read_chip(struct _i8259 *c, u32 addr) {
+	if (addr & 2) {
+		return c->imr;
+	}
+	return c->read_isr? c->isr : c->irr;
+}
+
+void PIC::write_chip(struct _i8259 *c, u32 addr, u8 data) {
+	if (!(addr & 2)) {
+		if (data & 0x10) { // ICW1
+			c->icw[1] = data;
+			c->icw_step = 2;
+			c->irr = 0;
+			c->isr = 0;
+			c->imr = 0;
+			c->read_isr = false;
+			return;
+		}
+		if (data & 0x08) { // OCW3
+			if (data & 0x02) {
+				c->read_isr = data & 0x01;
+			}
+			return;
+		}
+		// OCW2
+		switch (data >> 5) {
+		case 1: // non-specific EOI
+		case 5: // rotate on non-specific EOI (xxx 回転はしない)
+			for (int ir = 0; ir < 8; ir++) {
+				if (c->isr & 1 << ir) {
+					c->isr &= ~(1 << ir);
+					break;
+				}
+			}
+			break;
+		case 3: // specific EOI
+		case 7: // rotate on specific EOI (xxx 回転はしない)
+			c->isr &= ~(1 << (data & 7));
+			break;
+		}
+		return;
+	}
+
+	switch (c->icw_step) {
+	case 2:
+		c->icw[2] = data & 0xf8;
+		// SNGL=0ならICW3、IC4=1ならICW4が続く
+		c->icw_step = !(c->icw[1] & 0x02)? 3 : (c->icw[1] & 0x01)? 4 : 0;
+		break;
+	case 3:
+		c->icw[3] = data;
+		c->icw_step = (c->icw[1] & 0x01)? 4 : 0;
+		break;
+	case 4:
+		c->icw[4] = data;
+		c->icw_step = 0;
+		break;
+	default: // OCW1
+		c->imr = data;
+		break;
+	}
+}
+
+u8 PIC::read8(u32 addr) {
+	return read_chip(&chip[(addr >> 4) & 1], addr);
+}
+
+void PIC::write8(u32 addr, u8 data) {
+	write_chip(&chip[(addr >> 4) & 1], addr, data);
+	update();
+}
+
+u16 PIC::read16(u32 addr) {
+	return (read8(addr + 1) << 8) + read8(addr);
+}
+
+void PIC::write16(u32 addr, u16 data) {
+	write8(addr, (u8)data);
+	write8(addr + 1, data >> 8);
+}
+
+u32 PIC::read32(u32 addr) {
+	return (read16(addr + 2) << 16) + read16(addr);
+}
+
+void PIC::write32(u32 addr, u32 data) {
+	write16(addr, (u16)data);
+	write16(addr + 2, data >> 16);
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include "types.h"
+#include "bus.h"
+
+/*
+  割り込みコントローラ i8259A (マスタ/スレーブ)
+  - FM TOWNSではマスタがI/O 0x00, 0x02、スレーブがI/O 0x10, 0x12にあり、
+    スレーブはマスタのIR7に接続されている
+  - デバイスはset_irq()でIRQ線(0～15, 8～15はスレーブ)の状態を変える。
+    デバイスの都合のタイミングで割り込みを上げる場合は、Eventに登録した
+    関数から呼ぶ
+  - IRQ線、IMR、ISRが変わった時だけCPUへのINT出力を求め直して、
+    connect()で渡されたフラグに書く。CPUは命令の境界でこのフラグだけを
+    見ればよく、デバイスをポーリングしない
+  - xxx 優先順位の回転、スペシャルマスクモード、ポーリングは未実装
+    (常にIR0が最優先)
+ */
+#define PIC_CASCADE 7 // スレーブをつないでいるマスタのIR
+
+class PIC : public BUS {
+private:
+	struct _i8259 {
+		u8 irr; // 割り込み要求
+		u8 isr; // 処理中
+		u8 imr; // マスク
+		u8 lines; // IRQ線の状態 (エッジの検出用)
+		u8 icw[5]; // icw[1]～icw[4]
+		u8 icw_step; // 次に書くICWの番号 (0ならOCW)
+		bool read_isr; // ポート0で読むのがISR (OCW3)
+	} chip[2];
+	u8 *intr; // CPUへのINT出力 (NULLならつながっていない)
+
+	int highest(struct _i8259 *c);
+	bool int_out(struct _i8259 *c);
+	void set_line(struct _i8259 *c, u8 ir, bool level);
+	void update(void);
+	u8 read_chip(struct _i8259 *c, u32 addr);
+	void write_chip(struct _i8259 *c, u32 addr, u8 data);
+public:
+	PIC(void);
+	void connect(u8 *intr);
+	void set_irq(u8 irq, bool level);
+	u8 ack(void);
+	u8 read8(u32 addr);
+	void write8(u32 addr, u8 data);
+	u16 read16(u32 addr);
+	void write16(u32 addr, u16 data);
+	u32 read32(u32 addr);
+	void write32(u32 addr, u32 data);
+};
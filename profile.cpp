@@ -0,0 +1,93 @@
+#ifdef OP_PROFILE
+#include <cstdio> // for printf()
+#include <algorithm> // for sort()
+#include <vector>
+#include "profile.h"
+
+OpProfile::OpProfile() {
+	for (int i = 0; i < PROF_KEYS; i++) {
+		count[i] = 0;
+	}
+	for (int i = 0; i < PROF_OPS; i++) {
+		ns[i] = 0;
+		samples[i] = 0;
+	}
+	left = 0;
+	seed = 1;
+}
+
+// 命令の1バイト目(0x0fなら2バイト目も)
+static void print_op(u32 op)
+{
+	if (op & 0x100) {
+		printf("0f %02x", op & 0xff);
+	} else {
+		printf("%02x   ", op);
+	}
+}
+
+void OpProfile::report(void)
+{
+	std::vector<u32> keys;
+	u64 total = 0, total_ns = 0;
+	u64 op_count[PROF_OPS] = {0};
+	u64 op_ns[PROF_OPS] = {0};
+
+	for (u32 i = 0; i < PROF_KEYS; i++) {
+		if (count[i] == 0) {
+			continue;
+		}
+		keys.push_back(i);
+		total += count[i];
+		op_count[i & (PROF_OPS - 1)] += count[i];
+	}
+	if (total == 0) {
+		return;
+	}
+	std::sort(keys.begin(), keys.end(), [this](u32 a, u32 b) {
+		return count[a] > count[b];
+	});
+
+	printf("---- opcode profile: %llu instructions ----\n",
+	       (unsigned long long)total);
+	printf("       count      %%  opcode\n");
+	for (u32 k : keys) {
+		printf("%12llu %6.2f  ", (unsigned long long)count[k],
+		       count[k] * 100.0 / total);
+		print_op(k & (PROF_OPS - 1));
+		printf(" %s%s%s%s%s%s\n", (k & PROF_OP32)? "o32" : "o16",
+		       (k & PROF_SEG)? " seg" : "",
+		       (k & PROF_OPSIZE)? " 66" : "",
+		       (k & PROF_ADDRSIZE)? " 67" : "",
+		       (k & PROF_REPE)? " rep" : "",
+		       (k & PROF_REPNE)? " repne" : "");
+	}
+
+	// サンプルした時間の平均に回数を掛けて、命令ごとの時間を推定する
+	keys.clear();
+	for (u32 i = 0; i < PROF_OPS; i++) {
+		if (samples[i] == 0) {
+			continue;
+		}
+		op_ns[i] = ns[i] * op_count[i] / samples[i];
+		total_ns += op_ns[i];
+		keys.push_back(i);
+	}
+	if (total_ns == 0) {
+		return;
+	}
+	std::sort(keys.begin(), keys.end(), [&op_ns](u32 a, u32 b) {
+		return op_ns[a] > op_ns[b];
+	});
+	printf("---- host time (estimated, 1 in %d sampled) ----\n",
+	       PROF_SAMPLE);
+	printf("      total ms      %%  avg ns  opcode\n");
+	for (u32 k : keys) {
+		printf("%14.3f %6.2f %7.1f  ", op_ns[k] / 1e6,
+		       op_ns[k] * 100.0 / total_ns,
+		       (double)ns[k] / samples[k]);
+		print_op(k);
+		printf("\n");
+	}
+}
+#endif // OP_PROFILE
@@ -0,0 +1,61 @@
+#pragma once
+#include <chrono> // for steady_clock
+#include "types.h"
+
+/*
+  命令ごとのプロファイル (OP_PROFILEを定義した時だけ組み込む)
+  - CPU::exec()の命令の後始末で、命令の種類ごとに実行回数を数える
+  - 命令の種類は1バイト目(0x0fなら2バイト目も)、プリフィックス
+    (セグメント、0x66、0x67、REPE、REPNE)の組み合わせ、実効オペランド
+    サイズで分ける
+  - ホスト側の時間は平均PROF_SAMPLE命令に1回だけ、命令の取り出しから
+    後始末までを測り、プリフィックスを除いた命令(1バイト目と0x0fの
+    2バイト目)ごとに足す。報告では回数を掛けて全体の時間を推定する
+  - サンプルの間隔は短いループと同期しないように乱数でずらす
+  - プリフィックスの分の時間は含まない。JITで実行した命令は数えない
+ */
+#define PROF_SAMPLE 64
+
+// キーのビット (下位9ビットは命令。0x100以上は0x0fの2バイト目)
+#define PROF_OP32 0x0200 // 実効オペランドサイズが32bit
+#define PROF_SEG 0x0400
+#define PROF_OPSIZE 0x0800 // 0x66
+#define PROF_ADDRSIZE 0x1000 // 0x67
+#define PROF_REPE 0x2000
+#define PROF_REPNE 0x4000
+#define PROF_KEYS 0x8000
+#define PROF_OPS 0x200
+
+class OpProfile {
+private:
+	u64 count[PROF_KEYS];
+	u64 ns[PROF_OPS]; // サンプルした命令の時間の合計
+	u64 samples[PROF_OPS];
+	u32 left; // 次にサンプルするまでの命令数
+	u32 seed;
+	std::chrono::steady_clock::time_point t0;
+
+public:
+	OpProfile();
+	// 命令を取り出す前に呼ぶ
+	void begin(void) {
+		if (left == 0) {
+			t0 = std::chrono::steady_clock::now();
+		}
+	}
+	// 命令の後始末で呼ぶ
+	void end(u32 key) {
+		count[key]++;
+		if (left-- == 0) {
+			ns[key & (PROF_OPS - 1)] +=
+				std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now() - t0).count();
+			samples[key & (PROF_OPS - 1)]++;
+			// PROF_SAMPLE/2～PROF_SAMPLE*3/2-1命令後
+			seed = seed * 1103515245 + 12345;
+			left = PROF_SAMPLE / 2 + (seed >> 16) % PROF_SAMPLE;
+		}
+	}
+	// 回数の多い順と、推定時間の長い順に書き出す
+	void report(void);
+};
@@ -0,0 +1,149 @@
+#include <cstdio> // for printf()
+#include <cstdlib> // for exit(), strtoul()
+#include <algorithm> // for sort()
+#include "sampler.h"
+#include "cpu.h"
+#include "event.h"
+
+Sampler *Sampler::self = NULL;
+
+Sampler::Sampler(CPU *cpu, Event *ev, s32 period) {
+	this->cpu = cpu;
+	this->ev = ev;
+	this->period = period;
+	depth = 0;
+	nr_samples = 0;
+	folded_path = NULL;
+	self = this;
+}
+
+// 「アドレス 名前」の行を読む (#で始まる行と空行は飛ばす)
+void Sampler::load_symbols(const char *path) {
+	FILE *fp;
+	char line[256], name[200];
+	char *p, *endp;
+	struct _sym s;
+	u32 adr;
+
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		printf("can't open %s\n", path);
+		exit(1);
+	}
+	while (fgets(line, sizeof(line), fp)) {
+		if (line[0] == '#' || sscanf(line, "%*s %199s", name) != 1) {
+			continue;
+		}
+		adr = strtoul(line, &endp, 16);
+		if (*endp == ':') {
+			// セグメント:オフセット
+			p = endp + 1;
+			adr = (adr << 4) + strtoul(p, &endp, 16);
+		}
+		s.adr = adr;
+		s.name = name;
+		syms.push_back(s);
+	}
+	fclose(fp);
+	std::sort(syms.begin(), syms.end(),
+		  [](const struct _sym &a, const struct _sym &b) {
+			  return a.adr < b.adr;
+		  });
+}
+
+// アドレスの手前のシンボルの名前 (なければ16進数のアドレス)
+std::string Sampler::name_of(u32 adr) {
+	char buf[16];
+	auto it = std::upper_bound(syms.begin(), syms.end(), adr,
+				   [](u32 a, const struct _sym &s) {
+					   return a < s.adr;
+				   });
+
+	if (it != syms.begin() && adr - (it - 1)->adr < SAMPLER_SYM_RANGE) {
+		return (it - 1)->name;
+	}
+	snprintf(buf, sizeof(buf), "%08x", adr);
+	return buf;
+}
+
+void Sampler::start(void) {
+	ev->add(period, tick);
+}
+
+void Sampler::tick(void) {
+	Sampler *s = self;
+	u32 pc = s->cpu->get_pc();
+	std::vector<u32> st;
+
+	s->nr_samples++;
+	s->flat[pc]++;
+	if (s->tracking()) {
+		for (int i = 0; i < s->depth && i < SAMPLER_DEPTH; i++) {
+			st.push_back(s->stack[i].func);
+		}
+		st.push_back(pc);
+		s->folded[st]++;
+	}
+	s->ev->add(s->period, tick);
+}
+
+// 名前ごとにまとめたフラットプロファイルと、folded形式のスタック
+void Sampler::report(void) {
+	std::unordered_map<std::string, u64> by_name;
+	std::vector<std::pair<std::string, u64>> v;
+	FILE *fp;
+
+	if (nr_samples == 0) {
+		return;
+	}
+	for (auto &e : flat) {
+		by_name[name_of(e.first)] += e.second;
+	}
+	v.assign(by_name.begin(), by_name.end());
+	std::sort(v.begin(), v.end(),
+		  [](const std::pair<std::string, u64> &a,
+		     const std::pair<std::string, u64> &b) {
+			  return a.second > b.second;
+		  });
+	printf("---- guest profile: %llu samples every %d clocks ----\n",
+	       (unsigned long long)nr_samples, period);
+	printf("   samples      %%  name\n");
+	for (size_t i = 0; i < v.size() && i < SAMPLER_TOP; i++) {
+		printf("%10llu %6.2f  %s\n", (unsigned long long)v[i].second,
+		       v[i].second * 100.0 / nr_samples, v[i].first.c_str());
+	}
+
+	if (!tracking()) {
+		return;
+	}
+	fp = fopen(folded_path, "w");
+	if (fp == NULL) {
+		printf("can't open %s\n", folded_path);
+		return;
+	}
+	// 最後の要素はサンプルしたアドレス。シンボルがなければ呼ばれた
+	// 関数の先頭までにし、あれば同じ関数の中なら重ねない
+	by_name.clear();
+	for (auto &e : folded) {
+		std::string line, name, last;
+		size_t n = e.first.size();
+
+		for (size_t i = 0; i < n; i++) {
+			if (i == n - 1 && i > 0 && syms.empty()) {
+				break;
+			}
+			name = name_of(e.first[i]);
+			if (i == n - 1 && name == last) {
+				break;
+			}
+			line += (i? ";" : "") + name;
+			last = name;
+		}
+		by_name[line] += e.second;
+	}
+	for (auto &e : by_name) {
+		fprintf(fp, "%s %llu\n", e.first.c_str(),
+			(unsigned long long)e.second);
+	}
+	fclose(fp);
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "types.h"
+
+class CPU;
+class Event;
+
+/*
+  ゲストのサンプリングプロファイラ
+  - periodクロックごとにEventで呼ばれ、CS:EIPのリニアアドレスを数える
+    (インタプリタのホットループには何も足さない)
+  - シンボルファイルがあれば、アドレスをその手前のシンボルの名前に
+    まとめる。1行に「アドレス 名前」で、アドレスは16進数のリニア
+    アドレスか、リアルモードのセグメント:オフセット
+  - コールの追跡を有効にすると、CPUがCALL/INTとRET/IRETで
+    call()/ret()を呼び、シャドウスタックを積む。サンプルごとに
+    スタックを記録し、folded形式(「関数;関数;... 回数」)で書き出す
+  - RETではそのリターンアドレスより深いフレーム(ESPが小さいもの)を
+    まとめて捨てるので、スタックを直接書き換えて戻るコードにも追従する
+  - xxx 特権レベルの変わる割り込みでスタックを切り替えたフレームは
+    ESPを比べられない
+ */
+class Sampler {
+private:
+#define SAMPLER_DEPTH 64 // シャドウスタックの深さ
+#define SAMPLER_TOP 40 // フラットプロファイルに書き出す行数
+#define SAMPLER_SYM_RANGE 0x10000 // シンボルからこれ以上離れたら名前なし
+	struct _frame {
+		u32 func; // 呼ばれた先のリニアアドレス
+		u32 top; // リターンアドレスを積んだ後のESP
+	} stack[SAMPLER_DEPTH];
+	int depth; // SAMPLER_DEPTHをこえた分も数える
+
+	struct _sym {
+		u32 adr;
+		std::string name;
+	};
+	std::vector<struct _sym> syms; // アドレス順
+
+	CPU *cpu;
+	Event *ev;
+	s32 period;
+	u64 nr_samples;
+	std::unordered_map<u32, u64> flat;
+	std::map<std::vector<u32>, u64> folded;
+	const char *folded_path; // NULLならコールを追跡しない
+
+	static Sampler *self; // イベントの関数から使う
+	static void tick(void);
+	std::string name_of(u32 adr);
+
+public:
+	Sampler(CPU *cpu, Event *ev, s32 period);
+	void load_symbols(const char *path);
+	void set_folded(const char *path) { folded_path = path; }
+	bool tracking(void) { return folded_path != NULL; }
+	void start(void);
+	void call(u32 func, u32 top) {
+		if (depth < SAMPLER_DEPTH) {
+			stack[depth].func = func;
+			stack[depth].top = top;
+		}
+		depth++;
+	}
+	void ret(u32 top) {
+		// 記録できなかった深さのフレームは1つずつ捨てる
+		if (depth > SAMPLER_DEPTH) {
+			depth--;
+			return;
+		}
+		while (depth > 0 && stack[depth - 1].top <= top) {
+			depth--;
+		}
+	}
+	void report(void);
+};
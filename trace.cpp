@@ -0,0 +1,405 @@
+#include <cstdio> // for printf()
+#include <cstdlib> // for exit()
+#include <cstring> // for memcpy(), memmove(), memcmp()
+#include <chrono> // for milliseconds
+#include "trace.h"
+
+// 1レコードの最大のバイト数
+#define TRACE_MAX_REC (2 + 8 + 8 + 1 + TRACE_MAX_LEN + 4 * 8 + 4 + 2 * 6 + 1 + \
+		       TRACE_MAX_WRITES * (5 + TRACE_WRITE_LEN))
+
+// x以上の2のべき乗
+static u64 pow2(u64 x)
+{
+	u64 p = 1;
+
+	while (p < x) {
+		p <<= 1;
+	}
+	return p;
+}
+
+Trace::Trace(const char *path, u64 flight) {
+	struct trace_header hdr;
+	u64 size = flight? pow2(flight) : TRACE_RING_SIZE;
+
+	this->path = path;
+	fp = fopen(path, "wb");
+	if (fp == NULL) {
+		printf("can't open %s\n", path);
+		exit(1);
+	}
+	buf = new u8[TRACE_BUF_SIZE];
+	nbuf = 0;
+	adr_lo = 0;
+	adr_hi = 0xffffffff;
+	n_from = 0;
+	n_to = ~(u64)0;
+	n = 0;
+
+	// 書き込みは1命令あたり1個より少ないので、wringもringと同じ数にする
+	ring = new struct trace_slot[size];
+	wring = new struct trace_write[size];
+	ring_mask = wring_mask = size - 1;
+	head = whead = 0;
+	tail_seen = wtail_seen = 0;
+	pending = false;
+	this->flight = flight;
+	dumped = false;
+	head_pub = 0;
+	tail = 0;
+	wtail = 0;
+	stop = false;
+	first = true;
+
+	hdr.magic = TRACE_MAGIC;
+	hdr.version = TRACE_VERSION;
+	hdr.rec_size = 0;
+	fwrite(&hdr, sizeof(hdr), 1, fp);
+
+	flusher = flight? NULL : new std::thread(&Trace::flusher_main, this);
+}
+
+Trace::~Trace() {
+	if (pending) {
+		publish();
+	}
+	if (flusher) {
+		stop.store(true, std::memory_order_release);
+		flusher->join();
+		delete flusher;
+	}
+	flush();
+	fclose(fp);
+	delete[] buf;
+	delete[] ring;
+	delete[] wring;
+}
+
+void Trace::flush(void)
+{
+	if (nbuf > 0) {
+		fwrite(buf, 1, nbuf, fp);
+		nbuf = 0;
+	}
+}
+
+// リングが一杯なら書き出しスレッドが進むのを待つ
+void Trace::wait_room(void)
+{
+	for (;;) {
+		tail_seen = tail.load(std::memory_order_acquire);
+		if (head - tail_seen <= ring_mask) {
+			return;
+		}
+		std::this_thread::yield();
+	}
+}
+
+void Trace::wait_wroom(void)
+{
+	for (;;) {
+		wtail_seen = wtail.load(std::memory_order_acquire);
+		if (whead - wtail_seen <= wring_mask) {
+			return;
+		}
+		std::this_thread::yield();
+	}
+}
+
+void Trace::log_write(void *arg, u32 adr, u8 data)
+{
+	Trace *t = (Trace *)arg;
+	struct trace_slot *s = &t->ring[t->head & t->ring_mask];
+	struct trace_write *w;
+
+	if (!t->pending) {
+		return;
+	}
+	// 直前の書き込みの続きならまとめる
+	if (s->nr_writes > 0) {
+		w = &t->wring[(t->whead - 1) & t->wring_mask];
+		if (w->adr + w->len == adr && w->len < TRACE_WRITE_LEN) {
+			w->data[w->len++] = data;
+			return;
+		}
+	}
+	if (s->nr_writes == TRACE_MAX_WRITES) {
+		s->lost = true;
+		return;
+	}
+	if (!t->flight && t->whead - t->wtail_seen > t->wring_mask) {
+		t->wait_wroom();
+	}
+	w = &t->wring[t->whead++ & t->wring_mask];
+	w->adr = adr;
+	w->len = 1;
+	w->data[0] = data;
+	s->nr_writes++;
+}
+
+// 書き出しスレッド: 止めるように言われるまでリングを空にし続ける
+void Trace::flusher_main(void)
+{
+	bool last;
+
+	do {
+		last = stop.load(std::memory_order_acquire);
+		if (drain() == 0 && !last) {
+			flush();
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	} while (!last);
+}
+
+// 書き込み側が確定したレコードを全て書き出し、その数を返す
+u64 Trace::drain(void)
+{
+	u64 h = head_pub.load(std::memory_order_acquire);
+	u64 t = tail.load(std::memory_order_relaxed);
+	struct trace_slot *s = NULL;
+
+	for (u64 k = t; k < h; k++) {
+		s = &ring[k & ring_mask];
+		put_slot(s, false);
+	}
+	if (s) {
+		wtail.store(s->w_first + s->nr_writes, std::memory_order_release);
+		tail.store(h, std::memory_order_release);
+	}
+	return h - t;
+}
+
+/*
+  リングのレコードを書き出す
+  - check_writesなら、wringで上書きされてしまった書き込みを捨てる
+    (フライトレコーダー用。書き込み側のスレッドで呼ぶこと)
+ */
+void Trace::put_slot(const struct trace_slot *s, bool check_writes)
+{
+	struct trace_head h = *s;
+	struct trace_write w[TRACE_MAX_WRITES];
+
+	if (check_writes && whead - s->w_first > wring_mask + 1) {
+		h.nr_writes = 0;
+		h.lost = true;
+	}
+	for (int i = 0; i < h.nr_writes; i++) {
+		w[i] = wring[(s->w_first + i) & wring_mask];
+	}
+	put(&h, w);
+}
+
+void Trace::dump(void)
+{
+	u64 from;
+
+	if (!flight || dumped) {
+		return;
+	}
+	if (pending) {
+		publish();
+	}
+	from = (head > flight)? head - flight : 0;
+	for (u64 k = from; k < head; k++) {
+		put_slot(&ring[k & ring_mask], true);
+	}
+	flush();
+	fflush(fp);
+	dumped = true;
+	printf("trace: wrote the last %llu instructions to %s\n",
+	       (unsigned long long)(head - from), path);
+}
+
+// sを前のレコード(prev)との差分にして書き出す
+void Trace::put(const struct trace_head *s, const struct trace_write *w)
+{
+	u8 *p, *top;
+	u16 mask = 0;
+	int i;
+
+	if (nbuf > TRACE_BUF_SIZE - TRACE_MAX_REC) {
+		flush();
+	}
+	if (first || s->n != prev.n + 1) {
+		mask |= TR_N;
+	}
+	if (first || s->lin != prev.lin + prev.len ||
+	    s->pc != prev.pc + prev.len) {
+		mask |= TR_EIP;
+	}
+	for (i = 0; i < 8; i++) {
+		if (first || s->reg[i] != prev.reg[i]) {
+			mask |= TR_REG(i);
+		}
+	}
+	if (first || s->eflags != prev.eflags) {
+		mask |= TR_FLAGS;
+	}
+	if (first || memcmp(s->sreg, prev.sreg, sizeof(s->sreg)) != 0) {
+		mask |= TR_SREG;
+	}
+	if (s->nr_writes > 0) {
+		mask |= TR_WRITES;
+	}
+	if (s->lost) {
+		mask |= TR_LOST;
+	}
+
+	top = p = buf + nbuf;
+	store16le(p, mask); p += 2;
+	if (mask & TR_N) {
+		store32le(p, (u32)s->n);
+		store32le(p + 4, (u32)(s->n >> 32));
+		p += 8;
+	}
+	if (mask & TR_EIP) {
+		store32le(p, s->lin);
+		store32le(p + 4, s->pc);
+		p += 8;
+	}
+	*p++ = s->len;
+	memcpy(p, s->bytes, s->len); p += s->len;
+	for (i = 0; i < 8; i++) {
+		if (mask & TR_REG(i)) {
+			store32le(p, s->reg[i]); p += 4;
+		}
+	}
+	if (mask & TR_FLAGS) {
+		store32le(p, s->eflags); p += 4;
+	}
+	if (mask & TR_SREG) {
+		for (i = 0; i < 6; i++) {
+			store16le(p, s->sreg[i]); p += 2;
+		}
+	}
+	if (mask & TR_WRITES) {
+		*p++ = s->nr_writes;
+		for (i = 0; i < s->nr_writes; i++) {
+			store32le(p, w[i].adr);
+			p[4] = w[i].len;
+			memcpy(p + 5, w[i].data, w[i].len);
+			p += 5 + w[i].len;
+		}
+	}
+	nbuf += p - top;
+
+	prev = *s;
+	first = false;
+}
+
+TraceReader::TraceReader(const char *path) {
+	struct trace_header hdr;
+
+	fp = fopen(path, "rb");
+	if (fp == NULL) {
+		printf("can't open %s\n", path);
+		exit(1);
+	}
+	if (fread(&hdr, sizeof(hdr), 1, fp) != 1 || hdr.magic != TRACE_MAGIC) {
+		printf("%s is not a trace file\n", path);
+		exit(1);
+	}
+	if (hdr.version != TRACE_VERSION) {
+		printf("%s: trace version %d is not supported\n",
+		       path, hdr.version);
+		exit(1);
+	}
+	buf = new u8[TRACE_BUF_SIZE];
+	pos = len = 0;
+	memset(&st, 0, sizeof(st));
+}
+
+TraceReader::~TraceReader() {
+	fclose(fp);
+	delete[] buf;
+}
+
+// 1レコード分以上がbufに入っているようにする
+void TraceReader::fill(void)
+{
+	if (len - pos >= TRACE_MAX_REC) {
+		return;
+	}
+	memmove(buf, buf + pos, len - pos);
+	len -= pos;
+	pos = 0;
+	len += fread(buf + len, 1, TRACE_BUF_SIZE - len, fp);
+}
+
+const struct trace_state *TraceReader::next(void)
+{
+	struct trace_state *s = &st;
+	u8 *p, *end;
+	u16 mask;
+	int i;
+
+	fill();
+	if (pos == len) {
+		return NULL;
+	}
+	p = buf + pos;
+	end = buf + len;
+	if (end - p < 3) {
+		goto broken;
+	}
+	mask = load16le(p); p += 2;
+	if (mask & TR_N) {
+		s->n = load32le(p) | (u64)load32le(p + 4) << 32;
+		p += 8;
+	} else {
+		s->n++;
+	}
+	if (mask & TR_EIP) {
+		s->lin = load32le(p);
+		s->pc = load32le(p + 4);
+		p += 8;
+	} else {
+		s->lin += s->len;
+		s->pc += s->len;
+	}
+	s->len = *p++;
+	if (s->len > TRACE_MAX_LEN) {
+		goto broken;
+	}
+	memcpy(s->bytes, p, s->len); p += s->len;
+	for (i = 0; i < 8; i++) {
+		if (mask & TR_REG(i)) {
+			s->reg[i] = load32le(p); p += 4;
+		}
+	}
+	if (mask & TR_FLAGS) {
+		s->eflags = load32le(p); p += 4;
+	}
+	if (mask & TR_SREG) {
+		for (i = 0; i < 6; i++) {
+			s->sreg[i] = load16le(p); p += 2;
+		}
+	}
+	s->nr_writes = 0;
+	s->lost = mask & TR_LOST;
+	if (mask & TR_WRITES) {
+		s->nr_writes = *p++;
+		if (s->nr_writes > TRACE_MAX_WRITES) {
+			goto broken;
+		}
+		for (i = 0; i < s->nr_writes; i++) {
+			s->w[i].adr = load32le(p);
+			s->w[i].len = p[4];
+			if (s->w[i].len > TRACE_WRITE_LEN) {
+				goto broken;
+			}
+			memcpy(s->w[i].data, p + 5, s->w[i].len);
+			p += 5 + s->w[i].len;
+		}
+	}
+	if (p > end) {
+		goto broken;
+	}
+	pos = p - buf;
+	return s;
+
+broken:
+	printf("broken trace record\n");
+	exit(1);
+}
@@ -0,0 +1,200 @@
+#pragma once
+#include <cstdio> // for FILE
+#include <atomic>
+#include <thread>
+#include "types.h"
+
+/*
+  実行トレース
+  - CPU::exec()の命令の先頭で、命令実行前のレジスタの状態と命令の
+    バイト列、その命令が書き込んだメモリをバイナリのレコードとして
+    ファイルに書き出す
+  - アドレス範囲(リニアアドレス)と命令数の範囲で記録する命令を絞れる
+  - CPUにTraceが設定されていなければ、ホットループの負担は
+    ポインタのチェック1回だけ
+  - 直前の命令だけを持っておくフライトレコーダーにもできる
+  - ファイルの先頭にはヘッダ(trace_header)があり、その後にレコードが続く
+  - レコードは前のレコードから変わったものだけを持つ可変長で、
+    1命令あたり数バイト～十数バイトになる (TR_で始まるビットを参照)
+  - TraceReaderで読み戻すと、毎回全てのレジスタを埋めたtrace_stateになる
+ */
+#define TRACE_MAGIC 0x52545350 // "PSTR"
+#define TRACE_VERSION 2
+
+struct trace_header {
+	u32 magic;
+	u16 version;
+	u16 rec_size; // バージョン1の固定長レコードのサイズ (2以降は0)
+};
+
+/*
+  レコードの形式 (リトルエンディアン)
+  u16 mask
+  u64 n                 TR_Nが立っていれば (前のレコードのn+1でない)
+  u32 lin, u32 pc       TR_EIPが立っていれば (前の命令の直後でない)
+  u8 len, u8 bytes[len] 命令のバイト列 (プリフィックスを含む)
+  u32 reg[i]            TR_REG(i)が立っているレジスタだけ
+  u32 eflags            TR_FLAGSが立っていれば
+  u16 sreg[6]           TR_SREGが立っていれば
+  u8 nr_writes          TR_WRITESが立っていれば。その後に書き込みが
+                        nr_writes個続く (u32 adr, u8 len, u8 data[len])
+  - 最初のレコードは全てのビットが立っている
+  - レコードは次の命令の先頭で書き出すので、書き込みはその命令のもの
+ */
+#define TR_REG(i) (1 << (i))
+#define TR_FLAGS 0x0100
+#define TR_SREG 0x0200
+#define TR_EIP 0x0400
+#define TR_N 0x0800
+#define TR_WRITES 0x1000
+#define TR_LOST 0x2000 // TRACE_MAX_WRITESをこえた書き込みは捨てた
+
+#define TRACE_MAX_LEN 15 // 命令のバイト列の最大長
+#define TRACE_MAX_WRITES 64 // 1命令で記録する書き込みの数
+#define TRACE_WRITE_LEN 16 // 連続したアドレスへの書き込みはまとめる
+
+struct trace_write {
+	u32 adr; // リニアアドレス
+	u8 len;
+	u8 data[TRACE_WRITE_LEN];
+};
+
+// 命令実行前の状態 (書き込みはnr_writesとlostだけ)
+struct trace_head {
+	u64 n; // 何命令目か (0から)
+	u32 lin; // 命令の先頭のリニアアドレス
+	u32 pc; // eip
+	u32 eflags;
+	u32 reg[8]; // eax, ecx, edx, ebx, esp, ebp, esi, edi
+	u16 sreg[6]; // ES, CS, SS, DS, FS, GS
+	u8 len;
+	u8 bytes[TRACE_MAX_LEN]; // ホスト側のメモリにない場合は0
+	// この命令を実行した時の書き込み (割り込みの受け付けを含む)
+	u8 nr_writes;
+	bool lost;
+};
+
+// 1命令分の記録
+struct trace_state : trace_head {
+	struct trace_write w[TRACE_MAX_WRITES];
+};
+
+// リングバッファの1レコード。書き込みはwringのw_firstからnr_writes個
+struct trace_slot : trace_head {
+	u64 w_first;
+};
+
+/*
+  トレースの書き出し
+  - CPUのスレッド(書き込み側)は命令の状態をリングバッファ(ring)に、
+    メモリへの書き込みを別のリングバッファ(wring)に積むだけで、
+    ファイルには触らない。リングはどちらも1対1のロックフリーで、
+    位置はそれぞれの側だけが進める
+  - 書き出しスレッドがリングから取り出して差分のレコードにし、
+    ファイルに書く。書き出しが追いつかずリングが一杯になった時だけ、
+    書き込み側は空くのを待つ
+  - フライトレコーダー(flightが0以外)ではスレッドを作らず、リングを
+    上書きしながら直前のflight命令分を持っておく。未実装の命令などで
+    dump()が呼ばれた時に、その分だけをファイルに書き出す
+ */
+class Trace {
+private:
+#define TRACE_BUF_SIZE (256 * 1024) // まとめて書き出すバイト数
+#define TRACE_RING_SIZE (1 << 16) // 書き出しスレッドに渡すリングのレコード数
+	const char *path;
+	FILE *fp;
+	u8 *buf;
+	u32 nbuf;
+	u32 adr_lo, adr_hi; // 記録するリニアアドレスの範囲 (adr_hiを含む)
+	u64 n_from, n_to; // 記録する命令数の範囲 (n_toを含まない)
+	u64 n; // これまでに実行した命令数
+
+	// 書き込み側
+	struct trace_slot *ring;
+	struct trace_write *wring;
+	u64 ring_mask, wring_mask; // どちらも2のべき乗-1
+	u64 head, whead; // 次に積む位置
+	u64 tail_seen, wtail_seen; // 最後に読んだtail, wtail
+	bool pending; // ring[head]を記録中 (まだheadを進めていない)
+	u64 flight;
+	bool dumped;
+	void publish(void) {
+		head++;
+		head_pub.store(head, std::memory_order_release);
+		pending = false;
+	}
+	void wait_room(void);
+	void wait_wroom(void);
+
+	// 書き込み側と書き出しスレッドで共有する
+	std::atomic<u64> head_pub; // ここまでのレコードは書き終わった
+	std::atomic<u64> tail, wtail; // ここまでのレコードは書き出した
+	std::atomic<bool> stop;
+	std::thread *flusher;
+
+	// 書き出し側
+	struct trace_head prev; // 最後に書き出したレコード
+	bool first;
+	void open(void);
+	void put(const struct trace_head *s, const struct trace_write *w);
+	void put_slot(const struct trace_slot *s, bool check_writes);
+	u64 drain(void);
+	void flusher_main(void);
+	void flush(void);
+
+public:
+	// flightが0なら全て書き出す。0以外ならフライトレコーダーにする
+	Trace(const char *path, u64 flight = 0);
+	~Trace();
+	void set_range(u32 lo, u32 hi) { adr_lo = lo; adr_hi = hi; }
+	void set_window(u64 from, u64 count) {
+		n_from = from;
+		n_to = (count > ~(u64)0 - from)? ~(u64)0 : from + count;
+	}
+	/*
+	  命令ごとに呼び、記録する命令ならレコードの書き込み先を返す
+	  (呼び出し側でnと書き込み以外を埋める)。記録しない命令ならNULLを
+	  返す。前の命令のレコードはここでリングに確定する
+	 */
+	struct trace_head *want(u32 lin) {
+		u64 i = n++;
+		struct trace_slot *s;
+
+		if (pending) {
+			publish();
+		}
+		if (i < n_from || i >= n_to || lin < adr_lo || lin > adr_hi) {
+			return NULL;
+		}
+		if (!flight && head - tail_seen > ring_mask) {
+			wait_room();
+		}
+		s = &ring[head & ring_mask];
+		s->n = i;
+		s->nr_writes = 0;
+		s->lost = false;
+		s->w_first = whead;
+		pending = true;
+		return s;
+	}
+	// 記録中の命令のメモリへの書き込み (Memory::set_write_log()で登録する)
+	static void log_write(void *arg, u32 adr, u8 data);
+	// フライトレコーダーなら直前の命令をファイルに書き出す (1回だけ)
+	void dump(void);
+};
+
+// トレースを読み戻す (比較ツール用)
+class TraceReader {
+private:
+	FILE *fp;
+	u8 *buf;
+	u32 pos, len; // bufの読んだ位置と、ファイルから読み込んだ長さ
+	struct trace_state st;
+	void fill(void);
+
+public:
+	TraceReader(const char *path);
+	~TraceReader();
+	// 次のレコードを読んで全ての値を埋めたものを返す。最後ならNULL
+	const struct trace_state *next(void);
+};
@@ -0,0 +1,175 @@
+/*
+  実行トレースの比較 (make tracecmp)
+  - 2つのトレース(-tで書き出したもの)を先頭から1レコードずつ読み、
+    最初に食い違ったレコードとその1つ前のレコードを表示して止まる
+  - レコードは命令実行前の状態なので、レジスタが食い違っていれば
+    1つ前の命令の結果が違う。書き込みが食い違っていればその命令の結果が違う
+  - ファイル全体を読み込まないので、何十億命令のトレースでも比べられる
+  - -dでトレースをテキストで表示する
+
+  usage: tracecmp [-n] [-m eflags_mask] a.trc b.trc
+         tracecmp -d a.trc [count]
+ */
+#include <cstdio> // for printf()
+#include <cstdlib> // for strtoul()
+#include <cstring> // for strcmp(), memcmp()
+#include "trace.h"
+
+static const char *reg_name[8] = {
+	"eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi"
+};
+static const char *sreg_name[6] = {"es", "cs", "ss", "ds", "fs", "gs"};
+
+static void print_state(const char *tag, const struct trace_head *s,
+			const struct trace_write *w)
+{
+	int i, j;
+
+	printf("%s n=%llu %04x:%08x (lin %08x) ", tag,
+	       (unsigned long long)s->n, s->sreg[1], s->pc, s->lin);
+	for (i = 0; i < s->len; i++) {
+		printf(" %02x", s->bytes[i]);
+	}
+	printf("\n  ");
+	for (i = 0; i < 8; i++) {
+		printf("%s:%08x%s", reg_name[i], s->reg[i],
+		       (i == 3)? "   " : " ");
+		if (i == 3) {
+			printf("eflags:%08x\n  ", s->eflags);
+		}
+	}
+	printf("\n  ");
+	for (i = 0; i < 6; i++) {
+		printf("%s:%04x ", sreg_name[i], s->sreg[i]);
+	}
+	printf("\n");
+	if (w == NULL) {
+		return;
+	}
+	for (i = 0; i < s->nr_writes; i++) {
+		printf("  write %08x:", w[i].adr);
+		for (j = 0; j < w[i].len; j++) {
+			printf(" %02x", w[i].data[j]);
+		}
+		printf("\n");
+	}
+	if (s->lost) {
+		printf("  (more writes were not recorded)\n");
+	}
+}
+
+// 食い違った項目の名前を返す。同じならNULL
+static const char *diff(const struct trace_state *a,
+			const struct trace_state *b, bool cmp_n, u32 fmask)
+{
+	static char buf[16];
+	int i;
+
+	if (cmp_n && a->n != b->n) {
+		return "instruction number";
+	}
+	if (a->lin != b->lin || a->pc != b->pc) {
+		return "eip";
+	}
+	if (a->len != b->len || memcmp(a->bytes, b->bytes, a->len) != 0) {
+		return "instruction bytes";
+	}
+	for (i = 0; i < 8; i++) {
+		if (a->reg[i] != b->reg[i]) {
+			return reg_name[i];
+		}
+	}
+	if ((a->eflags ^ b->eflags) & fmask) {
+		return "eflags";
+	}
+	for (i = 0; i < 6; i++) {
+		if (a->sreg[i] != b->sreg[i]) {
+			return sreg_name[i];
+		}
+	}
+	if (a->nr_writes != b->nr_writes || a->lost != b->lost) {
+		return "number of writes";
+	}
+	for (i = 0; i < a->nr_writes; i++) {
+		if (a->w[i].adr != b->w[i].adr || a->w[i].len != b->w[i].len ||
+		    memcmp(a->w[i].data, b->w[i].data, a->w[i].len) != 0) {
+			snprintf(buf, sizeof(buf), "write #%d", i);
+			return buf;
+		}
+	}
+	return NULL;
+}
+
+static int dump(const char *path, u64 count)
+{
+	TraceReader r(path);
+	const struct trace_state *s;
+	char tag[24];
+
+	for (u64 i = 0; i < count && (s = r.next()) != NULL; i++) {
+		snprintf(tag, sizeof(tag), "#%llu", (unsigned long long)i);
+		print_state(tag, s, s->w);
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	bool cmp_n = true;
+	u32 fmask = 0xffffffff;
+	int i = 1;
+	u64 k;
+	const char *what;
+	const struct trace_state *a, *b;
+	struct trace_head prev; // 1つ前のレコード (書き込みは除く)
+
+	for (; i < argc && argv[i][0] == '-'; i++) {
+		if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+			return dump(argv[i + 1], (i + 2 < argc)?
+				    strtoull(argv[i + 2], NULL, 0) : ~(u64)0);
+		} else if (strcmp(argv[i], "-n") == 0) {
+			cmp_n = false;
+		} else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+			fmask = strtoul(argv[++i], NULL, 16);
+		} else {
+			break;
+		}
+	}
+	if (argc - i != 2) {
+		printf("usage: tracecmp [-n] [-m eflags_mask] a.trc b.trc\n");
+		printf("       tracecmp -d a.trc [count]\n");
+		printf("  -n  don't compare instruction numbers\n");
+		printf("  -m  compare only these eflags bits (hex)\n");
+		printf("  -d  print records as text\n");
+		return 2;
+	}
+
+	TraceReader ra(argv[i]), rb(argv[i + 1]);
+	for (k = 0;; k++) {
+		a = ra.next();
+		b = rb.next();
+		if (a == NULL || b == NULL) {
+			break;
+		}
+		what = diff(a, b, cmp_n, fmask);
+		if (what) {
+			printf("diverged at record #%llu (%s)\n",
+			       (unsigned long long)k, what);
+			if (k > 0) {
+				print_state("prev", &prev, NULL);
+			}
+			print_state("a   ", a, a->w);
+			print_state("b   ", b, b->w);
+			return 1;
+		}
+		prev = *a;
+	}
+	if (a != NULL || b != NULL) {
+		printf("%s ended at record #%llu\n",
+		       (a == NULL)? argv[i] : argv[i + 1],
+		       (unsigned long long)k);
+		return 1;
+	}
+	printf("%llu records match\n", (unsigned long long)k);
+	return 0;
+}
@@ -1,4 +1,6 @@
+#pragma once
 #include <cstdint>  // for uint?_t
+#include <cstring>  // for memcpy()
 
 /*-----
 このコメントは以下で消せる [2019-07-16]
@@ -51,3 +53,40 @@ typedef int64_t s64;
 #endif
 // big endianマシンでは以下を有効にする
 //#define BIG_ENDIAN
+
+/*
+  ホスト側のメモリ上のリトルエンディアンの値を読み書きする
+  - アラインされていないアドレスでも良い(memcpyはコンパイラが1命令にする)
+  - big endianマシンではバイトスワップする
+ */
+static inline u16 load16le(const u8 *p) {
+	u16 v;
+	memcpy(&v, p, 2);
+#ifdef BIG_ENDIAN
+	v = __builtin_bswap16(v);
+#endif
+	return v;
+}
+
+static inline u32 load32le(const u8 *p) {
+	u32 v;
+	memcpy(&v, p, 4);
+#ifdef BIG_ENDIAN
+	v = __builtin_bswap32(v);
+#endif
+	return v;
+}
+
+static inline void store16le(u8 *p, u16 v) {
+#ifdef BIG_ENDIAN
+	v = __builtin_bswap16(v);
+#endif
+	memcpy(p, &v, 2);
+}
+
+static inline void store32le(u8 *p, u32 v) {
+#ifdef BIG_ENDIAN
+	v = __builtin_bswap32(v);
+#endif
+	memcpy(p, &v, 4);
+}